@@ -0,0 +1,181 @@
+/*
+** BSD 3-Clause License
+**
+** Copyright (c) 2018, David Boucher
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**
+** * Redistributions of source code must retain the above copyright notice,
+**   this list of conditions and the following disclaimer.
+**
+** * Redistributions in binary form must reproduce the above copyright notice,
+**   this list of conditions and the following disclaimer in the documentation
+**   and/or other materials provided with the distribution.
+**
+** * Neither the name of the copyright holder nor the names of its
+**   contributors may be used to endorse or promote products derived from
+**   this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+** LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+** CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+** SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+** INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+** CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+** ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+** POSSIBILITY OF SUCH DAMAGE.
+*/
+#include <string.h>
+#include "batch.h"
+#include "members.h"
+
+/**
+ *  BatchCreate Reads the members of a set and the given fields of each row.
+ *
+ * @param ctx The Redis context
+ * @param set The set
+ * @param fields The fields to read
+ * @param fields_count The fields count
+ *
+ * @return The batch, or NULL if set is not a set.
+ */
+Batch *BatchCreate(RedisModuleCtx *ctx, RedisModuleString *set,
+                   RedisModuleString **fields, int fields_count) {
+    RedisModuleString **members;
+    long long count;
+    if (GetMembers(ctx, set, NULL, &members, &count) == REDISMODULE_ERR)
+        return NULL;
+
+    Batch *batch = RedisModule_Alloc(sizeof(Batch));
+    batch->set = set;
+    batch->members = members;
+    batch->count = count;
+    batch->fields = fields;
+    batch->fields_count = fields_count;
+    batch->values = RedisModule_Calloc(
+            (size_t)count * fields_count + 1, sizeof(RedisModuleString *));
+    StrTableInit(&batch->rows, count);
+
+    for (long long i = 0; i < count; ++i) {
+        size_t len;
+        const char *k = RedisModule_StringPtrLen(members[i], &len);
+        StrTableAdd(&batch->rows, k, len)->value = i;
+        if (fields_count == 0)
+            continue;
+        /* A member may have no hash, its values are then missing */
+        RedisModuleKey *key = RedisModule_OpenKey(ctx, members[i],
+                                                  REDISMODULE_READ);
+        if (key && RedisModule_KeyType(key) == REDISMODULE_KEYTYPE_HASH) {
+            for (int f = 0; f < fields_count; ++f) {
+                RedisModule_HashGet(key, REDISMODULE_HASH_NONE, fields[f],
+                                    &batch->values[(size_t)i * fields_count + f],
+                                    NULL);
+            }
+        }
+        if (key)
+            RedisModule_CloseKey(key);
+    }
+    return batch;
+}
+
+/**
+ *  BatchMembers Gives the rows keys of a query from the batch, when it reads
+ *  the batch set alone.
+ *
+ * @param ctx The Redis context
+ * @param batch The batch
+ * @param set The main set of the query
+ * @param options The query options
+ * @param[out] members An allocated array containing the rows keys, to free
+ *                     with RedisModule_Free, keys are owned by the caller.
+ * @param[out] count The number of rows keys.
+ *
+ * @return REDISMODULE_OK, or REDISMODULE_ERR if the batch does not have
+ *         these rows.
+ */
+int BatchMembers(RedisModuleCtx *ctx, Batch *batch, RedisModuleString *set,
+                 TabularOptions *options, RedisModuleString ***members,
+                 long long *count) {
+    if ((options && options->set_op != TABULAR_SET_NONE)
+        || RedisModule_StringCompare(set, batch->set))
+        return REDISMODULE_ERR;
+
+    *members = RedisModule_Alloc(
+            (batch->count ? batch->count : 1) * sizeof(RedisModuleString *));
+    for (long long i = 0; i < batch->count; ++i) {
+        RedisModule_RetainString(ctx, batch->members[i]);
+        (*members)[i] = batch->members[i];
+    }
+    *count = batch->count;
+    return REDISMODULE_OK;
+}
+
+/**
+ *  BatchColumn Gives the column of a field in the batch
+ *
+ * @return The column index or -1 if the field is not read by the batch.
+ */
+int BatchColumn(Batch *batch, RedisModuleString *field) {
+    for (int f = 0; f < batch->fields_count; ++f) {
+        if (RedisModule_StringCompare(field, batch->fields[f]) == 0)
+            return f;
+    }
+    return -1;
+}
+
+/**
+ *  BatchRow Gives the index of a row in the batch
+ *
+ * @return The row index or -1 if the row is not in the batch set.
+ */
+long long BatchRow(Batch *batch, RedisModuleString *key) {
+    size_t len;
+    const char *k = RedisModule_StringPtrLen(key, &len);
+    StrEntry *e = StrTableFind(&batch->rows, k, len);
+    return e ? e->value : -1;
+}
+
+/**
+ *  BatchValue Gives a value read by the batch
+ *
+ * @param ctx The Redis context
+ * @param batch The batch
+ * @param row The row index
+ * @param column The field column
+ *
+ * @return The value, to free with RedisModule_FreeString, or NULL if the row
+ *         has no such field.
+ */
+RedisModuleString *BatchValue(RedisModuleCtx *ctx, Batch *batch,
+                              long long row, int column) {
+    RedisModuleString *value =
+            batch->values[(size_t)row * batch->fields_count + column];
+    if (value)
+        RedisModule_RetainString(ctx, value);
+    return value;
+}
+
+/**
+ *  BatchFree Frees a batch
+ *
+ * @param ctx The Redis context
+ * @param batch The batch
+ */
+void BatchFree(RedisModuleCtx *ctx, Batch *batch) {
+    size_t size = (size_t)batch->count * batch->fields_count;
+    for (size_t i = 0; i < size; ++i) {
+        if (batch->values[i])
+            RedisModule_FreeString(ctx, batch->values[i]);
+    }
+    for (long long i = 0; i < batch->count; ++i)
+        RedisModule_FreeString(ctx, batch->members[i]);
+    StrTableFree(&batch->rows);
+    RedisModule_Free(batch->values);
+    RedisModule_Free(batch->members);
+    RedisModule_Free(batch);
+}
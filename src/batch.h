@@ -0,0 +1,64 @@
+#ifndef __BATCH_H__
+#define __BATCH_H__
+/*
+** BSD 3-Clause License
+**
+** Copyright (c) 2018, David Boucher
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**
+** * Redistributions of source code must retain the above copyright notice,
+**   this list of conditions and the following disclaimer.
+**
+** * Redistributions in binary form must reproduce the above copyright notice,
+**   this list of conditions and the following disclaimer in the documentation
+**   and/or other materials provided with the distribution.
+**
+** * Neither the name of the copyright holder nor the names of its
+**   contributors may be used to endorse or promote products derived from
+**   this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+** LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+** CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+** SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+** INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+** CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+** ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+** POSSIBILITY OF SUCH DAMAGE.
+*/
+#include "strtable.h"
+#include "tabular.h"
+
+/* The rows of a set read once for the queries of a TABULAR.BATCH */
+typedef struct _Batch Batch;
+struct _Batch {
+    RedisModuleString *set;
+    RedisModuleString **members;
+    long long count;
+    /* The fields read for each row, they point into argv */
+    RedisModuleString **fields;
+    int fields_count;
+    /* count rows of fields_count values */
+    RedisModuleString **values;
+    /* row key -> row index */
+    StrTable rows;
+};
+
+Batch *BatchCreate(RedisModuleCtx *ctx, RedisModuleString *set,
+                   RedisModuleString **fields, int fields_count);
+int BatchMembers(RedisModuleCtx *ctx, Batch *batch, RedisModuleString *set,
+                 TabularOptions *options, RedisModuleString ***members,
+                 long long *count);
+int BatchColumn(Batch *batch, RedisModuleString *field);
+long long BatchRow(Batch *batch, RedisModuleString *key);
+RedisModuleString *BatchValue(RedisModuleCtx *ctx, Batch *batch,
+                              long long row, int column);
+void BatchFree(RedisModuleCtx *ctx, Batch *batch);
+
+#endif /*__BATCH_H__*/
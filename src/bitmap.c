@@ -0,0 +1,112 @@
+/*
+** BSD 3-Clause License
+**
+** Copyright (c) 2018, David Boucher
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**
+** * Redistributions of source code must retain the above copyright notice,
+**   this list of conditions and the following disclaimer.
+**
+** * Redistributions in binary form must reproduce the above copyright notice,
+**   this list of conditions and the following disclaimer in the documentation
+**   and/or other materials provided with the distribution.
+**
+** * Neither the name of the copyright holder nor the names of its
+**   contributors may be used to endorse or promote products derived from
+**   this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+** LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+** CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+** SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+** INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+** CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+** ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+** POSSIBILITY OF SUCH DAMAGE.
+*/
+#include <string.h>
+#include "bitmap.h"
+#include "redismodule.h"
+
+#define WORDS(size) (((size) + 63) >> 6)
+
+/**
+ *  BitmapCreate Creates a bitmap
+ *
+ * @param size The number of ids
+ * @param fill 1 to start with all the ids, 0 to start empty
+ *
+ * @return The bitmap, to free with BitmapFree
+ */
+Bitmap *BitmapCreate(long long size, int fill) {
+    Bitmap *retval = RedisModule_Alloc(sizeof(Bitmap));
+    long long n = WORDS(size);
+    retval->size = size;
+    retval->words = RedisModule_Alloc((n ? n : 1) * sizeof(uint64_t));
+    memset(retval->words, fill ? 0xff : 0, n * sizeof(uint64_t));
+    /* Bits after size are always cleared */
+    if (fill && (size & 63))
+        retval->words[n - 1] = ((uint64_t)1 << (size & 63)) - 1;
+    return retval;
+}
+
+void BitmapFree(Bitmap *bm) {
+    RedisModule_Free(bm->words);
+    RedisModule_Free(bm);
+}
+
+/**
+ *  BitmapNext Gets the first id of the bitmap greater or equal to from
+ *
+ * @param bm The bitmap
+ * @param from The id to start from
+ *
+ * @return The found id or -1 if there is none.
+ */
+long long BitmapNext(const Bitmap *bm, long long from) {
+    if (from >= bm->size)
+        return -1;
+    long long i = from >> 6;
+    uint64_t w = bm->words[i] & (~(uint64_t)0 << (from & 63));
+    long long n = WORDS(bm->size);
+    while (!w) {
+        if (++i >= n)
+            return -1;
+        w = bm->words[i];
+    }
+    return (i << 6) + __builtin_ctzll(w);
+}
+
+/**
+ *  BitmapAnd Keeps in dst only the ids also in src. Both bitmaps must have
+ *  the same size.
+ *
+ * @param dst The bitmap to restrict
+ * @param src The bitmap to intersect with
+ */
+void BitmapAnd(Bitmap *dst, const Bitmap *src) {
+    long long n = WORDS(dst->size);
+    for (long long i = 0; i < n; ++i)
+        dst->words[i] &= src->words[i];
+}
+
+/**
+ *  BitmapCount Counts the ids of a bitmap
+ *
+ * @param bm The bitmap
+ *
+ * @return The number of ids
+ */
+long long BitmapCount(const Bitmap *bm) {
+    long long retval = 0;
+    long long n = WORDS(bm->size);
+    for (long long i = 0; i < n; ++i)
+        retval += __builtin_popcountll(bm->words[i]);
+    return retval;
+}
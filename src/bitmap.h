@@ -0,0 +1,58 @@
+#ifndef __BITMAP_H__
+#define __BITMAP_H__
+/*
+** BSD 3-Clause License
+**
+** Copyright (c) 2018, David Boucher
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**
+** * Redistributions of source code must retain the above copyright notice,
+**   this list of conditions and the following disclaimer.
+**
+** * Redistributions in binary form must reproduce the above copyright notice,
+**   this list of conditions and the following disclaimer in the documentation
+**   and/or other materials provided with the distribution.
+**
+** * Neither the name of the copyright holder nor the names of its
+**   contributors may be used to endorse or promote products derived from
+**   this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+** LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+** CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+** SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+** INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+** CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+** ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+** POSSIBILITY OF SUCH DAMAGE.
+*/
+#include <stdint.h>
+
+/* A set of row ids. Ids are dense, from 0 to size - 1 */
+typedef struct _Bitmap Bitmap;
+struct _Bitmap {
+    uint64_t *words;
+    long long size;
+};
+
+Bitmap *BitmapCreate(long long size, int fill);
+void BitmapFree(Bitmap *bm);
+long long BitmapNext(const Bitmap *bm, long long from);
+void BitmapAnd(Bitmap *dst, const Bitmap *src);
+long long BitmapCount(const Bitmap *bm);
+
+static inline void BitmapSet(Bitmap *bm, long long id) {
+    bm->words[id >> 6] |= (uint64_t)1 << (id & 63);
+}
+
+static inline void BitmapClear(Bitmap *bm, long long id) {
+    bm->words[id >> 6] &= ~((uint64_t)1 << (id & 63));
+}
+
+#endif /*__BITMAP_H__*/
@@ -0,0 +1,663 @@
+/*
+** BSD 3-Clause License
+**
+** Copyright (c) 2018, David Boucher
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**
+** * Redistributions of source code must retain the above copyright notice,
+**   this list of conditions and the following disclaimer.
+**
+** * Redistributions in binary form must reproduce the above copyright notice,
+**   this list of conditions and the following disclaimer in the documentation
+**   and/or other materials provided with the distribution.
+**
+** * Neither the name of the copyright holder nor the names of its
+**   contributors may be used to endorse or promote products derived from
+**   this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+** LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+** CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+** SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+** INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+** CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+** ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+** POSSIBILITY OF SUCH DAMAGE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "cache.h"
+#include "packed.h"
+
+struct _CacheDep {
+    char *key;
+    size_t len;
+    CacheEntry **entries;
+    int count;
+    int size;
+};
+
+/* The dependencies of the cached replies of a database */
+typedef struct _CacheDb CacheDb;
+struct _CacheDb {
+    /* key -> CacheDep */
+    StrTable deps;
+};
+
+/* query -> CacheEntry */
+static StrTable queries;
+
+static CacheDb *dbs = NULL;
+static int dbs_count = 0;
+
+/* The LRU list */
+static CacheEntry *first = NULL;
+static CacheEntry *last = NULL;
+
+static size_t memory = 0;
+static size_t max_memory = CACHE_DEFAULT_SIZE;
+
+static long long hits = 0;
+static long long misses = 0;
+static long long evictions = 0;
+static long long invalidations = 0;
+
+/**
+ *  GetDb Gives the dependencies of a database, allocated on demand
+ */
+static CacheDb *GetDb(int db) {
+    if (db >= dbs_count) {
+        dbs = RedisModule_Realloc(dbs, (db + 1) * sizeof(CacheDb));
+        for (int i = dbs_count; i <= db; ++i)
+            StrTableInit(&dbs[i].deps, 0);
+        dbs_count = db + 1;
+    }
+    return &dbs[db];
+}
+
+/**
+ *  Account Adds memory used by an entry
+ */
+static void Account(CacheEntry *entry, size_t bytes) {
+    entry->memory += bytes;
+    memory += bytes;
+}
+
+/**
+ *  DepMemory The memory used by a dependency
+ */
+static size_t DepMemory(CacheDep *dep) {
+    return sizeof(CacheDep) + dep->len + 1 + dep->size * sizeof(CacheEntry *)
+           + 2 * sizeof(StrEntry);
+}
+
+/**
+ *  Unlink Removes an entry from its dependencies, the ones left without
+ *  entry are freed.
+ *
+ * @param entry The entry
+ */
+static void Unlink(CacheEntry *entry) {
+    CacheDb *db = GetDb(entry->db);
+    for (int i = 0; i < entry->deps_count; ++i) {
+        CacheDep *dep = entry->deps[i];
+        for (int j = dep->count - 1; j >= 0; --j) {
+            if (dep->entries[j] == entry) {
+                dep->entries[j] = dep->entries[--dep->count];
+                break;
+            }
+        }
+        if (dep->count == 0) {
+            StrTableDel(&db->deps, StrTableFind(&db->deps, dep->key, dep->len));
+            memory -= DepMemory(dep);
+            RedisModule_Free(dep->entries);
+            RedisModule_Free(dep->key);
+            RedisModule_Free(dep);
+        }
+    }
+    RedisModule_Free(entry->deps);
+    entry->deps = NULL;
+    entry->deps_count = 0;
+}
+
+/**
+ *  CheckSize Marks an entry stale once it exceeds the memory cap, with its
+ *  dependencies, and unlinks it. Its reply is still recorded, but it will
+ *  not be stored and it declares no more dependencies.
+ *
+ * @param entry The entry
+ */
+static void CheckSize(CacheEntry *entry) {
+    if (!entry->stale && entry->memory + entry->deps_memory > max_memory) {
+        Unlink(entry);
+        entry->stale = 1;
+    }
+}
+
+/**
+ *  FreeEntry Frees an entry that is not in the cache
+ *
+ * @param ctx The Redis context
+ * @param entry The entry
+ */
+static void FreeEntry(RedisModuleCtx *ctx, CacheEntry *entry) {
+    Unlink(entry);
+    for (int i = 0; i < entry->count; ++i) {
+        if (entry->items[i].str)
+            RedisModule_FreeString(ctx, entry->items[i].str);
+    }
+    memory -= entry->memory;
+    RedisModule_Free(entry->items);
+    RedisModule_Free(entry->query);
+    RedisModule_Free(entry);
+}
+
+/**
+ *  Drop Removes an entry from the cache and frees it
+ *
+ * @param ctx The Redis context
+ * @param entry The entry
+ */
+static void Drop(RedisModuleCtx *ctx, CacheEntry *entry) {
+    StrTableDel(&queries, StrTableFind(&queries, entry->query, entry->len));
+    if (entry->prev)
+        entry->prev->next = entry->next;
+    else
+        first = entry->next;
+    if (entry->next)
+        entry->next->prev = entry->prev;
+    else
+        last = entry->prev;
+    FreeEntry(ctx, entry);
+}
+
+/**
+ *  Fingerprint Reads the type and the length of the first key an entry
+ *  depends on, which is the set of the rows.
+ *
+ * @param ctx The Redis context
+ * @param entry The entry
+ * @param type The key type is stored here
+ * @param len The key length is stored here
+ */
+static void Fingerprint(RedisModuleCtx *ctx, CacheEntry *entry, int *type,
+                        size_t *len) {
+    *type = REDISMODULE_KEYTYPE_EMPTY;
+    *len = 0;
+    if (entry->deps_count == 0)
+        return;
+    CacheDep *dep = entry->deps[0];
+    RedisModuleString *name = RedisModule_CreateString(ctx, dep->key,
+                                                       dep->len);
+    RedisModuleKey *key = RedisModule_OpenKey(ctx, name, REDISMODULE_READ);
+    *type = RedisModule_KeyType(key);
+    *len = RedisModule_ValueLength(key);
+    RedisModule_CloseKey(key);
+    RedisModule_FreeString(ctx, name);
+}
+
+/**
+ *  CheckEntry Checks that the set of the rows of an entry has the type and
+ *  the length it had when the entry was stored. FLUSHDB, FLUSHALL, SWAPDB
+ *  and a full resynchronization are not notified, this catches them unless
+ *  the set is replaced by one of the same size.
+ *
+ * @param ctx The Redis context
+ * @param entry The entry
+ *
+ * @return 1 if the entry is still valid, 0 otherwise.
+ */
+static int CheckEntry(RedisModuleCtx *ctx, CacheEntry *entry) {
+    int type;
+    size_t len;
+    Fingerprint(ctx, entry, &type, &len);
+    return type == entry->key_type && len == entry->key_len;
+}
+
+/**
+ *  CacheQuery Builds the cache key of a command, made of the current database and
+ *  of the arguments, each one prefixed by its length.
+ *
+ * @param ctx The Redis context
+ * @param argv The arguments following the command name
+ * @param argc The arguments count
+ * @param len The query length is stored here
+ *
+ * @return The query, to free with RedisModule_Free
+ */
+char *CacheQuery(RedisModuleCtx *ctx, RedisModuleString **argv, int argc,
+                 size_t *len) {
+    size_t size = 32;
+    for (int i = 0; i < argc; ++i) {
+        size_t l;
+        RedisModule_StringPtrLen(argv[i], &l);
+        size += l + 24;
+    }
+    char *query = RedisModule_Alloc(size);
+    size_t pos = sprintf(query, "%d", RedisModule_GetSelectedDb(ctx));
+    for (int i = 0; i < argc; ++i) {
+        size_t l;
+        const char *a = RedisModule_StringPtrLen(argv[i], &l);
+        pos += sprintf(query + pos, "\n%zu:", l);
+        memcpy(query + pos, a, l);
+        pos += l;
+    }
+    *len = pos;
+    return query;
+}
+
+/**
+ *  CacheReplyIfCached Replies with the cached reply of a command if there is
+ *  one.
+ *
+ * @param ctx The Redis context
+ * @param argv The arguments following the command name
+ * @param argc The arguments count
+ *
+ * @return 1 if the reply was cached, 0 otherwise.
+ */
+int CacheReplyIfCached(RedisModuleCtx *ctx, RedisModuleString **argv,
+                       int argc) {
+    if (max_memory == 0)
+        return 0;
+
+    size_t len;
+    char *query = CacheQuery(ctx, argv, argc, &len);
+    StrEntry *e = StrTableFind(&queries, query, len);
+    RedisModule_Free(query);
+    if (e && !CheckEntry(ctx, e->ptr)) {
+        Drop(ctx, e->ptr);
+        invalidations++;
+        e = NULL;
+    }
+    if (e == NULL) {
+        misses++;
+        return 0;
+    }
+
+    CacheEntry *entry = e->ptr;
+    if (entry != first) {
+        entry->prev->next = entry->next;
+        if (entry->next)
+            entry->next->prev = entry->prev;
+        else
+            last = entry->prev;
+        entry->prev = NULL;
+        entry->next = first;
+        first->prev = entry;
+        first = entry;
+    }
+    hits++;
+    CacheReply(ctx, entry);
+    return 1;
+}
+
+/**
+ *  CacheCreate Creates an entry to record the reply of a command. The entry
+ *  is then given to CacheStore or CacheDiscard.
+ *
+ * @param ctx The Redis context
+ * @param argv The arguments following the command name
+ * @param argc The arguments count
+ *
+ * @return The new entry
+ */
+CacheEntry *CacheCreate(RedisModuleCtx *ctx, RedisModuleString **argv,
+                        int argc) {
+    CacheEntry *entry = RedisModule_Calloc(1, sizeof(CacheEntry));
+    entry->query = CacheQuery(ctx, argv, argc, &entry->len);
+    entry->db = RedisModule_GetSelectedDb(ctx);
+    /* The reply is just recorded when the cache is disabled */
+    entry->stale = max_memory == 0;
+    Account(entry, sizeof(CacheEntry) + entry->len);
+    return entry;
+}
+
+/**
+ *  CacheDepend Declares a key the reply of an entry is computed from. Any
+ *  event on this key drops the entry.
+ *
+ * @param entry The entry
+ * @param key The key name
+ * @param len The key name length
+ */
+void CacheDepend(CacheEntry *entry, const char *key, size_t len) {
+    if (entry->stale)
+        return;
+
+    CacheDb *db = GetDb(entry->db);
+    StrEntry *e = StrTableFind(&db->deps, key, len);
+    CacheDep *dep;
+    if (e)
+        dep = e->ptr;
+    else {
+        dep = RedisModule_Calloc(1, sizeof(CacheDep));
+        dep->key = RedisModule_Alloc(len + 1);
+        memcpy(dep->key, key, len);
+        dep->key[len] = 0;
+        dep->len = len;
+        StrTableAdd(&db->deps, dep->key, len)->ptr = dep;
+        memory += DepMemory(dep);
+        entry->deps_memory += DepMemory(dep);
+    }
+
+    /* The entry declares its dependencies in a row */
+    if (dep->count > 0 && dep->entries[dep->count - 1] == entry)
+        return;
+
+    if (dep->count == dep->size) {
+        int size = dep->size ? 2 * dep->size : 2;
+        dep->entries = RedisModule_Realloc(dep->entries,
+                                           size * sizeof(CacheEntry *));
+        memory += (size - dep->size) * sizeof(CacheEntry *);
+        dep->size = size;
+    }
+    dep->entries[dep->count++] = entry;
+    entry->deps_memory += sizeof(CacheEntry *);
+
+    if (entry->deps_count == entry->deps_size) {
+        int size = entry->deps_size ? 2 * entry->deps_size : 16;
+        entry->deps = RedisModule_Realloc(entry->deps,
+                                          size * sizeof(CacheDep *));
+        Account(entry, (size - entry->deps_size) * sizeof(CacheDep *));
+        entry->deps_size = size;
+    }
+    entry->deps[entry->deps_count++] = dep;
+    CheckSize(entry);
+}
+
+/**
+ *  AddItem Appends an item to the reply of an entry
+ */
+static CacheItem *AddItem(CacheEntry *entry, char type) {
+    if (entry->count == entry->size) {
+        int size = entry->size ? 2 * entry->size : 16;
+        entry->items = RedisModule_Realloc(entry->items,
+                                           size * sizeof(CacheItem));
+        Account(entry, (size - entry->size) * sizeof(CacheItem));
+        entry->size = size;
+        CheckSize(entry);
+    }
+    CacheItem *item = &entry->items[entry->count++];
+    item->type = type;
+    item->num = 0;
+    item->str = NULL;
+    return item;
+}
+
+/**
+ *  CacheAddArray Records the header of an array of len elements
+ */
+void CacheAddArray(CacheEntry *entry, long long len) {
+    AddItem(entry, CACHE_ARRAY)->num = len;
+}
+
+/**
+ *  CacheAddLongLong Records an integer
+ */
+void CacheAddLongLong(CacheEntry *entry, long long value) {
+    AddItem(entry, CACHE_INTEGER)->num = value;
+}
+
+/**
+ *  CacheAddString Records a string. It is retained, the caller still has to
+ *  free its own reference.
+ */
+void CacheAddString(RedisModuleCtx *ctx, CacheEntry *entry,
+                    RedisModuleString *str) {
+    size_t len;
+    RedisModule_StringPtrLen(str, &len);
+    RedisModule_RetainString(ctx, str);
+    AddItem(entry, CACHE_STRING)->str = str;
+    Account(entry, len + CACHE_STRING_OVERHEAD);
+    CheckSize(entry);
+}
+
+/**
+ *  CacheAddNull Records a null
+ */
+void CacheAddNull(CacheEntry *entry) {
+    AddItem(entry, CACHE_NULL);
+}
+
+/**
+ *  CacheReplyWithItems Replies with recorded items
+ *
+ * @param ctx The Redis context
+ * @param items The items
+ * @param count The items count
+ */
+void CacheReplyWithItems(RedisModuleCtx *ctx, CacheItem *items, int count) {
+    for (int i = 0; i < count; ++i) {
+        CacheItem *item = &items[i];
+        switch (item->type) {
+            case CACHE_ARRAY:
+                RedisModule_ReplyWithArray(ctx, item->num);
+                break;
+            case CACHE_INTEGER:
+                RedisModule_ReplyWithLongLong(ctx, item->num);
+                break;
+            case CACHE_STRING:
+                RedisModule_ReplyWithString(ctx, item->str);
+                break;
+            default:
+                RedisModule_ReplyWithNull(ctx);
+        }
+    }
+}
+
+/**
+ *  CacheReply Replies with the reply recorded in an entry
+ *
+ * @param ctx The Redis context
+ * @param entry The entry
+ */
+void CacheReply(RedisModuleCtx *ctx, CacheEntry *entry) {
+    CacheReplyWithItems(ctx, entry->items, entry->count);
+}
+
+/**
+ *  CachePack Replaces the recorded items of an entry by a single string
+ *  holding them in the packed layout. Each item starts with a tag: '*' and
+ *  the elements count for an array, ':' and a signed integer, '$' and a
+ *  string, '_' for a null.
+ *
+ * @param ctx The Redis context
+ * @param entry The entry
+ */
+void CachePack(RedisModuleCtx *ctx, CacheEntry *entry) {
+    Packed packed;
+    PackedInit(&packed);
+    size_t freed = 0;
+    for (int i = 0; i < entry->count; ++i) {
+        CacheItem *item = &entry->items[i];
+        switch (item->type) {
+            case CACHE_ARRAY:
+                PackedTag(&packed, '*');
+                PackedVarint(&packed, item->num);
+                break;
+            case CACHE_INTEGER:
+                PackedTag(&packed, ':');
+                PackedSigned(&packed, item->num);
+                break;
+            case CACHE_STRING:
+                PackedTag(&packed, '$');
+                PackedString(&packed, item->str);
+                size_t len;
+                RedisModule_StringPtrLen(item->str, &len);
+                freed += len + CACHE_STRING_OVERHEAD;
+                RedisModule_FreeString(ctx, item->str);
+                break;
+            default:
+                PackedTag(&packed, '_');
+        }
+    }
+    entry->memory -= freed;
+    memory -= freed;
+    entry->count = 0;
+    RedisModuleString *str = PackedFinish(ctx, &packed);
+    CacheAddString(ctx, entry, str);
+    RedisModule_FreeString(ctx, str);
+}
+
+/**
+ *  CacheStore Puts an entry in the cache, the least recently used entries
+ *  are evicted to keep the cache under its memory cap. The entry is freed
+ *  instead if it cannot be cached or if it alone exceeds the cap.
+ *
+ * @param ctx The Redis context
+ * @param entry The entry, it must not be used after the call
+ */
+void CacheStore(RedisModuleCtx *ctx, CacheEntry *entry) {
+    /* An entry larger than the cap would evict the whole cache, then
+     * itself */
+    CheckSize(entry);
+    if (entry->stale) {
+        FreeEntry(ctx, entry);
+        return;
+    }
+    Fingerprint(ctx, entry, &entry->key_type, &entry->key_len);
+
+    StrEntry *e = StrTableFind(&queries, entry->query, entry->len);
+    if (e)
+        Drop(ctx, e->ptr);
+    StrTableAdd(&queries, entry->query, entry->len)->ptr = entry;
+    entry->stored = 1;
+    entry->next = first;
+    if (first)
+        first->prev = entry;
+    else
+        last = entry;
+    first = entry;
+
+    while (memory > max_memory && last) {
+        Drop(ctx, last);
+        evictions++;
+    }
+}
+
+/**
+ *  CacheDiscard Frees an entry that will not be stored
+ *
+ * @param ctx The Redis context
+ * @param entry The entry
+ */
+void CacheDiscard(RedisModuleCtx *ctx, CacheEntry *entry) {
+    FreeEntry(ctx, entry);
+}
+
+/**
+ *  CacheNotify The keyspace notifications callback dropping the entries
+ *  depending on the modified key.
+ *
+ * @param ctx The Redis context
+ * @param type The event class
+ * @param event The event name
+ * @param key The modified key
+ *
+ * @return REDISMODULE_OK
+ */
+int CacheNotify(RedisModuleCtx *ctx, int type, const char *event,
+                RedisModuleString *key) {
+    int db = RedisModule_GetSelectedDb(ctx);
+    if (db >= dbs_count || dbs[db].deps.used == 0)
+        return REDISMODULE_OK;
+
+    size_t len;
+    const char *k = RedisModule_StringPtrLen(key, &len);
+    StrEntry *e;
+    while ((e = StrTableFind(&dbs[db].deps, k, len))) {
+        CacheDep *dep = e->ptr;
+        CacheEntry *entry = dep->entries[dep->count - 1];
+        if (entry->stored) {
+            Drop(ctx, entry);
+            invalidations++;
+        }
+        else {
+            Unlink(entry);
+            entry->stale = 1;
+        }
+    }
+    return REDISMODULE_OK;
+}
+
+/**
+ *  CacheClear Drops all the entries
+ *
+ * @param ctx The Redis context
+ */
+void CacheClear(RedisModuleCtx *ctx) {
+    while (first)
+        Drop(ctx, first);
+}
+
+/**
+ *  CacheResize Changes the memory cap, 0 disables the cache
+ *
+ * @param ctx The Redis context
+ * @param size The new cap in bytes
+ */
+void CacheResize(RedisModuleCtx *ctx, long long size) {
+    max_memory = size;
+    while (memory > max_memory && last) {
+        Drop(ctx, last);
+        evictions++;
+    }
+}
+
+/**
+ *  CacheReplyWithStats Replies with the cache counters, as an array of
+ *  names and values.
+ *
+ * @param ctx The Redis context
+ */
+void CacheReplyWithStats(RedisModuleCtx *ctx) {
+    RedisModule_ReplyWithArray(ctx, 14);
+    RedisModule_ReplyWithSimpleString(ctx, "hits");
+    RedisModule_ReplyWithLongLong(ctx, hits);
+    RedisModule_ReplyWithSimpleString(ctx, "misses");
+    RedisModule_ReplyWithLongLong(ctx, misses);
+    RedisModule_ReplyWithSimpleString(ctx, "evictions");
+    RedisModule_ReplyWithLongLong(ctx, evictions);
+    RedisModule_ReplyWithSimpleString(ctx, "invalidations");
+    RedisModule_ReplyWithLongLong(ctx, invalidations);
+    RedisModule_ReplyWithSimpleString(ctx, "entries");
+    RedisModule_ReplyWithLongLong(ctx, queries.used);
+    RedisModule_ReplyWithSimpleString(ctx, "memory");
+    RedisModule_ReplyWithLongLong(ctx, memory);
+    RedisModule_ReplyWithSimpleString(ctx, "max_memory");
+    RedisModule_ReplyWithLongLong(ctx, max_memory);
+}
+
+/**
+ *  CacheInit Reads the module arguments. "CACHE_SIZE bytes" sets the memory
+ *  cap of the cache.
+ *
+ * @param ctx The Redis context
+ * @param argv The module arguments
+ * @param argc The module arguments count
+ *
+ * @return REDISMODULE_OK or REDISMODULE_ERR
+ */
+int CacheInit(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    StrTableInit(&queries, 0);
+
+    for (int i = 0; i < argc; i += 2) {
+        const char *name = RedisModule_StringPtrLen(argv[i], NULL);
+        long long size;
+        if (strcasecmp(name, "CACHE_SIZE") != 0 || i + 1 >= argc
+            || RedisModule_StringToLongLong(argv[i + 1], &size) == REDISMODULE_ERR
+            || size < 0)
+            return REDISMODULE_ERR;
+        max_memory = size;
+    }
+    return REDISMODULE_OK;
+}
@@ -0,0 +1,114 @@
+#ifndef __CACHE_H__
+#define __CACHE_H__
+/*
+** BSD 3-Clause License
+**
+** Copyright (c) 2018, David Boucher
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**
+** * Redistributions of source code must retain the above copyright notice,
+**   this list of conditions and the following disclaimer.
+**
+** * Redistributions in binary form must reproduce the above copyright notice,
+**   this list of conditions and the following disclaimer in the documentation
+**   and/or other materials provided with the distribution.
+**
+** * Neither the name of the copyright holder nor the names of its
+**   contributors may be used to endorse or promote products derived from
+**   this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+** LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+** CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+** SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+** INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+** CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+** ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+** POSSIBILITY OF SUCH DAMAGE.
+*/
+#include "redismodule.h"
+#include "strtable.h"
+
+/* The default memory cap of the cache, in bytes */
+#define CACHE_DEFAULT_SIZE (32 * 1024 * 1024)
+
+/* The approximate memory used by a retained string, besides its content */
+#define CACHE_STRING_OVERHEAD 16
+
+/* The kinds of items of a recorded reply */
+#define CACHE_ARRAY 'a'
+#define CACHE_INTEGER 'i'
+#define CACHE_STRING 's'
+#define CACHE_NULL 'n'
+
+/* An item of a recorded reply */
+typedef struct _CacheItem CacheItem;
+struct _CacheItem {
+    char type;
+    /* The array length or the integer */
+    long long num;
+    RedisModuleString *str;
+};
+
+/* A key the cached replies depend on. Any event on it drops them. */
+typedef struct _CacheDep CacheDep;
+
+/* A recorded reply of TABULAR.GET, with the keys it has been computed from */
+typedef struct _CacheEntry CacheEntry;
+struct _CacheEntry {
+    /* The database followed by the arguments of the command */
+    char *query;
+    size_t len;
+    int db;
+    CacheItem *items;
+    int count;
+    int size;
+    CacheDep **deps;
+    int deps_count;
+    int deps_size;
+    /* The memory used by the entry, its dependencies excepted */
+    size_t memory;
+    /* The memory of the dependencies the entry created or joined, charged
+     * to the entry against the cap */
+    size_t deps_memory;
+    /* Set once the entry is in the cache */
+    int stored;
+    /* Set if a dependency changed while the reply was computed */
+    int stale;
+    /* The type and the length of the set of the rows when stored */
+    int key_type;
+    size_t key_len;
+    /* The LRU list, the most recently used entry first */
+    CacheEntry *prev;
+    CacheEntry *next;
+};
+
+int CacheInit(RedisModuleCtx *ctx, RedisModuleString **argv, int argc);
+char *CacheQuery(RedisModuleCtx *ctx, RedisModuleString **argv, int argc,
+                 size_t *len);
+int CacheReplyIfCached(RedisModuleCtx *ctx, RedisModuleString **argv, int argc);
+CacheEntry *CacheCreate(RedisModuleCtx *ctx, RedisModuleString **argv, int argc);
+void CacheDepend(CacheEntry *entry, const char *key, size_t len);
+void CacheAddArray(CacheEntry *entry, long long len);
+void CacheAddLongLong(CacheEntry *entry, long long value);
+void CacheAddString(RedisModuleCtx *ctx, CacheEntry *entry,
+                    RedisModuleString *str);
+void CacheAddNull(CacheEntry *entry);
+void CacheReplyWithItems(RedisModuleCtx *ctx, CacheItem *items, int count);
+void CachePack(RedisModuleCtx *ctx, CacheEntry *entry);
+void CacheReply(RedisModuleCtx *ctx, CacheEntry *entry);
+void CacheStore(RedisModuleCtx *ctx, CacheEntry *entry);
+void CacheDiscard(RedisModuleCtx *ctx, CacheEntry *entry);
+int CacheNotify(RedisModuleCtx *ctx, int type, const char *event,
+                RedisModuleString *key);
+void CacheClear(RedisModuleCtx *ctx);
+void CacheResize(RedisModuleCtx *ctx, long long size);
+void CacheReplyWithStats(RedisModuleCtx *ctx);
+
+#endif /*__CACHE_H__*/
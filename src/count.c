@@ -31,14 +31,171 @@
 ** POSSIBILITY OF SUCH DAMAGE.
 */
 #include <fnmatch.h>
+#include <math.h>
+#include <stdio.h>
 #include <string.h>
 #include "count.h"
+#include "packed.h"
 
-static CountList *FillList(CountList *lst, RedisModuleString *content) {
+/* The HyperLogLog used by DISTINCT has 2^COUNT_HLL_BITS registers, that is
+ * a standard error of about 3% */
+#define COUNT_HLL_BITS 10
+#define COUNT_HLL_REGISTERS (1 << COUNT_HLL_BITS)
+
+static const char *count_op_names[] = { "sum", "min", "max", "avg", "distinct" };
+
+/**
+ *  CountAggregates Builds the aggregates description from the AGGREGATE
+ *  option.
+ *
+ * @param options The command options
+ * @param header The array header, aggregated fields are columns of it
+ * @param block_size The number of columns
+ *
+ * @return An array of options->aggregates_count aggregates to free with
+ *         RedisModule_Free, or NULL if there is no aggregate.
+ */
+CountAggregate *CountAggregates(TabularOptions *options, TabularHeader *header,
+                                int block_size) {
+    if (options->aggregates_count == 0)
+        return NULL;
+
+    CountAggregate *retval = RedisModule_Alloc(
+            options->aggregates_count * sizeof(CountAggregate));
+    for (int i = 0; i < options->aggregates_count; ++i) {
+        const char *op = RedisModule_StringPtrLen(options->aggregates[2 * i], NULL);
+        if (strcasecmp(op, "SUM") == 0)
+            retval[i].op = COUNT_SUM;
+        else if (strcasecmp(op, "MIN") == 0)
+            retval[i].op = COUNT_MIN;
+        else if (strcasecmp(op, "MAX") == 0)
+            retval[i].op = COUNT_MAX;
+        else if (strcasecmp(op, "AVG") == 0)
+            retval[i].op = COUNT_AVG;
+        else    /* DISTINCT */
+            retval[i].op = COUNT_DISTINCT;
+        retval[i].field = options->aggregates[2 * i + 1];
+        for (int j = 0; j < block_size - 1; ++j) {
+            if (RedisModule_StringCompare(header[j].field, retval[i].field) == 0) {
+                retval[i].column = j;
+                break;
+            }
+        }
+    }
+    return retval;
+}
+
+/**
+ *  HllHash A 64 bits hash of a string, FNV-1a followed by a finalizer to mix
+ *  all the bits.
+ *
+ * @param str The string
+ * @param len Its length
+ *
+ * @return The hash value
+ */
+static unsigned long long HllHash(const char *str, size_t len) {
+    unsigned long long h = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; ++i) {
+        h ^= (unsigned char)str[i];
+        h *= 1099511628211ULL;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/**
+ *  HllAdd Adds a string to a HyperLogLog
+ *
+ * @param hll The registers
+ * @param str The string
+ * @param len Its length
+ */
+static void HllAdd(unsigned char *hll, const char *str, size_t len) {
+    unsigned long long h = HllHash(str, len);
+    int idx = h & (COUNT_HLL_REGISTERS - 1);
+    h >>= COUNT_HLL_BITS;
+    unsigned char rho = 1;
+    while (rho <= 64 - COUNT_HLL_BITS && !(h & 1)) {
+        rho++;
+        h >>= 1;
+    }
+    if (rho > hll[idx])
+        hll[idx] = rho;
+}
+
+/**
+ *  HllCount Estimates the number of distinct strings added to a HyperLogLog
+ *
+ * @param hll The registers
+ *
+ * @return The estimation
+ */
+static long long HllCount(unsigned char *hll) {
+    double m = COUNT_HLL_REGISTERS;
+    double sum = 0;
+    int zeros = 0;
+    for (int i = 0; i < COUNT_HLL_REGISTERS; ++i) {
+        sum += ldexp(1.0, -hll[i]);
+        if (hll[i] == 0)
+            zeros++;
+    }
+    double estimate = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+    /* Small range correction */
+    if (estimate <= 2.5 * m && zeros > 0)
+        estimate = m * log(m / zeros);
+    return llround(estimate);
+}
+
+/**
+ *  Accumulate Adds the values of a row to the aggregates of a group
+ *
+ * @param acc The group accumulators
+ * @param row The row in the array
+ * @param aggs The aggregates description
+ * @param aggs_count The number of aggregates
+ */
+static void Accumulate(CountAccumulator *acc, RedisModuleString **row,
+                       CountAggregate *aggs, int aggs_count) {
+    for (int i = 0; i < aggs_count; ++i, ++acc) {
+        RedisModuleString *value = row[aggs[i].column];
+        if (!value)
+            continue;
+        if (aggs[i].op == COUNT_DISTINCT) {
+            size_t len;
+            const char *str = RedisModule_StringPtrLen(value, &len);
+            if (!acc->hll)
+                acc->hll = RedisModule_Calloc(COUNT_HLL_REGISTERS, 1);
+            HllAdd(acc->hll, str, len);
+        }
+        else {
+            double d;
+            if (RedisModule_StringToDouble(value, &d) == REDISMODULE_ERR)
+                continue;
+            if (acc->n == 0 || d < acc->min)
+                acc->min = d;
+            if (acc->n == 0 || d > acc->max)
+                acc->max = d;
+            acc->sum += d;
+        }
+        acc->n++;
+    }
+}
+
+static CountList *FillList(CountList *lst, RedisModuleString *content,
+                           RedisModuleString **row, CountAggregate *aggs,
+                           int aggs_count) {
     if (lst->content == NULL)
         lst->content = content;
     else
-        while (RedisModule_StringCompare(lst->content, content) != 0) {
+        /* Values read from an index are shared, most of them are found
+         * without comparing strings */
+        while (lst->content != content
+               && RedisModule_StringCompare(lst->content, content) != 0) {
             if (lst->next) {
                 lst = lst->next;
             }
@@ -52,6 +209,11 @@ static CountList *FillList(CountList *lst, RedisModuleString *content) {
         }
 
     lst->count++;
+    if (aggs_count > 0) {
+        if (!lst->acc)
+            lst->acc = RedisModule_Calloc(aggs_count, sizeof(CountAccumulator));
+        Accumulate(lst->acc, row, aggs, aggs_count);
+    }
     if (lst->children)
         lst = lst->children;
     else {
@@ -62,11 +224,12 @@ static CountList *FillList(CountList *lst, RedisModuleString *content) {
     return lst;
 }
 
-CountList *Count(RedisModuleCtx *ctx, RedisModuleString **array, int size,
-                 TabularHeader *header, int block_size) {
+CountList *Count(RedisModuleCtx *ctx, RedisModuleString **array,
+                 long long size, TabularHeader *header, int block_size,
+                 CountAggregate *aggs, int aggs_count) {
     CountList *retval = RedisModule_Alloc(sizeof(CountList));
     memset(retval, 0, sizeof(CountList));
-    for (int i = 0; i < size; i += block_size) {
+    for (long long i = 0; i < size; i += block_size) {
         CountList *lst = retval;
         int cont = 1;
         for (int j = 0; cont && j < block_size - 1; ++j) {
@@ -76,12 +239,15 @@ CountList *Count(RedisModuleCtx *ctx, RedisModuleString **array, int size,
                 case TABULAR_MATCH:
                     txt = RedisModule_StringPtrLen(array[i + j], &len);
                     if (fnmatch(header[j].search, txt, FNM_NOESCAPE | FNM_CASEFOLD | FNM_EXTMATCH) == 0)
-                        lst = FillList(lst, array[i + j]);
+                        lst = FillList(lst, array[i + j], array + i, aggs, aggs_count);
                     break;
                 case TABULAR_EQUAL:
                     txt = RedisModule_StringPtrLen(array[i + j], &len);
-                    if (strncmp(header[j].search, txt, len) == 0)
-                        lst = FillList(lst, array[i + j]);
+                    if (strcmp(header[j].search, txt) == 0)
+                        lst = FillList(lst, array[i + j], array + i, aggs, aggs_count);
+                    break;
+                case TABULAR_NONE:
+                    /* An aggregated column, not a group */
                     break;
                 default:
                     cont = 0;
@@ -91,7 +257,75 @@ CountList *Count(RedisModuleCtx *ctx, RedisModuleString **array, int size,
     return retval;
 }
 
-void CountReply(RedisModuleCtx *ctx, CountList *cnt) {
+/**
+ *  AggregateName Builds the name of an aggregate, as "sum(field)".
+ *
+ * @param buf The buffer to fill
+ * @param size The buffer size
+ * @param agg The aggregate
+ *
+ * @return The name length
+ */
+static size_t AggregateName(char *buf, size_t size, CountAggregate *agg) {
+    size_t len;
+    const char *field = RedisModule_StringPtrLen(agg->field, &len);
+    int retval = snprintf(buf, size, "%s(%.*s)", count_op_names[agg->op],
+                          (int)len, field);
+    return (size_t)retval < size ? (size_t)retval : size - 1;
+}
+
+/**
+ *  AccumulatorValue Gives the value of an aggregate in a group
+ *
+ * @param acc The group accumulator
+ * @param agg The aggregate
+ * @param[out] value The value
+ *
+ * @return 1 if the aggregate has a value, 0 if no value has been aggregated
+ *         by MIN, MAX or AVG.
+ */
+static int AccumulatorValue(CountAccumulator *acc, CountAggregate *agg,
+                            double *value) {
+    switch (agg->op) {
+        case COUNT_SUM:
+            *value = acc->sum;
+            return 1;
+        case COUNT_MIN:
+            *value = acc->min;
+            break;
+        case COUNT_MAX:
+            *value = acc->max;
+            break;
+        case COUNT_AVG:
+            *value = acc->n ? acc->sum / acc->n : 0;
+            break;
+        case COUNT_DISTINCT:
+            *value = acc->hll ? HllCount(acc->hll) : 0;
+            return 1;
+    }
+    return acc->n > 0;
+}
+
+/**
+ *  ReplyWithAccumulator Replies the value of an aggregate in a group
+ *
+ * @param ctx The Redis context
+ * @param acc The group accumulator
+ * @param agg The aggregate
+ */
+static void ReplyWithAccumulator(RedisModuleCtx *ctx, CountAccumulator *acc,
+                                 CountAggregate *agg) {
+    double value;
+    if (!AccumulatorValue(acc, agg, &value))
+        RedisModule_ReplyWithNull(ctx);
+    else if (agg->op == COUNT_DISTINCT)
+        RedisModule_ReplyWithLongLong(ctx, (long long)value);
+    else
+        RedisModule_ReplyWithDouble(ctx, value);
+}
+
+void CountReply(RedisModuleCtx *ctx, CountList *cnt, CountAggregate *aggs,
+                int aggs_count) {
     if (cnt->content == NULL) {
         RedisModule_ReplyWithNull(ctx);
         return;
@@ -104,18 +338,154 @@ void CountReply(RedisModuleCtx *ctx, CountList *cnt) {
         RedisModule_ReplyWithString(ctx, lst->content);
         RedisModule_ReplyWithStringBuffer(ctx, "count", 5);
         RedisModule_ReplyWithLongLong(ctx, lst->count);
+        for (int i = 0; i < aggs_count; ++i) {
+            char name[128];
+            size_t len = AggregateName(name, sizeof(name), &aggs[i]);
+            RedisModule_ReplyWithStringBuffer(ctx, name, len);
+            ReplyWithAccumulator(ctx, &lst->acc[i], &aggs[i]);
+        }
         RedisModule_ReplyWithStringBuffer(ctx, "children", 8);
         if (lst->children && lst->children->content) {
-            CountReply(ctx, lst->children);
+            CountReply(ctx, lst->children, aggs, aggs_count);
         }
         else
             RedisModule_ReplyWithNull(ctx);
-        s += 6;
+        s += 6 + 2 * aggs_count;
     }
     RedisModule_ReplySetArrayLength(ctx, s);
 }
 
-void CountReplyStore(RedisModuleCtx *ctx, CountList *cnt, RedisModuleString *store) {
+/**
+ *  CountNodes Counts the groups of a count tree
+ */
+static unsigned long long CountNodes(CountList *cnt) {
+    unsigned long long retval = 0;
+    for (CountList *lst = cnt; lst && lst->content; lst = lst->next) {
+        retval++;
+        if (lst->children)
+            retval += CountNodes(lst->children);
+    }
+    return retval;
+}
+
+/**
+ *  PackNodes Appends the groups of a count tree, each one before its
+ *  children.
+ *
+ * @param packed The packed reply
+ * @param cnt The groups
+ * @param parent The number of their parent, 0 at the first level
+ * @param[in,out] number The number of the last appended group
+ * @param aggs The aggregates
+ * @param aggs_count The number of aggregates
+ */
+static void PackNodes(Packed *packed, CountList *cnt, unsigned long long parent,
+                      unsigned long long *number, CountAggregate *aggs,
+                      int aggs_count) {
+    for (CountList *lst = cnt; lst && lst->content; lst = lst->next) {
+        unsigned long long self = ++*number;
+        PackedVarint(packed, parent);
+        PackedString(packed, lst->content);
+        PackedVarint(packed, lst->count);
+        for (int i = 0; i < aggs_count; ++i) {
+            double value;
+            if (!AccumulatorValue(&lst->acc[i], &aggs[i], &value))
+                value = NAN;
+            PackedDouble(packed, value);
+        }
+        if (lst->children)
+            PackNodes(packed, lst->children, self, number, aggs, aggs_count);
+    }
+}
+
+/**
+ *  CountReplyPacked Replies a count tree as a single string, in a flat
+ *  layout: the aggregates count and their names, the groups count, then
+ *  each group before its children. A group is the number of its parent (the
+ *  groups being numbered from 1 in this order, 0 for no parent), its value,
+ *  its count and the value of each aggregate as a double, NaN if missing.
+ *
+ * @param ctx The Redis context
+ * @param cnt The count tree
+ * @param aggs The aggregates
+ * @param aggs_count The number of aggregates
+ */
+void CountReplyPacked(RedisModuleCtx *ctx, CountList *cnt, CountAggregate *aggs,
+                      int aggs_count) {
+    Packed packed;
+    PackedInit(&packed);
+    PackedVarint(&packed, aggs_count);
+    for (int i = 0; i < aggs_count; ++i) {
+        char name[128];
+        size_t len = AggregateName(name, sizeof(name), &aggs[i]);
+        PackedBuffer(&packed, name, len);
+    }
+    PackedVarint(&packed, CountNodes(cnt));
+    unsigned long long number = 0;
+    PackNodes(&packed, cnt, 0, &number, aggs, aggs_count);
+    RedisModuleString *str = PackedFinish(ctx, &packed);
+    RedisModule_ReplyWithString(ctx, str);
+    RedisModule_FreeString(ctx, str);
+}
+
+/**
+ *  StoreAccumulator Stores the value of an aggregate of a group in the key
+ *  made of store, the aggregate name and the group values, for example
+ *  "store:sum:bytes:4:Vega".
+ *
+ * @param ctx The Redis context
+ * @param store The key prefix given with STORE
+ * @param path The group values, as ":4:Vega"
+ * @param acc The group accumulator
+ * @param agg The aggregate
+ */
+static void StoreAccumulator(RedisModuleCtx *ctx, RedisModuleString *store,
+                             RedisModuleString *path, CountAccumulator *acc,
+                             CountAggregate *agg) {
+    size_t len;
+    const char *str = RedisModule_StringPtrLen(store, &len);
+    RedisModuleString *tmp = RedisModule_CreateString(ctx, str, len);
+    RedisModule_StringAppendBuffer(ctx, tmp, ":", 1);
+    str = count_op_names[agg->op];
+    RedisModule_StringAppendBuffer(ctx, tmp, str, strlen(str));
+    RedisModule_StringAppendBuffer(ctx, tmp, ":", 1);
+    str = RedisModule_StringPtrLen(agg->field, &len);
+    RedisModule_StringAppendBuffer(ctx, tmp, str, len);
+    str = RedisModule_StringPtrLen(path, &len);
+    RedisModule_StringAppendBuffer(ctx, tmp, str, len);
+
+    RedisModuleString *val;
+    if (agg->op == COUNT_DISTINCT)
+        val = RedisModule_CreateStringFromLongLong(
+                ctx, acc->hll ? HllCount(acc->hll) : 0);
+    else if (agg->op != COUNT_SUM && acc->n == 0)
+        val = NULL;
+    else {
+        double d;
+        if (agg->op == COUNT_SUM)
+            d = acc->sum;
+        else if (agg->op == COUNT_MIN)
+            d = acc->min;
+        else if (agg->op == COUNT_MAX)
+            d = acc->max;
+        else
+            d = acc->sum / acc->n;
+        val = RedisModule_CreateStringPrintf(ctx, "%.17g", d);
+    }
+
+    RedisModuleKey *key = RedisModule_OpenKey(ctx, tmp, REDISMODULE_WRITE);
+    if (val) {
+        RedisModule_StringSet(key, val);
+        RedisModule_FreeString(ctx, val);
+    }
+    else
+        RedisModule_DeleteKey(key);
+    RedisModule_CloseKey(key);
+    RedisModule_FreeString(ctx, tmp);
+}
+
+void CountReplyStore(RedisModuleCtx *ctx, CountList *cnt, RedisModuleString *store,
+                     CountAggregate *aggs, int aggs_count) {
     if (cnt->content == NULL) {
         RedisModule_ReplyWithNull(ctx);
         return;
@@ -123,6 +493,7 @@ void CountReplyStore(RedisModuleCtx *ctx, CountList *cnt, RedisModuleString *sto
 
     for (CountList *lst = cnt; lst; lst = lst->next) {
         RedisModuleString *tmp = RedisModule_CreateStringFromString(ctx, store);
+        RedisModuleString *path = RedisModule_CreateString(ctx, "", 0);
         RedisModule_StringAppendBuffer(ctx, tmp, ":", 1);
         RedisModule_StringAppendBuffer(ctx, tmp, "count", 5);
         for (CountList *c = lst; c && c->content; c = c->children) {
@@ -137,19 +508,32 @@ void CountReplyStore(RedisModuleCtx *ctx, CountList *cnt, RedisModuleString *sto
             RedisModule_StringSet(key, val);
             RedisModule_CloseKey(key);
             RedisModule_FreeString(ctx, val);
+
+            RedisModule_StringAppendBuffer(ctx, path, ":", 1);
+            RedisModule_StringAppendBuffer(ctx, path, str, len);
+            for (int i = 0; i < aggs_count; ++i)
+                StoreAccumulator(ctx, store, path, &c->acc[i], &aggs[i]);
         }
+        RedisModule_FreeString(ctx, path);
         RedisModule_FreeString(ctx, tmp);
     }
     RedisModule_ReplyWithSimpleString(ctx, "OK");
 }
 
-void FreeCountList(CountList *cnt) {
+void FreeCountList(CountList *cnt, int aggs_count) {
     CountList *next = cnt->next;
     CountList *children = cnt->children;
 
+    if (cnt->acc) {
+        for (int i = 0; i < aggs_count; ++i) {
+            if (cnt->acc[i].hll)
+                RedisModule_Free(cnt->acc[i].hll);
+        }
+        RedisModule_Free(cnt->acc);
+    }
     RedisModule_Free(cnt);
     if (next)
-        FreeCountList(next);
+        FreeCountList(next, aggs_count);
     if (children)
-        FreeCountList(children);
+        FreeCountList(children, aggs_count);
 }
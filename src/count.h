@@ -34,18 +34,55 @@
 */
 #include "tabular.h"
 
+enum _CountOp {
+  COUNT_SUM,
+  COUNT_MIN,
+  COUNT_MAX,
+  COUNT_AVG,
+  COUNT_DISTINCT,
+};
+
+typedef enum _CountOp CountOp;
+
+/* An aggregate asked with the AGGREGATE keyword */
+typedef struct _CountAggregate CountAggregate;
+struct _CountAggregate {
+    CountOp op;
+    RedisModuleString *field;
+    int column;
+};
+
+/* The state of an aggregate in a group */
+typedef struct _CountAccumulator CountAccumulator;
+struct _CountAccumulator {
+    double sum;
+    double min;
+    double max;
+    long long n;
+    /* HyperLogLog registers, only for DISTINCT */
+    unsigned char *hll;
+};
+
 typedef struct _CountList CountList;
 struct _CountList {
     RedisModuleString *content;
-    int count;
+    long long count;
+    CountAccumulator *acc;
     CountList *next;
     CountList *children;
 };
 
-void CountReply(RedisModuleCtx *ctx, CountList *cnt);
-void CountReplyStore(RedisModuleCtx *ctx, CountList *cnt, RedisModuleString *store);
-CountList *Count(RedisModuleCtx *ctx, RedisModuleString **array, int size,
-           TabularHeader *header, int block_size);
-void FreeCountList(CountList *lst);
+CountAggregate *CountAggregates(TabularOptions *options, TabularHeader *header,
+                                int block_size);
+void CountReply(RedisModuleCtx *ctx, CountList *cnt, CountAggregate *aggs,
+                int aggs_count);
+void CountReplyPacked(RedisModuleCtx *ctx, CountList *cnt, CountAggregate *aggs,
+                      int aggs_count);
+void CountReplyStore(RedisModuleCtx *ctx, CountList *cnt, RedisModuleString *store,
+                     CountAggregate *aggs, int aggs_count);
+CountList *Count(RedisModuleCtx *ctx, RedisModuleString **array,
+                 long long size, TabularHeader *header, int block_size,
+                 CountAggregate *aggs, int aggs_count);
+void FreeCountList(CountList *lst, int aggs_count);
 
 #endif /*__COUNT_H__*/
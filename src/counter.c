@@ -0,0 +1,604 @@
+/*
+** BSD 3-Clause License
+**
+** Copyright (c) 2018, David Boucher
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**
+** * Redistributions of source code must retain the above copyright notice,
+**   this list of conditions and the following disclaimer.
+**
+** * Redistributions in binary form must reproduce the above copyright notice,
+**   this list of conditions and the following disclaimer in the documentation
+**   and/or other materials provided with the distribution.
+**
+** * Neither the name of the copyright holder nor the names of its
+**   contributors may be used to endorse or promote products derived from
+**   this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+** LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+** CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+** SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+** INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+** CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+** ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+** POSSIBILITY OF SUCH DAMAGE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "counter.h"
+
+/* The counters of all the databases */
+static Counter *counters = NULL;
+
+/* The type of the keys holding counters */
+static RedisModuleType *CounterType = NULL;
+
+/**
+ *  CopyString Allocates a copy of a buffer, terminated by a zero
+ */
+static char *CopyString(const char *str, size_t len) {
+    char *retval = RedisModule_Alloc(len + 1);
+    memcpy(retval, str, len);
+    retval[len] = 0;
+    return retval;
+}
+
+/**
+ *  CounterKeyName Gives the name of the key holding a counter
+ *
+ * @return The key name, to free with RedisModule_FreeString
+ */
+static RedisModuleString *CounterKeyName(RedisModuleCtx *ctx, const char *name) {
+    return RedisModule_CreateStringPrintf(ctx, "tabular:counter:%s", name);
+}
+
+/**
+ *  InDb Tells if a counter belongs to the current database. Counters loaded
+ *  from an RDB file do not know their database yet, it is then found by
+ *  looking for their key.
+ *
+ * @param ctx The Redis context
+ * @param counter The counter
+ *
+ * @return 1 if the counter key is in the current database, 0 otherwise.
+ */
+static int InDb(RedisModuleCtx *ctx, Counter *counter) {
+    int db = RedisModule_GetSelectedDb(ctx);
+    if (counter->db >= 0 || counter->dropped)
+        return counter->db == db && !counter->dropped;
+
+    RedisModuleString *name = CounterKeyName(ctx, counter->name);
+    RedisModuleKey *key = RedisModule_OpenKey(ctx, name, REDISMODULE_READ);
+    if (key) {
+        if (RedisModule_ModuleTypeGetType(key) == CounterType
+                && RedisModule_ModuleTypeGetValue(key) == counter)
+            counter->db = db;
+        RedisModule_CloseKey(key);
+    }
+    RedisModule_FreeString(ctx, name);
+    return counter->db == db;
+}
+
+/**
+ *  GroupKey Reads the counted fields of a row and encodes their values, each
+ *  one as '-' if missing or as '+<length>:' followed by the value.
+ *
+ * @param ctx The Redis context
+ * @param counter The counter
+ * @param key The row key, NULL for a removed row whose fields are all missing
+ * @param len The encoded length
+ *
+ * @return The encoded values, to free with RedisModule_Free
+ */
+static char *GroupKey(RedisModuleCtx *ctx, Counter *counter,
+                      RedisModuleString *key, size_t *len) {
+    RedisModuleString *values[counter->fields_count];
+    RedisModuleKey *h = key ? RedisModule_OpenKey(ctx, key, REDISMODULE_READ) : NULL;
+    int hash = h && RedisModule_KeyType(h) == REDISMODULE_KEYTYPE_HASH;
+    size_t size = 0;
+    for (int i = 0; i < counter->fields_count; ++i) {
+        values[i] = NULL;
+        if (hash)
+            RedisModule_HashGet(h, REDISMODULE_HASH_CFIELDS, counter->fields[i],
+                                &values[i], NULL);
+        size_t vlen = 0;
+        if (values[i])
+            RedisModule_StringPtrLen(values[i], &vlen);
+        size += values[i] ? vlen + 24 : 1;
+    }
+    if (h)
+        RedisModule_CloseKey(h);
+
+    char *retval = RedisModule_Alloc(size + 1);
+    char *p = retval;
+    for (int i = 0; i < counter->fields_count; ++i) {
+        if (!values[i]) {
+            *p++ = '-';
+            continue;
+        }
+        size_t vlen;
+        const char *v = RedisModule_StringPtrLen(values[i], &vlen);
+        p += sprintf(p, "+%zu:", vlen);
+        memcpy(p, v, vlen);
+        p += vlen;
+        RedisModule_FreeString(ctx, values[i]);
+    }
+    *len = p - retval;
+    return retval;
+}
+
+/**
+ *  NextValue Decodes a value of a group key
+ *
+ * @param p The position in the key, moved after the value
+ * @param value The value
+ * @param len The value length
+ *
+ * @return 1 if the value is there, 0 if missing.
+ */
+static int NextValue(const char **p, const char **value, size_t *len) {
+    if (**p == '-') {
+        (*p)++;
+        return 0;
+    }
+    char *end;
+    *len = strtoull(*p + 1, &end, 10);
+    *value = end + 1;
+    *p = *value + *len;
+    return 1;
+}
+
+/**
+ *  Join Counts a row in the group of its values
+ *
+ * @param counter The counter
+ * @param key The encoded values, owned by the group after the call
+ * @param len The encoded length
+ *
+ * @return The group
+ */
+static CounterGroup *Join(Counter *counter, char *key, size_t len) {
+    StrEntry *e = StrTableAdd(&counter->groups, key, len);
+    CounterGroup *group = e->ptr;
+    if (group)
+        RedisModule_Free(key);
+    else {
+        group = RedisModule_Alloc(sizeof(CounterGroup));
+        group->key = key;
+        group->len = len;
+        group->count = 0;
+        e->ptr = group;
+    }
+    group->count++;
+    return group;
+}
+
+/**
+ *  Leave Uncounts a row from its group, the group is freed when it becomes
+ *  empty.
+ *
+ * @param counter The counter
+ * @param group The group
+ */
+static void Leave(Counter *counter, CounterGroup *group) {
+    if (--group->count > 0)
+        return;
+    StrTableDel(&counter->groups,
+                StrTableFind(&counter->groups, group->key, group->len));
+    RedisModule_Free(group->key);
+    RedisModule_Free(group);
+}
+
+/**
+ *  UpdateRow Moves a row to the group of its current values
+ *
+ * @param ctx The Redis context
+ * @param counter The counter
+ * @param row The row entry in counter->rows
+ * @param key The row key, NULL if the row has been removed
+ */
+static void UpdateRow(RedisModuleCtx *ctx, Counter *counter, StrEntry *row,
+                      RedisModuleString *key) {
+    size_t len;
+    char *k = GroupKey(ctx, counter, key, &len);
+    CounterGroup *group = row->ptr;
+    if (group->len == len && memcmp(group->key, k, len) == 0) {
+        RedisModule_Free(k);
+        return;
+    }
+    row->ptr = Join(counter, k, len);
+    Leave(counter, group);
+}
+
+/**
+ *  Sync Applies the changes of the set to the rows of a counter. The members
+ *  already counted are only marked, the new ones are read and the ones no
+ *  longer in the set are uncounted.
+ *
+ * @param ctx The Redis context
+ * @param counter The counter
+ */
+static void Sync(RedisModuleCtx *ctx, Counter *counter) {
+    if (!counter->dirty)
+        return;
+
+    RedisModuleCallReply *reply = RedisModule_Call(
+            ctx, "SMEMBERS", "b", counter->set, counter->set_len);
+    long long generation = ++counter->generation;
+    size_t n = 0;
+    if (RedisModule_CallReplyType(reply) == REDISMODULE_REPLY_ARRAY)
+        n = RedisModule_CallReplyLength(reply);
+    for (size_t i = 0; i < n; ++i) {
+        RedisModuleCallReply *member = RedisModule_CallReplyArrayElement(reply, i);
+        size_t klen;
+        const char *k = RedisModule_CallReplyStringPtr(member, &klen);
+        StrEntry *row = StrTableFind(&counter->rows, k, klen);
+        if (row) {
+            row->value = generation;
+            continue;
+        }
+        RedisModuleString *key = RedisModule_CreateStringFromCallReply(member);
+        size_t len;
+        char *g = GroupKey(ctx, counter, key, &len);
+        RedisModule_FreeString(ctx, key);
+        row = StrTableAdd(&counter->rows, CopyString(k, klen), klen);
+        row->value = generation;
+        row->ptr = Join(counter, g, len);
+    }
+    if (reply)
+        RedisModule_FreeCallReply(reply);
+
+    /* The rows left unmarked have been removed from the set */
+    size_t stale_count = counter->rows.used - n;
+    if (stale_count > 0) {
+        StrEntry *stale = RedisModule_Alloc(stale_count * sizeof(StrEntry));
+        size_t s = 0;
+        for (size_t i = 0; i <= counter->rows.mask; ++i) {
+            StrEntry *e = &counter->rows.entries[i];
+            if (e->str && e->value != generation)
+                stale[s++] = *e;
+        }
+        for (size_t i = 0; i < s; ++i) {
+            StrEntry *row = StrTableFind(&counter->rows, stale[i].str, stale[i].len);
+            Leave(counter, row->ptr);
+            StrTableDel(&counter->rows, row);
+            RedisModule_Free((char *)stale[i].str);
+        }
+        RedisModule_Free(stale);
+    }
+    counter->dirty = 0;
+}
+
+/**
+ *  NewCounter Allocates an empty counter, and adds it to the counters list.
+ *  Its fields are then given by the caller.
+ *
+ * @param name The counter name
+ * @param set The counted set
+ * @param set_len The set name length
+ * @param fields_count The number of counted fields
+ *
+ * @return The counter
+ */
+static Counter *NewCounter(const char *name, const char *set, size_t set_len,
+                           int fields_count) {
+    Counter *counter = RedisModule_Alloc(sizeof(Counter));
+    counter->db = -1;
+    counter->name = CopyString(name, strlen(name));
+    counter->set = CopyString(set, set_len);
+    counter->set_len = set_len;
+    counter->fields = RedisModule_Calloc(fields_count, sizeof(char *));
+    counter->fields_count = fields_count;
+    StrTableInit(&counter->rows, 1024);
+    StrTableInit(&counter->groups, 16);
+    counter->dirty = 1;
+    counter->generation = 0;
+    counter->dropped = 0;
+    counter->next = counters;
+    counters = counter;
+    return counter;
+}
+
+/**
+ *  Sweep Frees the counters whose key has been deleted
+ */
+static void Sweep(void) {
+    Counter **prev = &counters;
+    while (*prev) {
+        Counter *counter = *prev;
+        if (!counter->dropped) {
+            prev = &counter->next;
+            continue;
+        }
+        *prev = counter->next;
+
+        for (size_t i = 0; i <= counter->rows.mask; ++i) {
+            if (counter->rows.entries[i].str)
+                RedisModule_Free((char *)counter->rows.entries[i].str);
+        }
+        StrTableFree(&counter->rows);
+        for (size_t i = 0; i <= counter->groups.mask; ++i) {
+            CounterGroup *group = counter->groups.entries[i].ptr;
+            if (counter->groups.entries[i].str) {
+                RedisModule_Free(group->key);
+                RedisModule_Free(group);
+            }
+        }
+        StrTableFree(&counter->groups);
+        for (int i = 0; i < counter->fields_count; ++i)
+            RedisModule_Free(counter->fields[i]);
+        RedisModule_Free(counter->fields);
+        RedisModule_Free(counter->set);
+        RedisModule_Free(counter->name);
+        RedisModule_Free(counter);
+    }
+}
+
+/**
+ *  CounterCreate Creates a counter of the rows of a set by the values of
+ *  some fields, in the key "tabular:counter:<name>" of the current database.
+ *
+ * @param ctx The Redis context
+ * @param name The counter name
+ * @param set The counted set
+ * @param fields The counted fields
+ * @param fields_count The number of fields
+ *
+ * @return REDISMODULE_OK or REDISMODULE_ERR if the counter key already exists.
+ */
+int CounterCreate(RedisModuleCtx *ctx, RedisModuleString *name,
+                  RedisModuleString *set, RedisModuleString **fields,
+                  int fields_count) {
+    Sweep();
+    const char *n = RedisModule_StringPtrLen(name, NULL);
+    RedisModuleString *kname = CounterKeyName(ctx, n);
+    RedisModuleKey *key = RedisModule_OpenKey(ctx, kname, REDISMODULE_WRITE);
+    RedisModule_FreeString(ctx, kname);
+    if (RedisModule_KeyType(key) != REDISMODULE_KEYTYPE_EMPTY) {
+        RedisModule_CloseKey(key);
+        return REDISMODULE_ERR;
+    }
+
+    size_t len;
+    const char *s = RedisModule_StringPtrLen(set, &len);
+    Counter *counter = NewCounter(n, s, len, fields_count);
+    for (int i = 0; i < fields_count; ++i) {
+        const char *f = RedisModule_StringPtrLen(fields[i], &len);
+        counter->fields[i] = CopyString(f, len);
+    }
+    counter->db = RedisModule_GetSelectedDb(ctx);
+    RedisModule_ModuleTypeSetValue(key, CounterType, counter);
+    RedisModule_CloseKey(key);
+    Sync(ctx, counter);
+    return REDISMODULE_OK;
+}
+
+/**
+ *  CounterDrop Removes a counter of the current database, that is its key.
+ *
+ * @param ctx The Redis context
+ * @param name The counter name
+ *
+ * @return REDISMODULE_OK or REDISMODULE_ERR if there is no such counter.
+ */
+int CounterDrop(RedisModuleCtx *ctx, RedisModuleString *name) {
+    RedisModuleString *kname = CounterKeyName(
+            ctx, RedisModule_StringPtrLen(name, NULL));
+    RedisModuleKey *key = RedisModule_OpenKey(ctx, kname, REDISMODULE_WRITE);
+    RedisModule_FreeString(ctx, kname);
+    int retval = REDISMODULE_ERR;
+    if (RedisModule_ModuleTypeGetType(key) == CounterType) {
+        RedisModule_DeleteKey(key);
+        retval = REDISMODULE_OK;
+    }
+    RedisModule_CloseKey(key);
+    Sweep();
+    return retval;
+}
+
+/**
+ *  CmpGroups Orders groups by their values, field by field. A missing value
+ *  comes after the other ones.
+ */
+static int CmpGroups(const void *a, const void *b) {
+    const CounterGroup *ga = *(CounterGroup * const *)a;
+    const CounterGroup *gb = *(CounterGroup * const *)b;
+    const char *pa = ga->key, *pb = gb->key;
+    while (pa < ga->key + ga->len) {
+        const char *va, *vb;
+        size_t la, lb;
+        int has_a = NextValue(&pa, &va, &la);
+        int has_b = NextValue(&pb, &vb, &lb);
+        if (has_a != has_b)
+            return has_b - has_a;
+        if (!has_a)
+            continue;
+        int cmp = memcmp(va, vb, la < lb ? la : lb);
+        if (cmp)
+            return cmp;
+        if (la != lb)
+            return la < lb ? -1 : 1;
+    }
+    return 0;
+}
+
+/**
+ *  CounterReplyWithGroups Replies with the groups of a counter of the current
+ *  database, each one as an array of its values followed by its rows count.
+ *  Reading the counts does not read any row, except the members added to
+ *  the set since the last call.
+ *
+ * @param ctx The Redis context
+ * @param name The counter name
+ *
+ * @return REDISMODULE_OK or REDISMODULE_ERR if there is no such counter, no
+ *         reply is then sent.
+ */
+int CounterReplyWithGroups(RedisModuleCtx *ctx, RedisModuleString *name) {
+    Sweep();
+    const char *n = RedisModule_StringPtrLen(name, NULL);
+    Counter *counter = counters;
+    while (counter && (strcmp(counter->name, n) || !InDb(ctx, counter)))
+        counter = counter->next;
+    if (!counter)
+        return REDISMODULE_ERR;
+
+    Sync(ctx, counter);
+    StrTable *groups = &counter->groups;
+    CounterGroup **sorted = RedisModule_Alloc(
+            (groups->used ? groups->used : 1) * sizeof(CounterGroup *));
+    size_t count = 0;
+    for (size_t i = 0; i <= groups->mask; ++i) {
+        if (groups->entries[i].str)
+            sorted[count++] = groups->entries[i].ptr;
+    }
+    qsort(sorted, count, sizeof(CounterGroup *), CmpGroups);
+
+    RedisModule_ReplyWithArray(ctx, count);
+    for (size_t i = 0; i < count; ++i) {
+        RedisModule_ReplyWithArray(ctx, counter->fields_count + 1);
+        const char *p = sorted[i]->key;
+        for (int j = 0; j < counter->fields_count; ++j) {
+            const char *value;
+            size_t len;
+            if (NextValue(&p, &value, &len))
+                RedisModule_ReplyWithStringBuffer(ctx, value, len);
+            else
+                RedisModule_ReplyWithNull(ctx);
+        }
+        RedisModule_ReplyWithLongLong(ctx, sorted[i]->count);
+    }
+    RedisModule_Free(sorted);
+    return REDISMODULE_OK;
+}
+
+/**
+ *  CounterRdbSave Saves a counter definition, its groups are counted again
+ *  after the load.
+ */
+static void CounterRdbSave(RedisModuleIO *rdb, void *value) {
+    Counter *counter = value;
+    RedisModule_SaveStringBuffer(rdb, counter->name, strlen(counter->name));
+    RedisModule_SaveStringBuffer(rdb, counter->set, counter->set_len);
+    RedisModule_SaveUnsigned(rdb, counter->fields_count);
+    for (int i = 0; i < counter->fields_count; ++i)
+        RedisModule_SaveStringBuffer(rdb, counter->fields[i],
+                                     strlen(counter->fields[i]));
+}
+
+/**
+ *  CounterRdbLoad Loads a counter saved by CounterRdbSave
+ */
+static void *CounterRdbLoad(RedisModuleIO *rdb, int encver) {
+    if (encver != COUNTER_ENCVER)
+        return NULL;
+
+    size_t len;
+    char *name = RedisModule_LoadStringBuffer(rdb, &len);
+    char *set = RedisModule_LoadStringBuffer(rdb, &len);
+    int fields_count = RedisModule_LoadUnsigned(rdb);
+    Counter *counter = NewCounter(name, set, len, fields_count);
+    RedisModule_Free(name);
+    RedisModule_Free(set);
+    for (int i = 0; i < fields_count; ++i) {
+        char *field = RedisModule_LoadStringBuffer(rdb, &len);
+        counter->fields[i] = CopyString(field, len);
+        RedisModule_Free(field);
+    }
+    return counter;
+}
+
+/**
+ *  CounterAofRewrite Rewrites a counter as the command creating it
+ */
+static void CounterAofRewrite(RedisModuleIO *aof, RedisModuleString *key,
+                              void *value) {
+    Counter *counter = value;
+    /* The fields count varies, they are given as strings with 'v' */
+    RedisModuleCtx *ctx = RedisModule_GetContextFromIO(aof);
+    RedisModuleString *fields[counter->fields_count];
+    for (int i = 0; i < counter->fields_count; ++i)
+        fields[i] = RedisModule_CreateString(ctx, counter->fields[i],
+                                             strlen(counter->fields[i]));
+    RedisModule_EmitAOF(aof, "TABULAR.COUNTER", "ccbv", "CREATE", counter->name,
+                        counter->set, counter->set_len, fields,
+                        (size_t)counter->fields_count);
+    for (int i = 0; i < counter->fields_count; ++i)
+        RedisModule_FreeString(ctx, fields[i]);
+}
+
+/**
+ *  CounterFree Called when a counter key is deleted. As for indexes, the
+ *  counter is only marked and Sweep frees it later from the main thread.
+ */
+static void CounterFree(void *value) {
+    Counter *counter = value;
+    counter->dropped = 1;
+}
+
+/**
+ *  CounterRegisterType Registers the type of the keys holding counters
+ *
+ * @param ctx The Redis context
+ *
+ * @return REDISMODULE_OK or REDISMODULE_ERR
+ */
+int CounterRegisterType(RedisModuleCtx *ctx) {
+    RedisModuleTypeMethods tm = {
+        .version = REDISMODULE_TYPE_METHOD_VERSION,
+        .rdb_load = CounterRdbLoad,
+        .rdb_save = CounterRdbSave,
+        .aof_rewrite = CounterAofRewrite,
+        .free = CounterFree,
+    };
+    CounterType = RedisModule_CreateDataType(ctx, "tab-count", COUNTER_ENCVER, &tm);
+    return CounterType ? REDISMODULE_OK : REDISMODULE_ERR;
+}
+
+/**
+ *  CounterNotify The keyspace notifications callback keeping counters up to
+ *  date. A change of a counted row moves it from its old group to its new
+ *  one. Notifications do not tell which members a set change added or
+ *  removed, so a change of the set only marks the counter, its members are
+ *  compared by the next read.
+ *
+ * @param ctx The Redis context
+ * @param type The event class
+ * @param event The event name
+ * @param key The modified key
+ *
+ * @return REDISMODULE_OK
+ */
+int CounterNotify(RedisModuleCtx *ctx, int type, const char *event,
+                  RedisModuleString *key) {
+    if (!counters)
+        return REDISMODULE_OK;
+
+    size_t klen;
+    const char *k = RedisModule_StringPtrLen(key, &klen);
+    /* Expired and evicted keys are notified before their deletion */
+    int removed = (type & (REDISMODULE_NOTIFY_EXPIRED | REDISMODULE_NOTIFY_EVICTED))
+                  || strcmp(event, "del") == 0
+                  || strcmp(event, "rename_from") == 0;
+
+    for (Counter *counter = counters; counter; counter = counter->next) {
+        if (!InDb(ctx, counter))
+            continue;
+        if (klen == counter->set_len && memcmp(k, counter->set, klen) == 0) {
+            counter->dirty = 1;
+            continue;
+        }
+        StrEntry *row = StrTableFind(&counter->rows, k, klen);
+        if (row)
+            UpdateRow(ctx, counter, row, removed ? NULL : key);
+    }
+    return REDISMODULE_OK;
+}
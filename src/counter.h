@@ -0,0 +1,85 @@
+#ifndef __COUNTER_H__
+#define __COUNTER_H__
+/*
+** BSD 3-Clause License
+**
+** Copyright (c) 2018, David Boucher
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**
+** * Redistributions of source code must retain the above copyright notice,
+**   this list of conditions and the following disclaimer.
+**
+** * Redistributions in binary form must reproduce the above copyright notice,
+**   this list of conditions and the following disclaimer in the documentation
+**   and/or other materials provided with the distribution.
+**
+** * Neither the name of the copyright holder nor the names of its
+**   contributors may be used to endorse or promote products derived from
+**   this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+** LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+** CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+** SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+** INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+** CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+** ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+** POSSIBILITY OF SUCH DAMAGE.
+*/
+#include "redismodule.h"
+#include "strtable.h"
+
+/* The rows of a counter having the same values in the counted fields */
+typedef struct _CounterGroup CounterGroup;
+struct _CounterGroup {
+    /* The encoded values, see GroupKey */
+    char *key;
+    size_t len;
+    long long count;
+};
+
+/* The encoding version of counters in RDB files */
+#define COUNTER_ENCVER 1
+
+/* The rows count of each group of values of a set, stored in the key
+ * "tabular:counter:<name>". It is kept up to date with keyspace
+ * notifications. */
+typedef struct _Counter Counter;
+struct _Counter {
+    /* -1 until known for a counter loaded from an RDB file */
+    int db;
+    char *name;
+    char *set;
+    size_t set_len;
+    char **fields;
+    int fields_count;
+    /* row key -> CounterGroup, the entry value is the generation of the last
+     * membership check */
+    StrTable rows;
+    /* encoded values -> CounterGroup */
+    StrTable groups;
+    /* Set when the set changed, the members are read again by the next
+     * CounterGet */
+    int dirty;
+    long long generation;
+    /* Set when the counter key is deleted */
+    int dropped;
+    Counter *next;
+};
+
+int CounterRegisterType(RedisModuleCtx *ctx);
+int CounterCreate(RedisModuleCtx *ctx, RedisModuleString *name,
+                  RedisModuleString *set, RedisModuleString **fields,
+                  int fields_count);
+int CounterDrop(RedisModuleCtx *ctx, RedisModuleString *name);
+int CounterReplyWithGroups(RedisModuleCtx *ctx, RedisModuleString *name);
+int CounterNotify(RedisModuleCtx *ctx, int type, const char *event,
+                  RedisModuleString *key);
+
+#endif /*__COUNTER_H__*/
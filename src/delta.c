@@ -0,0 +1,383 @@
+/*
+** BSD 3-Clause License
+**
+** Copyright (c) 2018, David Boucher
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**
+** * Redistributions of source code must retain the above copyright notice,
+**   this list of conditions and the following disclaimer.
+**
+** * Redistributions in binary form must reproduce the above copyright notice,
+**   this list of conditions and the following disclaimer in the documentation
+**   and/or other materials provided with the distribution.
+**
+** * Neither the name of the copyright holder nor the names of its
+**   contributors may be used to endorse or promote products derived from
+**   this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+** LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+** CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+** SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+** INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+** CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+** ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+** POSSIBILITY OF SUCH DAMAGE.
+*/
+#include <string.h>
+#include "delta.h"
+
+/* The states of the rows of a new window compared to the old one */
+#define DELTA_KEPT 0
+#define DELTA_INSERTED 1
+#define DELTA_MOVED 2
+
+/* A row of a recorded window, the row key or an array made of the row key
+ * and its fields */
+typedef struct _DeltaRow DeltaRow;
+struct _DeltaRow {
+    CacheItem *items;
+    int count;
+    RedisModuleString *key;
+};
+
+/* The versions, in the slot following their token */
+static DeltaVersion versions[DELTA_VERSIONS];
+
+/* The first and the last tokens given */
+static long long first_token = 0;
+static long long last_token = 0;
+
+/* The memory used by the versions */
+static size_t memory = 0;
+
+/**
+ *  NewToken Gives a new token. The first token is the current time, so that
+ *  the tokens given before a restart are not given again, and the next ones
+ *  follow it, so that the last DELTA_VERSIONS tokens have their own slot.
+ */
+static long long NewToken(void) {
+    if (first_token == 0)
+        first_token = last_token = RedisModule_Milliseconds() * 1000;
+    else
+        ++last_token;
+    return last_token;
+}
+
+/**
+ *  GetVersion Gives the version of a token
+ *
+ * @param token The token
+ *
+ * @return The version, NULL if the token is unknown or overwritten
+ */
+static DeltaVersion *GetVersion(long long token) {
+    if (first_token == 0 || token < first_token || token > last_token)
+        return NULL;
+    DeltaVersion *version = &versions[(token - first_token) % DELTA_VERSIONS];
+    return version->token == token ? version : NULL;
+}
+
+/**
+ *  FreeVersion Empties the slot of a version
+ *
+ * @param ctx The Redis context
+ * @param version The version
+ */
+static void FreeVersion(RedisModuleCtx *ctx, DeltaVersion *version) {
+    for (int i = 0; i < version->count; ++i) {
+        if (version->items[i].str)
+            RedisModule_FreeString(ctx, version->items[i].str);
+    }
+    RedisModule_Free(version->items);
+    RedisModule_Free(version->query);
+    memory -= version->memory;
+    memset(version, 0, sizeof(DeltaVersion));
+}
+
+/**
+ *  GetRows Splits recorded items into rows
+ *
+ * @param items The items
+ * @param count The items count
+ * @param rows The rows, an array of count rows at most
+ *
+ * @return The rows count
+ */
+static int GetRows(CacheItem *items, int count, DeltaRow *rows) {
+    int n = 0;
+    for (int i = 0; i < count; i += rows[n++].count) {
+        rows[n].items = items + i;
+        if (items[i].type == CACHE_ARRAY) {
+            rows[n].count = items[i].num + 1;
+            rows[n].key = items[i + 1].str;
+        }
+        else {
+            rows[n].count = 1;
+            rows[n].key = items[i].str;
+        }
+    }
+    return n;
+}
+
+/**
+ *  SameRow Tells if two rows have the same key and fields
+ */
+static int SameRow(DeltaRow *a, DeltaRow *b) {
+    if (a->count != b->count)
+        return 0;
+    for (int i = 0; i < a->count; ++i) {
+        CacheItem *x = &a->items[i];
+        CacheItem *y = &b->items[i];
+        if (x->type != y->type || x->num != y->num)
+            return 0;
+        if (x->str && RedisModule_StringCompare(x->str, y->str))
+            return 0;
+    }
+    return 1;
+}
+
+/**
+ *  Diff Compares a new window to an old one. Rows of the new window are kept,
+ *  inserted or moved, a moved row being removed and inserted at its new
+ *  position. Kept rows are the longest sequence of unchanged rows in the
+ *  same order in both windows.
+ *
+ * @param old The rows of the old window
+ * @param n The old rows count
+ * @param rows The rows of the new window
+ * @param m The new rows count
+ * @param state The state of each new row is stored here
+ * @param removed Each old row missing in the new window is flagged here
+ *
+ * @return The number of removed, inserted and moved rows
+ */
+static int Diff(DeltaRow *old, int n, DeltaRow *rows, int m, int *state,
+                char *removed) {
+    int retval = 0;
+    StrTable keys;
+    StrTableInit(&keys, n);
+    for (int i = 0; i < n; ++i) {
+        size_t len;
+        const char *k = RedisModule_StringPtrLen(old[i].key, &len);
+        StrTableAdd(&keys, k, len)->value = i;
+        removed[i] = 1;
+    }
+
+    /* cand is the old position of unchanged rows, -1 for the others */
+    int *cand = RedisModule_Alloc(3 * (m + 1) * sizeof(int));
+    int *tails = cand + m + 1;
+    int *prev = tails + m + 1;
+    for (int j = 0; j < m; ++j) {
+        size_t len;
+        const char *k = RedisModule_StringPtrLen(rows[j].key, &len);
+        StrEntry *e = StrTableFind(&keys, k, len);
+        cand[j] = -1;
+        state[j] = DELTA_INSERTED;
+        if (e) {
+            removed[e->value] = 0;
+            state[j] = DELTA_MOVED;
+            if (SameRow(&old[e->value], &rows[j]))
+                cand[j] = e->value;
+        }
+    }
+    StrTableFree(&keys);
+
+    /* The longest increasing sequence of old positions */
+    int size = 0;
+    for (int j = 0; j < m; ++j) {
+        if (cand[j] < 0)
+            continue;
+        int lo = 0, hi = size;
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            if (cand[tails[mid]] < cand[j])
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        prev[j] = lo > 0 ? tails[lo - 1] : -1;
+        tails[lo] = j;
+        if (lo == size)
+            size++;
+    }
+    for (int j = size > 0 ? tails[size - 1] : -1; j >= 0; j = prev[j])
+        state[j] = DELTA_KEPT;
+    RedisModule_Free(cand);
+
+    for (int i = 0; i < n; ++i)
+        retval += removed[i];
+    for (int j = 0; j < m; ++j)
+        retval += state[j] != DELTA_KEPT;
+    return retval;
+}
+
+/**
+ *  ReplyWithRows Replies with the rows of a window having a given state, each
+ *  one preceded by its position.
+ */
+static void ReplyWithRows(RedisModuleCtx *ctx, DeltaRow *rows, int m,
+                          int *state, int s) {
+    int count = 0;
+    for (int j = 0; j < m; ++j)
+        count += state[j] == s;
+    RedisModule_ReplyWithArray(ctx, 2 * count);
+    for (int j = 0; j < m; ++j) {
+        if (state[j] == s) {
+            RedisModule_ReplyWithLongLong(ctx, j);
+            CacheReplyWithItems(ctx, rows[j].items, rows[j].count);
+        }
+    }
+}
+
+/**
+ *  SaveVersion Keeps a window for later SINCE queries, in place of the
+ *  version given DELTA_VERSIONS tokens before. The oldest versions are
+ *  dropped to keep the versions under their memory cap, a window larger than
+ *  the cap is not kept.
+ *
+ * @param ctx The Redis context
+ * @param token The token of the version
+ * @param query The query, owned by the version
+ * @param len The query length
+ * @param items The rows of the window
+ * @param count The items count
+ */
+static void SaveVersion(RedisModuleCtx *ctx, long long token, char *query,
+                        size_t len, CacheItem *items, int count) {
+    DeltaVersion *version = &versions[(token - first_token) % DELTA_VERSIONS];
+    FreeVersion(ctx, version);
+
+    size_t size = sizeof(DeltaVersion) + len + count * sizeof(CacheItem);
+    for (int i = 0; i < count; ++i) {
+        if (items[i].str) {
+            size_t l;
+            RedisModule_StringPtrLen(items[i].str, &l);
+            size += l + CACHE_STRING_OVERHEAD;
+        }
+    }
+    if (size > DELTA_MAX_MEMORY) {
+        RedisModule_Free(query);
+        return;
+    }
+    for (long long t = token - DELTA_VERSIONS + 1;
+         memory + size > DELTA_MAX_MEMORY && t < token; ++t) {
+        DeltaVersion *old = GetVersion(t);
+        if (old)
+            FreeVersion(ctx, old);
+    }
+
+    version->token = token;
+    version->query = query;
+    version->len = len;
+    version->items = RedisModule_Alloc((count + 1) * sizeof(CacheItem));
+    memcpy(version->items, items, count * sizeof(CacheItem));
+    version->count = count;
+    version->memory = size;
+    memory += size;
+    for (int i = 0; i < count; ++i) {
+        if (items[i].str)
+            RedisModule_RetainString(ctx, items[i].str);
+    }
+}
+
+/**
+ *  DeltaReply Replies to a TABULAR.GET with SINCE. The reply starts with a
+ *  token identifying the new window and the rows count. If the version given
+ *  by SINCE is known for the same query, and the changes are fewer than the
+ *  window rows, it follows with DELTA, the keys of the removed rows, and the
+ *  inserted and the moved rows, each one preceded by its position in the
+ *  window. Otherwise, it follows with FULL and the rows of the window. An
+ *  unchanged window keeps its token.
+ *
+ * @param ctx The Redis context
+ * @param reply The recorded reply of TABULAR.GET
+ * @param argv The command arguments
+ * @param argc The arguments count with the command
+ * @param since The SINCE option in argv
+ * @param token The token given with SINCE
+ */
+void DeltaReply(RedisModuleCtx *ctx, CacheEntry *reply,
+                RedisModuleString **argv, int argc, RedisModuleString **since,
+                long long token) {
+    /* The query is the command without its SINCE option */
+    RedisModuleString **args = RedisModule_Alloc(argc * sizeof(RedisModuleString *));
+    int n = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (argv + i != since && argv + i != since + 1)
+            args[n++] = argv[i];
+    }
+    size_t len;
+    char *query = CacheQuery(ctx, args, n, &len);
+    RedisModule_Free(args);
+
+    /* The rows count is an integer, or an array with APPROX */
+    CacheItem *total = reply->items + 1;
+    int total_count = total->type == CACHE_ARRAY ? total->num + 1 : 1;
+    CacheItem *items = total + total_count;
+    int count = reply->count - 1 - total_count;
+    DeltaRow *rows = RedisModule_Alloc((count + 1) * sizeof(DeltaRow));
+    int m = GetRows(items, count, rows);
+
+    DeltaVersion *version = GetVersion(token);
+    int delta = 0;
+    int changes = 0;
+    int *state = NULL;
+    char *removed = NULL;
+    DeltaRow *old = NULL;
+    n = 0;
+    if (version && version->len == len
+        && memcmp(version->query, query, len) == 0) {
+        old = RedisModule_Alloc((version->count + 1) * sizeof(DeltaRow));
+        n = GetRows(version->items, version->count, old);
+        state = RedisModule_Alloc((m + 1) * sizeof(int));
+        removed = RedisModule_Alloc(n + 1);
+        changes = Diff(old, n, rows, m, state, removed);
+        delta = changes <= m;
+    }
+
+    long long new_token = token;
+    if (!delta || changes > 0)
+        new_token = NewToken();
+
+    if (delta) {
+        RedisModule_ReplyWithArray(ctx, 6);
+        RedisModule_ReplyWithLongLong(ctx, new_token);
+        CacheReplyWithItems(ctx, total, total_count);
+        RedisModule_ReplyWithSimpleString(ctx, "DELTA");
+        int count_removed = 0;
+        for (int i = 0; i < n; ++i)
+            count_removed += removed[i];
+        RedisModule_ReplyWithArray(ctx, count_removed);
+        for (int i = 0; i < n; ++i) {
+            if (removed[i])
+                RedisModule_ReplyWithString(ctx, old[i].key);
+        }
+        ReplyWithRows(ctx, rows, m, state, DELTA_INSERTED);
+        ReplyWithRows(ctx, rows, m, state, DELTA_MOVED);
+    }
+    else {
+        RedisModule_ReplyWithArray(ctx, 3 + m);
+        RedisModule_ReplyWithLongLong(ctx, new_token);
+        CacheReplyWithItems(ctx, total, total_count);
+        RedisModule_ReplyWithSimpleString(ctx, "FULL");
+        CacheReplyWithItems(ctx, items, count);
+    }
+
+    /* The old version may be overwritten, it is not used anymore */
+    if (new_token != token)
+        SaveVersion(ctx, new_token, query, len, items, count);
+    else
+        RedisModule_Free(query);
+
+    RedisModule_Free(old);
+    RedisModule_Free(state);
+    RedisModule_Free(removed);
+    RedisModule_Free(rows);
+}
@@ -0,0 +1,61 @@
+#ifndef __DELTA_H__
+#define __DELTA_H__
+/*
+** BSD 3-Clause License
+**
+** Copyright (c) 2018, David Boucher
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**
+** * Redistributions of source code must retain the above copyright notice,
+**   this list of conditions and the following disclaimer.
+**
+** * Redistributions in binary form must reproduce the above copyright notice,
+**   this list of conditions and the following disclaimer in the documentation
+**   and/or other materials provided with the distribution.
+**
+** * Neither the name of the copyright holder nor the names of its
+**   contributors may be used to endorse or promote products derived from
+**   this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+** LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+** CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+** SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+** INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+** CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+** ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+** POSSIBILITY OF SUCH DAMAGE.
+*/
+#include "cache.h"
+
+/* The number of versions kept for SINCE, the oldest are overwritten */
+#define DELTA_VERSIONS 1024
+
+/* The memory cap of the kept versions, in bytes */
+#define DELTA_MAX_MEMORY (8 * 1024 * 1024)
+
+/* A window replied to a SINCE query, identified by its token */
+typedef struct _DeltaVersion DeltaVersion;
+struct _DeltaVersion {
+    long long token;
+    /* The query without its SINCE option */
+    char *query;
+    size_t len;
+    /* The rows of the window, as recorded by TABULAR.GET */
+    CacheItem *items;
+    int count;
+    /* The memory used by the version */
+    size_t memory;
+};
+
+void DeltaReply(RedisModuleCtx *ctx, CacheEntry *reply,
+                RedisModuleString **argv, int argc, RedisModuleString **since,
+                long long token);
+
+#endif /*__DELTA_H__*/
@@ -0,0 +1,189 @@
+/*
+** BSD 3-Clause License
+**
+** Copyright (c) 2018, David Boucher
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**
+** * Redistributions of source code must retain the above copyright notice,
+**   this list of conditions and the following disclaimer.
+**
+** * Redistributions in binary form must reproduce the above copyright notice,
+**   this list of conditions and the following disclaimer in the documentation
+**   and/or other materials provided with the distribution.
+**
+** * Neither the name of the copyright holder nor the names of its
+**   contributors may be used to endorse or promote products derived from
+**   this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+** LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+** CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+** SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+** INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+** CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+** ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+** POSSIBILITY OF SUCH DAMAGE.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include "facet.h"
+
+/**
+ *  CountFacets Counts rows by the values of each facet column. All the facets
+ *  are computed in a single pass over the array.
+ *
+ * @param options The command options, containing the facets description
+ * @param array The array of rows
+ * @param size The array size
+ * @param header The array header, facet fields are columns of it
+ * @param block_size The number of columns
+ *
+ * @return An array of options->facets_count facets, to free with FreeFacets
+ */
+Facet *CountFacets(TabularOptions *options, RedisModuleString **array,
+                   long long size, TabularHeader *header, int block_size) {
+    int count = options->facets_count;
+    Facet *retval = RedisModule_Alloc(count * sizeof(Facet));
+    RedisModuleString **argv = options->facets;
+    int idx = 0;
+    for (int f = 0; f < count; ++f) {
+        Facet *facet = &retval[f];
+        facet->field = argv[idx++];
+        facet->limit = 0;
+        if (idx + 1 < options->facets_argc) {
+            const char *a = RedisModule_StringPtrLen(argv[idx], NULL);
+            if (strcasecmp(a, "LIMIT") == 0
+                && RedisModule_StringToLongLong(argv[idx + 1], &facet->limit) == REDISMODULE_OK)
+                idx += 2;
+        }
+        for (int j = 0; j < block_size - 1; ++j) {
+            if (RedisModule_StringCompare(header[j].field, facet->field) == 0) {
+                facet->column = j;
+                break;
+            }
+        }
+        StrTableInit(&facet->table, 64);
+    }
+
+    for (long long i = 0; i < size; i += block_size) {
+        for (int f = 0; f < count; ++f) {
+            RedisModuleString *value = array[i + retval[f].column];
+            if (value) {
+                size_t len;
+                const char *str = RedisModule_StringPtrLen(value, &len);
+                StrTableAdd(&retval[f].table, str, len)->value++;
+            }
+        }
+    }
+    return retval;
+}
+
+/**
+ *  CompareEntries Orders facet values by decreasing count, then by value
+ */
+static int CompareEntries(const void *a, const void *b) {
+    const StrEntry *ea = *(const StrEntry **)a;
+    const StrEntry *eb = *(const StrEntry **)b;
+    if (ea->value != eb->value)
+        return ea->value < eb->value ? 1 : -1;
+    size_t len = ea->len < eb->len ? ea->len : eb->len;
+    int cmp = memcmp(ea->str, eb->str, len);
+    if (cmp)
+        return cmp;
+    return (ea->len > eb->len) - (ea->len < eb->len);
+}
+
+/**
+ *  SortedEntries Gets the values of a facet ordered by decreasing count and
+ *  truncated to its limit.
+ *
+ * @param facet The facet
+ * @param[out] count The number of returned entries
+ *
+ * @return An array of entries to free with RedisModule_Free
+ */
+static StrEntry **SortedEntries(Facet *facet, size_t *count) {
+    StrTable *table = &facet->table;
+    StrEntry **retval = RedisModule_Alloc((table->used ? table->used : 1) * sizeof(StrEntry *));
+    size_t n = 0;
+    for (size_t i = 0; i <= table->mask; ++i) {
+        if (table->entries[i].str)
+            retval[n++] = &table->entries[i];
+    }
+    qsort(retval, n, sizeof(StrEntry *), CompareEntries);
+    if (facet->limit > 0 && (size_t)facet->limit < n)
+        n = facet->limit;
+    *count = n;
+    return retval;
+}
+
+/**
+ *  FacetsReply Replies the facets as an array made of each facet field
+ *  followed by an array of its values and their counts.
+ *
+ * @param ctx The Redis context
+ * @param facets The facets
+ * @param count The number of facets
+ */
+void FacetsReply(RedisModuleCtx *ctx, Facet *facets, int count) {
+    RedisModule_ReplyWithArray(ctx, 2 * count);
+    for (int f = 0; f < count; ++f) {
+        size_t n;
+        StrEntry **entries = SortedEntries(&facets[f], &n);
+        RedisModule_ReplyWithString(ctx, facets[f].field);
+        RedisModule_ReplyWithArray(ctx, 2 * n);
+        for (size_t i = 0; i < n; ++i) {
+            RedisModule_ReplyWithStringBuffer(ctx, entries[i]->str, entries[i]->len);
+            RedisModule_ReplyWithLongLong(ctx, entries[i]->value);
+        }
+        RedisModule_Free(entries);
+    }
+}
+
+/**
+ *  FacetsReplyStore Stores each facet count in the key made of store, the
+ *  word facet, the field and the value, for example "test:facet:status:1".
+ *
+ * @param ctx The Redis context
+ * @param facets The facets
+ * @param count The number of facets
+ * @param store The keys prefix
+ */
+void FacetsReplyStore(RedisModuleCtx *ctx, Facet *facets, int count,
+                      RedisModuleString *store) {
+    size_t len;
+    const char *prefix = RedisModule_StringPtrLen(store, &len);
+    for (int f = 0; f < count; ++f) {
+        size_t n, flen;
+        StrEntry **entries = SortedEntries(&facets[f], &n);
+        const char *field = RedisModule_StringPtrLen(facets[f].field, &flen);
+        for (size_t i = 0; i < n; ++i) {
+            RedisModuleString *tmp = RedisModule_CreateString(ctx, prefix, len);
+            RedisModule_StringAppendBuffer(ctx, tmp, ":facet:", 7);
+            RedisModule_StringAppendBuffer(ctx, tmp, field, flen);
+            RedisModule_StringAppendBuffer(ctx, tmp, ":", 1);
+            RedisModule_StringAppendBuffer(ctx, tmp, entries[i]->str, entries[i]->len);
+            RedisModuleKey *key = RedisModule_OpenKey(ctx, tmp, REDISMODULE_WRITE);
+            RedisModuleString *val = RedisModule_CreateStringFromLongLong(
+                    ctx, entries[i]->value);
+            RedisModule_StringSet(key, val);
+            RedisModule_CloseKey(key);
+            RedisModule_FreeString(ctx, val);
+            RedisModule_FreeString(ctx, tmp);
+        }
+        RedisModule_Free(entries);
+    }
+    RedisModule_ReplyWithSimpleString(ctx, "OK");
+}
+
+void FreeFacets(Facet *facets, int count) {
+    for (int f = 0; f < count; ++f)
+        StrTableFree(&facets[f].table);
+    RedisModule_Free(facets);
+}
@@ -0,0 +1,56 @@
+#ifndef __FACET_H__
+#define __FACET_H__
+/*
+** BSD 3-Clause License
+**
+** Copyright (c) 2018, David Boucher
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**
+** * Redistributions of source code must retain the above copyright notice,
+**   this list of conditions and the following disclaimer.
+**
+** * Redistributions in binary form must reproduce the above copyright notice,
+**   this list of conditions and the following disclaimer in the documentation
+**   and/or other materials provided with the distribution.
+**
+** * Neither the name of the copyright holder nor the names of its
+**   contributors may be used to endorse or promote products derived from
+**   this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+** LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+** CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+** SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+** INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+** CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+** ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+** POSSIBILITY OF SUCH DAMAGE.
+*/
+#include "strtable.h"
+#include "tabular.h"
+
+/* A facet is a flat count of rows by the values of a column */
+typedef struct _Facet Facet;
+struct _Facet {
+    RedisModuleString *field;
+    int column;
+    /* The maximum number of values to return, 0 for no limit */
+    long long limit;
+    /* Values of the column with their count. Strings point into the array */
+    StrTable table;
+};
+
+Facet *CountFacets(TabularOptions *options, RedisModuleString **array,
+                   long long size, TabularHeader *header, int block_size);
+void FacetsReply(RedisModuleCtx *ctx, Facet *facets, int count);
+void FacetsReplyStore(RedisModuleCtx *ctx, Facet *facets, int count,
+                      RedisModuleString *store);
+void FreeFacets(Facet *facets, int count);
+
+#endif /*__FACET_H__*/
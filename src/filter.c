@@ -32,8 +32,152 @@
 */
 #include <fnmatch.h>
 #include <string.h>
+#include "bitmap.h"
 #include "filter.h"
 
+/**
+ *  FilterMatch Tells if a value satisfies the filter of a column
+ *
+ * @param ctx The Redis context
+ * @param header The column description, with its filter
+ * @param value The value to check
+ *
+ * @return 1 if the value satisfies the filter, 0 otherwise.
+ */
+int FilterMatch(RedisModuleCtx *ctx, TabularHeader *header,
+                RedisModuleString *value) {
+    size_t len;
+    const char *txt;
+    int retval = 1;
+    switch (header->tool) {
+        case TABULAR_MATCH:
+            txt = RedisModule_StringPtrLen(value, &len);
+            retval = fnmatch(header->search, txt, FNM_NOESCAPE | FNM_CASEFOLD | FNM_EXTMATCH) == 0;
+            break;
+        case TABULAR_EQUAL:
+            txt = RedisModule_StringPtrLen(value, &len);
+            retval = strcmp(header->search, txt) == 0;
+            break;
+        case TABULAR_IN:
+            if (value) {
+                RedisModuleCallReply *reply = RedisModule_Call(
+                        ctx, "SISMEMBER", "cs", header->search, value);
+                retval = RedisModule_CallReplyInteger(reply);
+                RedisModule_FreeCallReply(reply);
+            }
+            else
+                retval = 0;
+            break;
+        case TABULAR_NONE:
+            break;
+    }
+    return retval;
+}
+
+/**
+ *  FilterOrder Gives the filtered columns in the order their filters are
+ *  applied, from the most selective one. Columns of the same selectivity
+ *  keep their order.
+ *
+ * @param header The columns description
+ * @param block_size The number of columns
+ * @param order The filtered columns indexes
+ *
+ * @return The number of filtered columns
+ */
+int FilterOrder(TabularHeader *header, int block_size, int *order) {
+    int retval = 0;
+    for (int j = 0; j < block_size - 1; ++j) {
+        if (header[j].tool == TABULAR_NONE)
+            continue;
+        int k = retval++;
+        while (k > 0 && header[order[k - 1]].selectivity > header[j].selectivity) {
+            order[k] = order[k - 1];
+            k--;
+        }
+        order[k] = j;
+    }
+    return retval;
+}
+
+/**
+ *  ColumnBitmap Computes the rows satisfying the filter of one column
+ *
+ * @param ctx The Redis context
+ * @param array The array to apply filter on.
+ * @param rows The number of rows in the array
+ * @param header The column description, with its filter
+ * @param j The column index
+ * @param block_size The number of columns.
+ *
+ * @return The bitmap of matching rows, to free with BitmapFree.
+ */
+static Bitmap *ColumnBitmap(RedisModuleCtx *ctx, RedisModuleString **array,
+                            long long rows, TabularHeader *header, int j,
+                            int block_size) {
+    Bitmap *retval = BitmapCreate(rows, 0);
+    for (long long r = 0; r < rows; ++r) {
+        if (FilterMatch(ctx, header, array[r * block_size + j]))
+            BitmapSet(retval, r);
+    }
+    return retval;
+}
+
+/**
+ *  FilterBitmap Computes the rows satisfying all the filters. Rows are
+ *  identified by their index in the array. Each filter gives its own bitmap,
+ *  they are intersected following FilterOrder and the remaining filters are
+ *  skipped as soon as no row is left.
+ *
+ * @param ctx The Redis context
+ * @param array The array to apply filter on.
+ * @param size The array size
+ * @param header Informations on each column, it contains the filter patterns
+ * @param block_size The number of columns.
+ *
+ * @return The bitmap of kept rows, to free with BitmapFree.
+ */
+Bitmap *FilterBitmap(RedisModuleCtx *ctx, RedisModuleString **array,
+                     long long size, TabularHeader *header, int block_size) {
+    long long rows = size / block_size;
+    int order[block_size];
+    int filters = FilterOrder(header, block_size, order);
+    if (filters == 0)
+        return BitmapCreate(rows, 1);
+
+    Bitmap *retval = ColumnBitmap(ctx, array, rows, &header[order[0]],
+                                  order[0], block_size);
+    for (int f = 1; f < filters && BitmapCount(retval) > 0; ++f) {
+        Bitmap *bm = ColumnBitmap(ctx, array, rows, &header[order[f]],
+                                  order[f], block_size);
+        BitmapAnd(retval, bm);
+        BitmapFree(bm);
+    }
+    return retval;
+}
+
+/**
+ *  Compact Moves the rows of a bitmap at the beginning of the array, in the
+ *  same order. Other rows are moved after them, so that the array still
+ *  contains all its strings.
+ *
+ * @param array The array to compact
+ * @param block_size The number of columns
+ * @param rows The rows to move
+ *
+ * @return The size of the array part containing the rows
+ */
+static long long Compact(RedisModuleString **array, int block_size,
+                         Bitmap *rows) {
+    long long dst = 0;
+    for (long long r = BitmapNext(rows, 0); r >= 0; r = BitmapNext(rows, r + 1)) {
+        if (r != dst)
+            Swap(array, block_size, r * block_size, dst * block_size);
+        dst++;
+    }
+    return dst * block_size;
+}
+
 /**
  *  Filter A multicolumn string filter function
  *
@@ -44,62 +188,49 @@
  *
  * @return The new size of the array. The real size of array is not modified
  *         to avoid reallocations, with this information, we know that the new
- *         array must be read in the range [0, return value).
+ *         array must be read in the range [0, return value). Kept rows stay
+ *         in the same order.
  */
-int Filter(RedisModuleCtx *ctx, RedisModuleString **array, int size,
-           TabularHeader *header, int block_size) {
-    int retval = size - block_size;
-    int i, j;
-    for (j = 0; j < block_size - 1; ++j) {
-        size_t len;
-        switch (header[j].tool) {
-            case TABULAR_MATCH:
-                i = 0;
-                while (i <= retval) {
-                    const char *txt = RedisModule_StringPtrLen(array[i + j], &len);
-                    if (fnmatch(header[j].search, txt, FNM_NOESCAPE | FNM_CASEFOLD | FNM_EXTMATCH)) {
-                        Swap(array, block_size, i, retval);
-                        retval -= block_size;
-                    }
-                    else
-                        i += block_size;
-                }
-                break;
-            case TABULAR_EQUAL:
-                i = 0;
-                while (i <= retval) {
-                    const char *txt = RedisModule_StringPtrLen(array[i + j], &len);
-                    if (strncmp(header[j].search, txt, len)) {
-                        Swap(array, block_size, i, retval);
-                        retval -= block_size;
-                    }
-                    else
-                        i += block_size;
-                }
-                break;
-            case TABULAR_IN:
-                i = 0;
-                while (i <= retval) {
-                    int v;
-                    if (array[i + j]) {
-                        RedisModuleCallReply *reply = RedisModule_Call(
-                                ctx, "SISMEMBER", "cs",
-                                header[j].search, array[i + j]);
-                        v = RedisModule_CallReplyInteger(reply);
-                        RedisModule_FreeCallReply(reply);
-                    }
-                    else
-                        v = 0;
+long long Filter(RedisModuleCtx *ctx, RedisModuleString **array,
+                 long long size, TabularHeader *header, int block_size) {
+    Bitmap *rows = FilterBitmap(ctx, array, size, header, block_size);
+    long long count = BitmapCount(rows);
+    /* Nothing to move when all the rows are kept */
+    long long retval = count == rows->size ? count * block_size
+                                           : Compact(array, block_size, rows);
+    BitmapFree(rows);
+    return retval;
+}
 
-                    if (!v) {
-                        Swap(array, block_size, i, retval);
-                        retval -= block_size;
-                    }
-                    else
-                        i += block_size;
-                }
-                break;
+/**
+ *  FilterKeys Applies the filters on the TABULAR_KEY_FIELD pseudo-field to
+ *  the rows keys, before any hash is opened. Since these filters are then
+ *  satisfied, their tool is reset to TABULAR_NONE.
+ *
+ * @param ctx The Redis context
+ * @param header The columns description
+ * @param columns The number of columns in header
+ * @param members The rows keys, removed keys are freed
+ * @param[in,out] count The number of rows keys
+ *
+ * @return The number of applied filters
+ */
+int FilterKeys(RedisModuleCtx *ctx, TabularHeader *header, int columns,
+               RedisModuleString **members, long long *count) {
+    int retval = 0;
+    for (int j = 0; j < columns; ++j) {
+        if (header[j].tool == TABULAR_NONE || !IsKeyField(header[j].field))
+            continue;
+        long long kept = 0;
+        for (long long i = 0; i < *count; ++i) {
+            if (FilterMatch(ctx, &header[j], members[i]))
+                members[kept++] = members[i];
+            else
+                RedisModule_FreeString(ctx, members[i]);
         }
+        *count = kept;
+        header[j].tool = TABULAR_NONE;
+        retval++;
     }
-    return retval + block_size;
+    return retval;
 }
@@ -32,9 +32,17 @@
 ** ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
 ** POSSIBILITY OF SUCH DAMAGE.
 */
+#include "bitmap.h"
 #include "tabular.h"
 
-int Filter(RedisModuleCtx *ctx, RedisModuleString **array, int size,
-           TabularHeader *header, int block_size);
+int FilterMatch(RedisModuleCtx *ctx, TabularHeader *header,
+                RedisModuleString *value);
+int FilterOrder(TabularHeader *header, int block_size, int *order);
+Bitmap *FilterBitmap(RedisModuleCtx *ctx, RedisModuleString **array,
+                     long long size, TabularHeader *header, int block_size);
+long long Filter(RedisModuleCtx *ctx, RedisModuleString **array,
+                 long long size, TabularHeader *header, int block_size);
+int FilterKeys(RedisModuleCtx *ctx, TabularHeader *header, int columns,
+               RedisModuleString **members, long long *count);
 
 #endif /*__FILTER_H__*/
@@ -0,0 +1,1001 @@
+/*
+** BSD 3-Clause License
+**
+** Copyright (c) 2018, David Boucher
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**
+** * Redistributions of source code must retain the above copyright notice,
+**   this list of conditions and the following disclaimer.
+**
+** * Redistributions in binary form must reproduce the above copyright notice,
+**   this list of conditions and the following disclaimer in the documentation
+**   and/or other materials provided with the distribution.
+**
+** * Neither the name of the copyright holder nor the names of its
+**   contributors may be used to endorse or promote products derived from
+**   this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+** LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+** CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+** SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+** INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+** CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+** ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+** POSSIBILITY OF SUCH DAMAGE.
+*/
+#include <fnmatch.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "index.h"
+#include "join.h"
+
+/* The indexes of all the databases */
+static Index *indexes = NULL;
+
+/* The type of the keys holding indexes */
+static RedisModuleType *IndexType = NULL;
+
+/* The maximum number of trigrams taken from a MATCH pattern */
+#define MAX_PATTERN_GRAMS 32
+
+/* The number of keys scanned by each step of an index build */
+#define INDEX_BUILD_STEP "1000"
+
+/* The pause of the build thread between two steps, in microseconds, so that
+ * the server handles its clients meanwhile */
+#define INDEX_BUILD_PAUSE 1000
+
+/* Set while the build thread runs, it is only read and written with the
+ * server lock held */
+static int building = 0;
+
+/**
+ *  CopyString Allocates a copy of a buffer, terminated by a zero
+ */
+static char *CopyString(const char *str, size_t len) {
+    char *retval = RedisModule_Alloc(len + 1);
+    memcpy(retval, str, len);
+    retval[len] = 0;
+    return retval;
+}
+
+/**
+ *  IndexKeyName Gives the name of the key holding the index of a field
+ *
+ * @return The key name, to free with RedisModule_FreeString
+ */
+static RedisModuleString *IndexKeyName(RedisModuleCtx *ctx, const char *field) {
+    return RedisModule_CreateStringPrintf(ctx, "tabular:index:%s", field);
+}
+
+/**
+ *  Dropped Tells if the key of an index has been deleted. The flag is set by
+ *  IndexFree, maybe from the lazy free thread, so it is read atomically.
+ */
+static int Dropped(Index *index) {
+    return __atomic_load_n(&index->dropped, __ATOMIC_ACQUIRE);
+}
+
+/**
+ *  InDb Tells if an index belongs to the current database. Indexes loaded
+ *  from an RDB file do not know their database yet, it is then found by
+ *  looking for their key.
+ *
+ * @param ctx The Redis context
+ * @param index The index
+ *
+ * @return 1 if the index key is in the current database, 0 otherwise.
+ */
+static int InDb(RedisModuleCtx *ctx, Index *index) {
+    int db = RedisModule_GetSelectedDb(ctx);
+    if (index->db >= 0 || Dropped(index))
+        return index->db == db && !Dropped(index);
+
+    RedisModuleString *name = IndexKeyName(ctx, index->field);
+    RedisModuleKey *key = RedisModule_OpenKey(ctx, name, REDISMODULE_READ);
+    if (key) {
+        if (RedisModule_ModuleTypeGetType(key) == IndexType
+                && RedisModule_ModuleTypeGetValue(key) == index)
+            index->db = db;
+        RedisModule_CloseKey(key);
+    }
+    RedisModule_FreeString(ctx, name);
+    return index->db == db;
+}
+
+/**
+ *  IndexGet Looks for the index of a field in the current database
+ *
+ * @param ctx The Redis context
+ * @param field The indexed field
+ *
+ * @return The index or NULL if the field is not indexed or if its index is
+ *         still being built. Join columns and the TABULAR_KEY_FIELD column
+ *         are not hash fields, they never have an index.
+ */
+Index *IndexGet(RedisModuleCtx *ctx, RedisModuleString *field) {
+    if (JoinField(field) || IsKeyField(field))
+        return NULL;
+    const char *f = RedisModule_StringPtrLen(field, NULL);
+    for (Index *idx = indexes; idx; idx = idx->next) {
+        if (idx->ready && strcmp(idx->field, f) == 0 && InDb(ctx, idx))
+            return idx;
+    }
+    return NULL;
+}
+
+/**
+ *  NewPosting Creates a posting and adds it to a table of postings
+ *
+ * @param table The table, values or grams
+ * @param value The posting value, it is copied
+ * @param len The value length
+ *
+ * @return The posting
+ */
+static IndexPosting *NewPosting(StrTable *table, const char *value, size_t len) {
+    StrEntry *e = StrTableAdd(table, value, len);
+    IndexPosting *posting = e->ptr;
+    if (!posting) {
+        posting = RedisModule_Alloc(sizeof(IndexPosting));
+        posting->value = CopyString(value, len);
+        posting->len = len;
+        posting->code = 0;
+        posting->str = NULL;
+        StrTableInit(&posting->keys, 4);
+        /* The entry must point to the copy, not to the given buffer */
+        e->str = posting->value;
+        e->ptr = posting;
+    }
+    return posting;
+}
+
+/**
+ *  PostingDel Removes a key from a posting, the posting is freed when it
+ *  becomes empty.
+ *
+ * @param ctx The Redis context
+ * @param table The table containing the posting
+ * @param posting The posting
+ * @param key The key to remove
+ * @param klen The key length
+ */
+static void PostingDel(RedisModuleCtx *ctx, StrTable *table,
+                       IndexPosting *posting, const char *key, size_t klen) {
+    StrEntry *e = StrTableFind(&posting->keys, key, klen);
+    if (e)
+        StrTableDel(&posting->keys, e);
+    if (posting->keys.used == 0) {
+        StrTableDel(table, StrTableFind(table, posting->value, posting->len));
+        StrTableFree(&posting->keys);
+        if (posting->str)
+            RedisModule_FreeString(ctx, posting->str);
+        RedisModule_Free(posting->value);
+        RedisModule_Free(posting);
+    }
+}
+
+/**
+ *  FreePostings Frees all the postings of a table, and the table.
+ */
+static void FreePostings(RedisModuleCtx *ctx, StrTable *table) {
+    for (size_t i = 0; i <= table->mask; ++i) {
+        IndexPosting *posting = table->entries[i].ptr;
+        if (table->entries[i].str) {
+            StrTableFree(&posting->keys);
+            if (posting->str)
+                RedisModule_FreeString(ctx, posting->str);
+            RedisModule_Free(posting->value);
+            RedisModule_Free(posting);
+        }
+    }
+    StrTableFree(table);
+}
+
+/**
+ *  UpdateGrams Adds or removes a row key to the postings of the trigrams of
+ *  a value. Trigrams are lowercase since MATCH ignores the case.
+ *
+ * @param ctx The Redis context
+ * @param index The index
+ * @param key The row key, owned by index->rows
+ * @param klen The row key length
+ * @param value The value
+ * @param vlen The value length
+ * @param add 1 to add the key, 0 to remove it
+ */
+static void UpdateGrams(RedisModuleCtx *ctx, Index *index, const char *key,
+                        size_t klen, const char *value, size_t vlen, int add) {
+    for (size_t i = 0; i + 3 <= vlen; ++i) {
+        char gram[3] = {tolower((unsigned char)value[i]),
+                        tolower((unsigned char)value[i + 1]),
+                        tolower((unsigned char)value[i + 2])};
+        if (add)
+            StrTableAdd(&NewPosting(&index->grams, gram, 3)->keys, key, klen);
+        else {
+            StrEntry *e = StrTableFind(&index->grams, gram, 3);
+            if (e)
+                PostingDel(ctx, &index->grams, e->ptr, key, klen);
+        }
+    }
+}
+
+/**
+ *  RemoveRow Removes a row from the index
+ *
+ * @param ctx The Redis context
+ * @param index The index
+ * @param row The row entry in index->rows
+ */
+static void RemoveRow(RedisModuleCtx *ctx, Index *index, StrEntry *row) {
+    IndexPosting *posting = row->ptr;
+    char *key = (char *)row->str;
+    if (index->trigram)
+        UpdateGrams(ctx, index, row->str, row->len, posting->value, posting->len, 0);
+    PostingDel(ctx, &index->values, posting, row->str, row->len);
+    StrTableDel(&index->rows, row);
+    RedisModule_Free(key);
+}
+
+/**
+ *  IndexUpdate Sets the value of a row in the index
+ *
+ * @param ctx The Redis context
+ * @param index The index
+ * @param key The row key
+ * @param klen The row key length
+ * @param value The new value of the field, NULL if the row does not contain
+ *              it anymore.
+ * @param vlen The value length
+ */
+static void IndexUpdate(RedisModuleCtx *ctx, Index *index, const char *key,
+                        size_t klen, const char *value, size_t vlen) {
+    StrEntry *row = StrTableFind(&index->rows, key, klen);
+    if (row) {
+        IndexPosting *posting = row->ptr;
+        if (value && posting->len == vlen && memcmp(posting->value, value, vlen) == 0)
+            return;
+        RemoveRow(ctx, index, row);
+    }
+    if (!value)
+        return;
+
+    size_t used = index->values.used;
+    IndexPosting *posting = NewPosting(&index->values, value, vlen);
+    if (index->values.used != used)
+        index->codes_dirty = 1;
+    char *k = CopyString(key, klen);
+    StrTableAdd(&posting->keys, k, klen);
+    StrTableAdd(&index->rows, k, klen)->ptr = posting;
+    if (index->trigram)
+        UpdateGrams(ctx, index, k, klen, value, vlen, 1);
+}
+
+/**
+ *  IndexKey Reads the indexed field of a key and updates the index.
+ *
+ * @param ctx The Redis context
+ * @param index The index
+ * @param key The key to read
+ */
+static void IndexKey(RedisModuleCtx *ctx, Index *index, RedisModuleString *key) {
+    size_t klen;
+    const char *k = RedisModule_StringPtrLen(key, &klen);
+    RedisModuleString *value = NULL;
+    RedisModuleKey *h = RedisModule_OpenKey(ctx, key, REDISMODULE_READ);
+    if (h && RedisModule_KeyType(h) == REDISMODULE_KEYTYPE_HASH)
+        RedisModule_HashGet(h, REDISMODULE_HASH_CFIELDS, index->field, &value, NULL);
+    if (h)
+        RedisModule_CloseKey(h);
+
+    if (value) {
+        size_t vlen;
+        const char *v = RedisModule_StringPtrLen(value, &vlen);
+        IndexUpdate(ctx, index, k, klen, v, vlen);
+        RedisModule_FreeString(ctx, value);
+    }
+    else
+        IndexUpdate(ctx, index, k, klen, NULL, 0);
+}
+
+/**
+ *  NewIndex Allocates an empty index, and adds it to the indexes list
+ *
+ * @param field The indexed field
+ * @param len The field length
+ * @param trigram 1 to also index the trigrams of the values, for MATCH
+ *
+ * @return The index
+ */
+static Index *NewIndex(const char *field, size_t len, int trigram) {
+    Index *index = RedisModule_Alloc(sizeof(Index));
+    index->db = -1;
+    index->field = CopyString(field, len);
+    StrTableInit(&index->values, 16);
+    index->codes_dirty = 1;
+    index->codes = 0;
+    StrTableInit(&index->rows, 1024);
+    index->trigram = trigram;
+    if (trigram)
+        StrTableInit(&index->grams, 1024);
+    index->ready = 0;
+    strcpy(index->cursor, "0");
+    index->dropped = 0;
+    index->next = indexes;
+    indexes = index;
+    return index;
+}
+
+/**
+ *  Sweep Frees the indexes whose key has been deleted
+ *
+ * @param ctx The Redis context
+ */
+static void Sweep(RedisModuleCtx *ctx) {
+    Index **prev = &indexes;
+    while (*prev) {
+        Index *index = *prev;
+        if (!Dropped(index)) {
+            prev = &index->next;
+            continue;
+        }
+        *prev = index->next;
+
+        for (size_t i = 0; i <= index->rows.mask; ++i) {
+            if (index->rows.entries[i].str)
+                RedisModule_Free((char *)index->rows.entries[i].str);
+        }
+        StrTableFree(&index->rows);
+        FreePostings(ctx, &index->values);
+        if (index->trigram)
+            FreePostings(ctx, &index->grams);
+        RedisModule_Free(index->field);
+        RedisModule_Free(index);
+    }
+}
+
+/**
+ *  BuildStep Scans a bounded number of keys of the database of an index
+ *
+ * @param ctx The Redis context, whose database is the one of the index
+ * @param index The index being built
+ */
+static void BuildStep(RedisModuleCtx *ctx, Index *index) {
+    RedisModuleCallReply *reply = RedisModule_Call(
+            ctx, "SCAN", "ccc", index->cursor, "COUNT", INDEX_BUILD_STEP);
+    size_t clen;
+    const char *c = RedisModule_CallReplyStringPtr(
+            RedisModule_CallReplyArrayElement(reply, 0), &clen);
+    if (clen >= sizeof(index->cursor))
+        clen = sizeof(index->cursor) - 1;
+    memcpy(index->cursor, c, clen);
+    index->cursor[clen] = 0;
+
+    RedisModuleCallReply *keys = RedisModule_CallReplyArrayElement(reply, 1);
+    size_t n = RedisModule_CallReplyLength(keys);
+    for (size_t i = 0; i < n; ++i) {
+        RedisModuleString *key = RedisModule_CreateStringFromCallReply(
+                RedisModule_CallReplyArrayElement(keys, i));
+        IndexKey(ctx, index, key);
+        RedisModule_FreeString(ctx, key);
+    }
+    RedisModule_FreeCallReply(reply);
+    index->ready = strcmp(index->cursor, "0") == 0;
+}
+
+/**
+ *  IndexStep Continues the build of the indexes of the current database.
+ *  Each call scans a bounded number of keys, so that a build never blocks
+ *  the server. Until an index is ready, queries do not use it.
+ *
+ * @param ctx The Redis context
+ */
+void IndexStep(RedisModuleCtx *ctx) {
+    Sweep(ctx);
+    for (Index *index = indexes; index; index = index->next) {
+        if (!index->ready && !Dropped(index) && InDb(ctx, index))
+            BuildStep(ctx, index);
+    }
+}
+
+/**
+ *  BuildThread Builds the indexes of all the databases without waiting for
+ *  module commands. Each step is made with the server lock held, which is
+ *  released between steps. The thread ends once every index is ready.
+ */
+static void *BuildThread(void *arg) {
+    RedisModuleCtx *ctx = RedisModule_GetThreadSafeContext(NULL);
+    int pending = 1;
+    while (pending) {
+        RedisModule_ThreadSafeContextLock(ctx);
+        pending = 0;
+        for (Index *index = indexes; index; index = index->next) {
+            if (index->ready || Dropped(index))
+                continue;
+            /* An index loaded before it was ready looks for its key */
+            for (int db = 0; index->db < 0
+                    && RedisModule_SelectDb(ctx, db) == REDISMODULE_OK; ++db)
+                InDb(ctx, index);
+            if (index->db < 0)
+                continue;
+            RedisModule_SelectDb(ctx, index->db);
+            BuildStep(ctx, index);
+            pending |= !index->ready;
+        }
+        if (!pending)
+            building = 0;
+        RedisModule_ThreadSafeContextUnlock(ctx);
+        if (pending)
+            usleep(INDEX_BUILD_PAUSE);
+    }
+    RedisModule_FreeThreadSafeContext(ctx);
+    return NULL;
+}
+
+/**
+ *  StartBuild Starts the build thread unless it runs already. If it cannot be
+ *  started, indexes are still built by IndexStep.
+ */
+static void StartBuild(void) {
+    if (building)
+        return;
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    building = pthread_create(&thread, &attr, BuildThread, NULL) == 0;
+    pthread_attr_destroy(&attr);
+}
+
+/**
+ *  IndexCreate Creates the index of a field in the current database, in the
+ *  key "tabular:index:<field>". The index is then built step by step by the
+ *  build thread, and by IndexStep.
+ *
+ * @param ctx The Redis context
+ * @param field The field to index
+ * @param trigram 1 to also index the trigrams of the values, for MATCH
+ *
+ * @return REDISMODULE_OK or REDISMODULE_ERR if the index key already exists.
+ */
+int IndexCreate(RedisModuleCtx *ctx, RedisModuleString *field, int trigram) {
+    size_t len;
+    const char *f = RedisModule_StringPtrLen(field, &len);
+    RedisModuleString *name = IndexKeyName(ctx, f);
+    RedisModuleKey *key = RedisModule_OpenKey(ctx, name, REDISMODULE_WRITE);
+    RedisModule_FreeString(ctx, name);
+    if (RedisModule_KeyType(key) != REDISMODULE_KEYTYPE_EMPTY) {
+        RedisModule_CloseKey(key);
+        return REDISMODULE_ERR;
+    }
+
+    Index *index = NewIndex(f, len, trigram);
+    index->db = RedisModule_GetSelectedDb(ctx);
+    RedisModule_ModuleTypeSetValue(key, IndexType, index);
+    RedisModule_CloseKey(key);
+    IndexStep(ctx);
+    if (!index->ready)
+        StartBuild();
+    return REDISMODULE_OK;
+}
+
+/**
+ *  IndexDrop Removes the index of a field in the current database, that is
+ *  its key.
+ *
+ * @param ctx The Redis context
+ * @param field The indexed field
+ *
+ * @return REDISMODULE_OK or REDISMODULE_ERR if there is no such index.
+ */
+int IndexDrop(RedisModuleCtx *ctx, RedisModuleString *field) {
+    RedisModuleString *name = IndexKeyName(
+            ctx, RedisModule_StringPtrLen(field, NULL));
+    RedisModuleKey *key = RedisModule_OpenKey(ctx, name, REDISMODULE_WRITE);
+    RedisModule_FreeString(ctx, name);
+    int retval = REDISMODULE_ERR;
+    if (RedisModule_ModuleTypeGetType(key) == IndexType) {
+        RedisModule_DeleteKey(key);
+        retval = REDISMODULE_OK;
+    }
+    RedisModule_CloseKey(key);
+    Sweep(ctx);
+    return retval;
+}
+
+/**
+ *  IndexRdbSave Saves an index. A ready index is saved with its postings, so
+ *  that it is usable as soon as it is loaded. An index being built is saved
+ *  without content, its build starts again after the load.
+ */
+static void IndexRdbSave(RedisModuleIO *rdb, void *value) {
+    Index *index = value;
+    RedisModule_SaveStringBuffer(rdb, index->field, strlen(index->field));
+    RedisModule_SaveUnsigned(rdb, index->trigram);
+    RedisModule_SaveUnsigned(rdb, index->ready);
+    if (!index->ready)
+        return;
+
+    RedisModule_SaveUnsigned(rdb, index->values.used);
+    for (size_t i = 0; i <= index->values.mask; ++i) {
+        if (!index->values.entries[i].str)
+            continue;
+        IndexPosting *posting = index->values.entries[i].ptr;
+        RedisModule_SaveStringBuffer(rdb, posting->value, posting->len);
+        RedisModule_SaveUnsigned(rdb, posting->keys.used);
+        for (size_t j = 0; j <= posting->keys.mask; ++j) {
+            StrEntry *e = &posting->keys.entries[j];
+            if (e->str)
+                RedisModule_SaveStringBuffer(rdb, e->str, e->len);
+        }
+    }
+}
+
+/**
+ *  IndexRdbLoad Loads an index saved by IndexRdbSave
+ */
+static void *IndexRdbLoad(RedisModuleIO *rdb, int encver) {
+    if (encver != INDEX_ENCVER)
+        return NULL;
+
+    RedisModuleCtx *ctx = RedisModule_GetContextFromIO(rdb);
+    size_t len;
+    char *field = RedisModule_LoadStringBuffer(rdb, &len);
+    int trigram = RedisModule_LoadUnsigned(rdb);
+    Index *index = NewIndex(field, len, trigram);
+    RedisModule_Free(field);
+    index->ready = RedisModule_LoadUnsigned(rdb);
+    /* An index saved while being built is built again once loaded. The
+     * build thread waits for the end of the load to take the server lock. */
+    if (!index->ready) {
+        StartBuild();
+        return index;
+    }
+
+    uint64_t values = RedisModule_LoadUnsigned(rdb);
+    for (uint64_t i = 0; i < values; ++i) {
+        size_t vlen;
+        char *value = RedisModule_LoadStringBuffer(rdb, &vlen);
+        uint64_t keys = RedisModule_LoadUnsigned(rdb);
+        for (uint64_t j = 0; j < keys; ++j) {
+            size_t klen;
+            char *key = RedisModule_LoadStringBuffer(rdb, &klen);
+            IndexUpdate(ctx, index, key, klen, value, vlen);
+            RedisModule_Free(key);
+        }
+        RedisModule_Free(value);
+    }
+    return index;
+}
+
+/**
+ *  IndexAofRewrite Rewrites an index as the command creating it, it is then
+ *  built again after the AOF load.
+ */
+static void IndexAofRewrite(RedisModuleIO *aof, RedisModuleString *key,
+                            void *value) {
+    Index *index = value;
+    if (index->trigram)
+        RedisModule_EmitAOF(aof, "TABULAR.INDEX", "ccc", "CREATE", index->field,
+                            "TRIGRAM");
+    else
+        RedisModule_EmitAOF(aof, "TABULAR.INDEX", "cc", "CREATE", index->field);
+}
+
+/**
+ *  IndexFree Called when an index key is deleted. This can happen in a
+ *  background thread (FLUSHALL ASYNC) and without context, so the index is
+ *  only marked, Sweep frees it later from the main thread.
+ */
+static void IndexFree(void *value) {
+    Index *index = value;
+    __atomic_store_n(&index->dropped, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ *  IndexRegisterType Registers the type of the keys holding indexes
+ *
+ * @param ctx The Redis context
+ *
+ * @return REDISMODULE_OK or REDISMODULE_ERR
+ */
+int IndexRegisterType(RedisModuleCtx *ctx) {
+    RedisModuleTypeMethods tm = {
+        .version = REDISMODULE_TYPE_METHOD_VERSION,
+        .rdb_load = IndexRdbLoad,
+        .rdb_save = IndexRdbSave,
+        .aof_rewrite = IndexAofRewrite,
+        .free = IndexFree,
+    };
+    IndexType = RedisModule_CreateDataType(ctx, "tab-index", INDEX_ENCVER, &tm);
+    return IndexType ? REDISMODULE_OK : REDISMODULE_ERR;
+}
+
+/**
+ *  IndexNotify The keyspace notifications callback keeping indexes up to
+ *  date.
+ *
+ * @param ctx The Redis context
+ * @param type The event class
+ * @param event The event name
+ * @param key The modified key
+ *
+ * @return REDISMODULE_OK
+ */
+int IndexNotify(RedisModuleCtx *ctx, int type, const char *event,
+                RedisModuleString *key) {
+    size_t klen;
+    const char *k = RedisModule_StringPtrLen(key, &klen);
+    /* Expired and evicted keys are notified before their deletion */
+    int removed = (type & (REDISMODULE_NOTIFY_EXPIRED | REDISMODULE_NOTIFY_EVICTED))
+                  || strcmp(event, "del") == 0
+                  || strcmp(event, "rename_from") == 0;
+
+    for (Index *index = indexes; index; index = index->next) {
+        if (!InDb(ctx, index))
+            continue;
+        if (removed) {
+            StrEntry *row = StrTableFind(&index->rows, k, klen);
+            if (row)
+                RemoveRow(ctx, index, row);
+        }
+        /* Other types can only replace an indexed hash */
+        else if ((type & (REDISMODULE_NOTIFY_HASH | REDISMODULE_NOTIFY_GENERIC))
+                 || StrTableFind(&index->rows, k, klen))
+            IndexKey(ctx, index, key);
+    }
+    return REDISMODULE_OK;
+}
+
+/**
+ *  IndexValue Gives the value of the indexed field of a row, from the index.
+ *  All the rows having the same value share the same string, so that a
+ *  repeated value is stored once.
+ *
+ * @param ctx The Redis context
+ * @param index The index
+ * @param key The row key
+ *
+ * @return The value, to free with RedisModule_FreeString, or NULL if the row
+ *         has no such field.
+ */
+RedisModuleString *IndexValue(RedisModuleCtx *ctx, Index *index,
+                              RedisModuleString *key) {
+    size_t len;
+    const char *k = RedisModule_StringPtrLen(key, &len);
+    StrEntry *row = StrTableFind(&index->rows, k, len);
+    if (!row)
+        return NULL;
+    IndexPosting *posting = row->ptr;
+    if (!posting->str)
+        posting->str = RedisModule_CreateString(ctx, posting->value, posting->len);
+    RedisModule_RetainString(ctx, posting->str);
+    return posting->str;
+}
+
+static int CmpPostings(const void *a, const void *b) {
+    const IndexPosting *pa = *(IndexPosting * const *)a;
+    const IndexPosting *pb = *(IndexPosting * const *)b;
+    return strcmp(pa->value, pb->value);
+}
+
+/**
+ *  IndexCodes Gives the dictionary of the index values. Codes are assigned
+ *  following the ALPHA order, so that two values compare as their codes.
+ *  They are computed again only when new values have been indexed.
+ *
+ * @param index The index
+ *
+ * @return A table whose entries values are the values codes
+ */
+StrTable *IndexCodes(Index *index) {
+    if (!index->codes_dirty)
+        return &index->values;
+
+    StrTable *values = &index->values;
+    IndexPosting **postings = RedisModule_Alloc(
+            (values->used ? values->used : 1) * sizeof(IndexPosting *));
+    size_t n = 0;
+    for (size_t i = 0; i <= values->mask; ++i) {
+        if (values->entries[i].str)
+            postings[n++] = values->entries[i].ptr;
+    }
+    qsort(postings, n, sizeof(IndexPosting *), CmpPostings);
+    for (size_t i = 0; i < n; ++i)
+        postings[i]->code = i;
+    for (size_t i = 0; i <= values->mask; ++i) {
+        if (values->entries[i].str) {
+            IndexPosting *posting = values->entries[i].ptr;
+            values->entries[i].value = posting->code;
+        }
+    }
+    RedisModule_Free(postings);
+    index->codes = n;
+    index->codes_dirty = 0;
+    return values;
+}
+
+/**
+ *  PatternGrams Gives the trigrams every value matched by a MATCH pattern
+ *  contains, that is the trigrams of its literal runs. Brackets and extended
+ *  patterns like '@(a|b)' are skipped since their content is optional.
+ *
+ * @param pattern The fnmatch pattern
+ * @param grams The lowercase trigrams found
+ *
+ * @return The number of trigrams, at most MAX_PATTERN_GRAMS
+ */
+static int PatternGrams(const char *pattern, char grams[][3]) {
+    int retval = 0;
+    size_t run = 0;
+    int depth = 0;
+    char window[3];
+    for (const char *p = pattern; *p && retval < MAX_PATTERN_GRAMS; ++p) {
+        if (depth > 0) {
+            if (*p == '(')
+                depth++;
+            else if (*p == ')')
+                depth--;
+            continue;
+        }
+        if (strchr("?*+@!", *p) && p[1] == '(') {
+            depth = 1;
+            p++;
+            run = 0;
+        }
+        else if (*p == '?' || *p == '*')
+            run = 0;
+        else if (*p == '[') {
+            /* A ']' just after '[' or '[!' is part of the set */
+            const char *q = p + 1;
+            if (*q == '!' || *q == '^')
+                q++;
+            if (*q == ']')
+                q++;
+            q = strchr(q, ']');
+            if (q)
+                p = q;
+            run = 0;
+        }
+        else {
+            window[0] = window[1];
+            window[1] = window[2];
+            window[2] = tolower((unsigned char)*p);
+            if (++run >= 3)
+                memcpy(grams[retval++], window, 3);
+        }
+    }
+    return retval;
+}
+
+/**
+ *  Keep Keeps the members accepted by a predicate on their index entry, the
+ *  other ones are freed.
+ */
+static void Keep(RedisModuleCtx *ctx, RedisModuleString **members,
+                 long long *count,
+                 int (*accept)(const char *key, size_t len, void *data),
+                 void *data) {
+    long long kept = 0;
+    for (long long i = 0; i < *count; ++i) {
+        size_t len;
+        const char *k = RedisModule_StringPtrLen(members[i], &len);
+        if (accept(k, len, data))
+            members[kept++] = members[i];
+        else
+            RedisModule_FreeString(ctx, members[i]);
+    }
+    *count = kept;
+}
+
+/* The state of an EQUAL or IN restriction */
+typedef struct {
+    Index *index;
+    StrTable bag;
+} ValuesFilter;
+
+static int AcceptValue(const char *key, size_t len, void *data) {
+    ValuesFilter *filter = data;
+    StrEntry *row = StrTableFind(&filter->index->rows, key, len);
+    IndexPosting *posting = row ? row->ptr : NULL;
+    return posting && StrTableFind(&filter->bag, posting->value, posting->len);
+}
+
+/* The state of a MATCH restriction, postings sorted by size */
+typedef struct {
+    IndexPosting *postings[MAX_PATTERN_GRAMS];
+    int count;
+} GramsFilter;
+
+static int AcceptGrams(const char *key, size_t len, void *data) {
+    GramsFilter *filter = data;
+    for (int i = 0; i < filter->count; ++i) {
+        if (!StrTableFind(&filter->postings[i]->keys, key, len))
+            return 0;
+    }
+    return 1;
+}
+
+/**
+ *  RestrictValues Keeps the members whose value satisfies an EQUAL or IN
+ *  filter. Nothing is removed if the IN set is not a set.
+ */
+static void RestrictValues(RedisModuleCtx *ctx, Index *index,
+                           TabularHeader *header, RedisModuleString **members,
+                           long long *count) {
+    /* The accepted values */
+    ValuesFilter filter;
+    filter.index = index;
+    RedisModuleCallReply *reply = NULL;
+    if (header->tool == TABULAR_IN) {
+        reply = RedisModule_Call(ctx, "SMEMBERS", "c", header->search);
+        if (RedisModule_CallReplyType(reply) != REDISMODULE_REPLY_ARRAY) {
+            RedisModule_FreeCallReply(reply);
+            return;
+        }
+        size_t n = RedisModule_CallReplyLength(reply);
+        StrTableInit(&filter.bag, n);
+        for (size_t i = 0; i < n; ++i) {
+            size_t len;
+            const char *str = RedisModule_CallReplyStringPtr(
+                    RedisModule_CallReplyArrayElement(reply, i), &len);
+            StrTableAdd(&filter.bag, str, len);
+        }
+    }
+    else {
+        StrTableInit(&filter.bag, 1);
+        StrTableAdd(&filter.bag, header->search, strlen(header->search));
+    }
+
+    Keep(ctx, members, count, AcceptValue, &filter);
+
+    StrTableFree(&filter.bag);
+    if (reply)
+        RedisModule_FreeCallReply(reply);
+}
+
+/**
+ *  RestrictGrams Keeps the members whose value contains all the trigrams of
+ *  a MATCH pattern. Postings are intersected from the smallest one.
+ */
+static void RestrictGrams(RedisModuleCtx *ctx, Index *index,
+                          TabularHeader *header, RedisModuleString **members,
+                          long long *count) {
+    char grams[MAX_PATTERN_GRAMS][3];
+    int n = PatternGrams(header->search, grams);
+    GramsFilter filter;
+    filter.count = 0;
+    for (int i = 0; i < n; ++i) {
+        StrEntry *e = StrTableFind(&index->grams, grams[i], 3);
+        if (!e) {
+            /* No value contains this trigram */
+            for (long long j = 0; j < *count; ++j)
+                RedisModule_FreeString(ctx, members[j]);
+            *count = 0;
+            return;
+        }
+        IndexPosting *posting = e->ptr;
+        int j;
+        for (j = filter.count; j > 0
+                && filter.postings[j - 1]->keys.used > posting->keys.used; --j)
+            filter.postings[j] = filter.postings[j - 1];
+        filter.postings[j] = posting;
+        filter.count++;
+    }
+    if (filter.count > 0)
+        Keep(ctx, members, count, AcceptGrams, &filter);
+}
+
+/**
+ *  IndexRestrict Removes from members the rows that cannot satisfy an EQUAL
+ *  or IN filter on an indexed column, or a MATCH filter on a trigram indexed
+ *  column. No hash is opened. Filters are kept: the index may miss changes
+ *  that are not notified, so the kept rows are still checked against their
+ *  hash.
+ *
+ * @param ctx The Redis context
+ * @param header The columns description
+ * @param columns The number of columns in header
+ * @param members The rows keys, removed keys are freed
+ * @param[in,out] count The number of rows keys
+ */
+void IndexRestrict(RedisModuleCtx *ctx, TabularHeader *header, int columns,
+                   RedisModuleString **members, long long *count) {
+    for (int j = 0; j < columns; ++j) {
+        if (header[j].tool == TABULAR_NONE)
+            continue;
+        Index *index = IndexGet(ctx, header[j].field);
+        if (!index)
+            continue;
+        if (header[j].tool == TABULAR_MATCH) {
+            if (index->trigram)
+                RestrictGrams(ctx, index, &header[j], members, count);
+        }
+        else
+            RestrictValues(ctx, index, &header[j], members, count);
+    }
+}
+
+/**
+ *  IndexCount Counts rows of a set by the values of an indexed field, without
+ *  opening any hash. The only filter is the one on this field. Rows are
+ *  grouped by the code of their value in a flat array, and the filter is
+ *  applied once per value.
+ *
+ * @param ctx The Redis context
+ * @param index The index of the field
+ * @param header The column description, with its MATCH or EQUAL filter
+ * @param members The rows keys
+ * @param count The number of rows keys
+ *
+ * @return The count list, to free with FreeIndexCountList
+ */
+CountList *IndexCount(RedisModuleCtx *ctx, Index *index, TabularHeader *header,
+                      RedisModuleString **members, long long count) {
+    CountList *retval = RedisModule_Alloc(sizeof(CountList));
+    memset(retval, 0, sizeof(CountList));
+
+    IndexCodes(index);
+    long long *counts = RedisModule_Calloc(index->codes ? index->codes : 1,
+                                           sizeof(long long));
+    for (long long i = 0; i < count; ++i) {
+        size_t len;
+        const char *k = RedisModule_StringPtrLen(members[i], &len);
+        StrEntry *row = StrTableFind(&index->rows, k, len);
+        if (row)
+            counts[((IndexPosting *)row->ptr)->code]++;
+    }
+
+    /* Groups are listed in the order of their first row, as Count does */
+    CountList *lst = NULL;
+    for (long long i = 0; i < count; ++i) {
+        size_t len;
+        const char *k = RedisModule_StringPtrLen(members[i], &len);
+        StrEntry *row = StrTableFind(&index->rows, k, len);
+        IndexPosting *posting = row ? row->ptr : NULL;
+        if (!posting || counts[posting->code] == 0)
+            continue;
+        int match;
+        if (header->tool == TABULAR_MATCH)
+            match = fnmatch(header->search, posting->value,
+                            FNM_NOESCAPE | FNM_CASEFOLD | FNM_EXTMATCH) == 0;
+        else
+            match = strcmp(header->search, posting->value) == 0;
+        if (match) {
+            if (lst) {
+                lst->next = RedisModule_Alloc(sizeof(CountList));
+                lst = lst->next;
+                memset(lst, 0, sizeof(CountList));
+            }
+            else
+                lst = retval;
+            lst->content = RedisModule_CreateString(ctx, posting->value, posting->len);
+            lst->count = counts[posting->code];
+        }
+        counts[posting->code] = 0;
+    }
+    RedisModule_Free(counts);
+    return retval;
+}
+
+/**
+ *  FreeIndexCountList Frees a count list built by IndexCount, with its
+ *  strings.
+ */
+void FreeIndexCountList(RedisModuleCtx *ctx, CountList *cnt) {
+    for (CountList *lst = cnt; lst; lst = lst->next) {
+        if (lst->content)
+            RedisModule_FreeString(ctx, lst->content);
+    }
+    FreeCountList(cnt, 0);
+}
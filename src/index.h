@@ -0,0 +1,100 @@
+#ifndef __INDEX_H__
+#define __INDEX_H__
+/*
+** BSD 3-Clause License
+**
+** Copyright (c) 2018, David Boucher
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**
+** * Redistributions of source code must retain the above copyright notice,
+**   this list of conditions and the following disclaimer.
+**
+** * Redistributions in binary form must reproduce the above copyright notice,
+**   this list of conditions and the following disclaimer in the documentation
+**   and/or other materials provided with the distribution.
+**
+** * Neither the name of the copyright holder nor the names of its
+**   contributors may be used to endorse or promote products derived from
+**   this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+** LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+** CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+** SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+** INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+** CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+** ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+** POSSIBILITY OF SUCH DAMAGE.
+*/
+#include "count.h"
+#include "strtable.h"
+#include "tabular.h"
+
+/* The rows having a given value in an indexed field */
+typedef struct _IndexPosting IndexPosting;
+struct _IndexPosting {
+    char *value;
+    size_t len;
+    /* Row keys, they are shared with the index rows table */
+    StrTable keys;
+    /* The rank of the value in the ALPHA order, valid when the codes of
+     * the index are */
+    long long code;
+    /* The value shared by the rows read from the index, created on demand */
+    RedisModuleString *str;
+};
+
+/* The encoding version of indexes in RDB files */
+#define INDEX_ENCVER 1
+
+/* An inverted index on a hash field of a database, stored in the key
+ * "tabular:index:<field>". Each hash containing the field is indexed. */
+typedef struct _Index Index;
+struct _Index {
+    /* -1 until known for an index loaded from an RDB file */
+    int db;
+    char *field;
+    /* value -> IndexPosting, the entry value is the rank of the value in the
+     * ALPHA order, valid when codes_dirty is 0 */
+    StrTable values;
+    int codes_dirty;
+    /* The number of codes given, codes are below it */
+    size_t codes;
+    /* row key -> IndexPosting */
+    StrTable rows;
+    /* If set, grams maps each lowercase trigram of the values to the
+     * IndexPosting of the rows containing it */
+    int trigram;
+    StrTable grams;
+    /* The index is built step by step, with a SCAN cursor */
+    int ready;
+    char cursor[32];
+    /* Set when the index key is deleted, maybe from another thread, it is
+     * only accessed atomically */
+    int dropped;
+    Index *next;
+};
+
+int IndexRegisterType(RedisModuleCtx *ctx);
+Index *IndexGet(RedisModuleCtx *ctx, RedisModuleString *field);
+void IndexStep(RedisModuleCtx *ctx);
+int IndexCreate(RedisModuleCtx *ctx, RedisModuleString *field, int trigram);
+int IndexDrop(RedisModuleCtx *ctx, RedisModuleString *field);
+int IndexNotify(RedisModuleCtx *ctx, int type, const char *event,
+                RedisModuleString *key);
+RedisModuleString *IndexValue(RedisModuleCtx *ctx, Index *index,
+                              RedisModuleString *key);
+StrTable *IndexCodes(Index *index);
+void IndexRestrict(RedisModuleCtx *ctx, TabularHeader *header, int columns,
+                   RedisModuleString **members, long long *count);
+CountList *IndexCount(RedisModuleCtx *ctx, Index *index, TabularHeader *header,
+                      RedisModuleString **members, long long count);
+void FreeIndexCountList(RedisModuleCtx *ctx, CountList *cnt);
+
+#endif /*__INDEX_H__*/
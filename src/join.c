@@ -0,0 +1,276 @@
+/*
+** BSD 3-Clause License
+**
+** Copyright (c) 2018, David Boucher
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**
+** * Redistributions of source code must retain the above copyright notice,
+**   this list of conditions and the following disclaimer.
+**
+** * Redistributions in binary form must reproduce the above copyright notice,
+**   this list of conditions and the following disclaimer in the documentation
+**   and/or other materials provided with the distribution.
+**
+** * Neither the name of the copyright holder nor the names of its
+**   contributors may be used to endorse or promote products derived from
+**   this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+** LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+** CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+** SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+** INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+** CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+** ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+** POSSIBILITY OF SUCH DAMAGE.
+*/
+#include <string.h>
+#include "join.h"
+
+/* The values of a referenced hash, one for each join column */
+typedef struct _JoinEntry JoinEntry;
+struct _JoinEntry {
+    RedisModuleString *key;
+    RedisModuleString *values[];
+};
+
+/**
+ *  Arrow Finds the arrow of a join column
+ *
+ * @param field The column field
+ * @param[out] len The field length
+ *
+ * @return The arrow in field, or NULL if field is not a join column. The
+ *         reference and the referenced field must not be empty.
+ */
+static const char *Arrow(RedisModuleString *field, size_t *len) {
+    const char *str = RedisModule_StringPtrLen(field, len);
+    const char *arrow = strstr(str, JOIN_ARROW);
+    if (arrow == NULL || arrow == str
+        || arrow + strlen(JOIN_ARROW) == str + *len)
+        return NULL;
+    return arrow;
+}
+
+/**
+ *  JoinField Tells if a field is a join column, that is a reference field
+ *  followed by JOIN_ARROW and a field of the referenced hash.
+ */
+int JoinField(RedisModuleString *field) {
+    size_t len;
+    return Arrow(field, &len) != NULL;
+}
+
+/**
+ *  JoinCreate Finds the join columns of a query
+ *
+ * @param ctx The Redis context
+ * @param header The columns description
+ * @param columns The number of columns in header
+ *
+ * @return The join columns to free with JoinFree, or NULL if there is none.
+ */
+Join *JoinCreate(RedisModuleCtx *ctx, TabularHeader *header, int columns) {
+    int count = 0;
+    for (int i = 0; i < columns; ++i) {
+        if (JoinField(header[i].field))
+            count++;
+    }
+    if (count == 0)
+        return NULL;
+
+    Join *retval = RedisModule_Alloc(sizeof(Join));
+    retval->count = 0;
+    retval->columns = RedisModule_Alloc(count * sizeof(int));
+    retval->refs = RedisModule_Alloc(count * sizeof(RedisModuleString *));
+    retval->fields = RedisModule_Alloc(count * sizeof(RedisModuleString *));
+    for (int i = 0; i < columns; ++i) {
+        size_t len;
+        const char *arrow = Arrow(header[i].field, &len);
+        if (arrow == NULL)
+            continue;
+        const char *str = RedisModule_StringPtrLen(header[i].field, NULL);
+        const char *field = arrow + strlen(JOIN_ARROW);
+        int j = retval->count++;
+        retval->columns[j] = i;
+        retval->refs[j] = RedisModule_CreateString(ctx, str, arrow - str);
+        retval->fields[j] = RedisModule_CreateString(ctx, field,
+                                                     str + len - field);
+    }
+    StrTableInit(&retval->memo, 16);
+    return retval;
+}
+
+/**
+ *  JoinColumn Gives the join column of a header column
+ *
+ * @return The index of the join column, or -1 if the column is not a join
+ *         column.
+ */
+int JoinColumn(Join *join, int column) {
+    for (int j = 0; join && j < join->count; ++j) {
+        if (join->columns[j] == column)
+            return j;
+    }
+    return -1;
+}
+
+/**
+ *  Reference Reads the key referenced by a row
+ *
+ * @return The key to free with RedisModule_FreeString, or NULL if the row
+ *         has no such reference.
+ */
+static RedisModuleString *Reference(RedisModuleKey *row,
+                                    RedisModuleString *ref) {
+    RedisModuleString *retval = NULL;
+    if (row && RedisModule_KeyType(row) == REDISMODULE_KEYTYPE_HASH)
+        RedisModule_HashGet(row, REDISMODULE_HASH_NONE, ref, &retval, NULL);
+    return retval;
+}
+
+/**
+ *  JoinValue Gives the value of a join column for a row. The referenced
+ *  hash is read the first time it is met, with the fields of all the join
+ *  columns.
+ *
+ * @param ctx The Redis context
+ * @param join The join columns
+ * @param j The join column
+ * @param row The row hash, it may be NULL
+ *
+ * @return The value to free with RedisModule_FreeString, or NULL if the row
+ *         has no reference or the referenced hash has no such field.
+ */
+RedisModuleString *JoinValue(RedisModuleCtx *ctx, Join *join, int j,
+                             RedisModuleKey *row) {
+    RedisModuleString *ref = Reference(row, join->refs[j]);
+    if (ref == NULL)
+        return NULL;
+
+    size_t len;
+    const char *k = RedisModule_StringPtrLen(ref, &len);
+    StrEntry *e = StrTableFind(&join->memo, k, len);
+    if (e == NULL) {
+        JoinEntry *entry = RedisModule_Alloc(
+                sizeof(JoinEntry) + join->count * sizeof(RedisModuleString *));
+        entry->key = ref;
+        ref = NULL;
+        RedisModuleKey *key = RedisModule_OpenKey(ctx, entry->key,
+                                                  REDISMODULE_READ);
+        int hash = key && RedisModule_KeyType(key) == REDISMODULE_KEYTYPE_HASH;
+        for (int f = 0; f < join->count; ++f) {
+            entry->values[f] = NULL;
+            if (hash)
+                RedisModule_HashGet(key, REDISMODULE_HASH_NONE,
+                                    join->fields[f], &entry->values[f], NULL);
+        }
+        if (key)
+            RedisModule_CloseKey(key);
+        /* The entry string lives as long as the entry */
+        k = RedisModule_StringPtrLen(entry->key, &len);
+        e = StrTableAdd(&join->memo, k, len);
+        e->ptr = entry;
+    }
+    if (ref)
+        RedisModule_FreeString(ctx, ref);
+
+    RedisModuleString *retval = ((JoinEntry *)e->ptr)->values[j];
+    if (retval)
+        RedisModule_RetainString(ctx, retval);
+    return retval;
+}
+
+/**
+ *  JoinRead Reads the value of a join field for a single row, without
+ *  memo. It is used for fields only returned with the rows.
+ *
+ * @param ctx The Redis context
+ * @param row The row hash, it may be NULL
+ * @param field The join field
+ * @param entry A recorded reply depending on the referenced hash, or NULL
+ *
+ * @return The value to free with RedisModule_FreeString, or NULL.
+ */
+RedisModuleString *JoinRead(RedisModuleCtx *ctx, RedisModuleKey *row,
+                            RedisModuleString *field, CacheEntry *entry) {
+    size_t len;
+    const char *arrow = Arrow(field, &len);
+    if (arrow == NULL)
+        return NULL;
+    const char *str = RedisModule_StringPtrLen(field, NULL);
+    RedisModuleString *ref = RedisModule_CreateString(ctx, str, arrow - str);
+    RedisModuleString *key_name = Reference(row, ref);
+    RedisModule_FreeString(ctx, ref);
+    if (key_name == NULL)
+        return NULL;
+
+    RedisModuleString *retval = NULL;
+    const char *name = arrow + strlen(JOIN_ARROW);
+    RedisModuleKey *key = RedisModule_OpenKey(ctx, key_name, REDISMODULE_READ);
+    if (key && RedisModule_KeyType(key) == REDISMODULE_KEYTYPE_HASH)
+        RedisModule_HashGet(key, REDISMODULE_HASH_CFIELDS, name, &retval, NULL);
+    if (key)
+        RedisModule_CloseKey(key);
+    if (entry) {
+        const char *k = RedisModule_StringPtrLen(key_name, &len);
+        CacheDepend(entry, k, len);
+    }
+    RedisModule_FreeString(ctx, key_name);
+    return retval;
+}
+
+/**
+ *  JoinDepend Makes a recorded reply depend on the hashes read through the
+ *  join columns, so that it is dropped when one of them changes.
+ *
+ * @param join The join columns, it may be NULL
+ * @param entry The recorded reply
+ */
+void JoinDepend(Join *join, CacheEntry *entry) {
+    if (join == NULL)
+        return;
+    for (size_t i = 0; i <= join->memo.mask; ++i) {
+        StrEntry *e = &join->memo.entries[i];
+        if (e->str)
+            CacheDepend(entry, e->str, e->len);
+    }
+}
+
+/**
+ *  JoinFree Frees the join columns with their memo
+ *
+ * @param ctx The Redis context
+ * @param join The join columns, it may be NULL
+ */
+void JoinFree(RedisModuleCtx *ctx, Join *join) {
+    if (join == NULL)
+        return;
+    for (size_t i = 0; i <= join->memo.mask; ++i) {
+        StrEntry *e = &join->memo.entries[i];
+        if (e->str == NULL)
+            continue;
+        JoinEntry *entry = e->ptr;
+        for (int f = 0; f < join->count; ++f) {
+            if (entry->values[f])
+                RedisModule_FreeString(ctx, entry->values[f]);
+        }
+        RedisModule_FreeString(ctx, entry->key);
+        RedisModule_Free(entry);
+    }
+    StrTableFree(&join->memo);
+    for (int j = 0; j < join->count; ++j) {
+        RedisModule_FreeString(ctx, join->refs[j]);
+        RedisModule_FreeString(ctx, join->fields[j]);
+    }
+    RedisModule_Free(join->columns);
+    RedisModule_Free(join->refs);
+    RedisModule_Free(join->fields);
+    RedisModule_Free(join);
+}
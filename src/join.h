@@ -0,0 +1,68 @@
+#ifndef __JOIN_H__
+#define __JOIN_H__
+/*
+** BSD 3-Clause License
+**
+** Copyright (c) 2018, David Boucher
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**
+** * Redistributions of source code must retain the above copyright notice,
+**   this list of conditions and the following disclaimer.
+**
+** * Redistributions in binary form must reproduce the above copyright notice,
+**   this list of conditions and the following disclaimer in the documentation
+**   and/or other materials provided with the distribution.
+**
+** * Neither the name of the copyright holder nor the names of its
+**   contributors may be used to endorse or promote products derived from
+**   this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+** LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+** CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+** SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+** INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+** CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+** ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+** POSSIBILITY OF SUCH DAMAGE.
+*/
+#include "cache.h"
+#include "strtable.h"
+#include "tabular.h"
+
+/* The marker separating the reference field from the field of the
+ * referenced hash in a join column, as in "host_id->name" */
+#define JOIN_ARROW "->"
+
+/* The join columns of a query. The value of a join column is read in the
+ * hash whose key is the value of the reference field of the row. */
+typedef struct _Join Join;
+struct _Join {
+    /* For each join column, its index in the header, the reference field
+     * and the field of the referenced hash */
+    int count;
+    int *columns;
+    RedisModuleString **refs;
+    RedisModuleString **fields;
+    /* referenced key -> JoinEntry, so that each referenced hash is read once
+     * for the whole query */
+    StrTable memo;
+};
+
+int JoinField(RedisModuleString *field);
+Join *JoinCreate(RedisModuleCtx *ctx, TabularHeader *header, int columns);
+int JoinColumn(Join *join, int column);
+RedisModuleString *JoinValue(RedisModuleCtx *ctx, Join *join, int j,
+                             RedisModuleKey *row);
+RedisModuleString *JoinRead(RedisModuleCtx *ctx, RedisModuleKey *row,
+                            RedisModuleString *field, CacheEntry *entry);
+void JoinDepend(Join *join, CacheEntry *entry);
+void JoinFree(RedisModuleCtx *ctx, Join *join);
+
+#endif /*__JOIN_H__*/
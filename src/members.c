@@ -0,0 +1,156 @@
+/*
+** BSD 3-Clause License
+**
+** Copyright (c) 2018, David Boucher
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**
+** * Redistributions of source code must retain the above copyright notice,
+**   this list of conditions and the following disclaimer.
+**
+** * Redistributions in binary form must reproduce the above copyright notice,
+**   this list of conditions and the following disclaimer in the documentation
+**   and/or other materials provided with the distribution.
+**
+** * Neither the name of the copyright holder nor the names of its
+**   contributors may be used to endorse or promote products derived from
+**   this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+** LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+** CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+** SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+** INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+** CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+** ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+** POSSIBILITY OF SUCH DAMAGE.
+*/
+#include <string.h>
+#include "members.h"
+#include "strtable.h"
+
+/**
+ *  GetMembers Gets the rows keys. They are the members of set, combined with
+ *  other sets if the UNION, INTER or DIFF option is given. The combination is
+ *  made here, without intermediate keys.
+ *
+ * @param ctx The Redis context
+ * @param set The main set
+ * @param options The command options, they may contain other sets to combine
+ *                with set. It can be NULL.
+ * @param[out] members An allocated array containing the rows keys, to free
+ *                     with RedisModule_Free, keys are owned by the caller.
+ * @param[out] count The number of rows keys.
+ *
+ * @return REDISMODULE_OK on success or REDISMODULE_ERR if a key is not a set.
+ */
+int GetMembers(RedisModuleCtx *ctx, RedisModuleString *set,
+               TabularOptions *options, RedisModuleString ***members,
+               long long *count) {
+    int sets_count = 1;
+    if (options && options->set_op != TABULAR_SET_NONE)
+        sets_count += options->sets_count;
+
+    RedisModuleCallReply *reply[sets_count];
+    size_t total = 0;
+    int retval = REDISMODULE_OK;
+    int i;
+    for (i = 0; i < sets_count; ++i) {
+        reply[i] = RedisModule_Call(ctx, "SMEMBERS", "s",
+                                    i == 0 ? set : options->sets[i - 1]);
+        if (RedisModule_CallReplyType(reply[i]) != REDISMODULE_REPLY_ARRAY) {
+            RedisModule_FreeCallReply(reply[i]);
+            retval = REDISMODULE_ERR;
+            break;
+        }
+        total += RedisModule_CallReplyLength(reply[i]);
+    }
+
+    if (retval == REDISMODULE_ERR) {
+        while (--i >= 0)
+            RedisModule_FreeCallReply(reply[i]);
+        return retval;
+    }
+
+    size_t size = RedisModule_CallReplyLength(reply[0]);
+    *count = 0;
+    if (sets_count == 1) {
+        *members = RedisModule_Alloc((size ? size : 1) * sizeof(RedisModuleString *));
+        for (size_t j = 0; j < size; ++j) {
+            size_t len;
+            const char *str = RedisModule_CallReplyStringPtr(
+                    RedisModule_CallReplyArrayElement(reply[0], j), &len);
+            (*members)[(*count)++] = RedisModule_CreateString(ctx, str, len);
+        }
+        RedisModule_FreeCallReply(reply[0]);
+        return REDISMODULE_OK;
+    }
+
+    /* Strings in the table point into the SMEMBERS replies */
+    StrTable table;
+    if (options->set_op == TABULAR_UNION) {
+        /* Each distinct string is kept the first time it is seen */
+        StrTableInit(&table, total);
+        *members = RedisModule_Alloc((total ? total : 1) * sizeof(RedisModuleString *));
+        for (i = 0; i < sets_count; ++i) {
+            size_t n = RedisModule_CallReplyLength(reply[i]);
+            for (size_t j = 0; j < n; ++j) {
+                size_t len;
+                const char *str = RedisModule_CallReplyStringPtr(
+                        RedisModule_CallReplyArrayElement(reply[i], j), &len);
+                size_t used = table.used;
+                StrTableAdd(&table, str, len);
+                if (table.used > used)
+                    (*members)[(*count)++] = RedisModule_CreateString(ctx, str, len);
+            }
+        }
+    }
+    else {
+        /* The main set is stored in the table, then each other set marks the
+         * entries it contains. INTER keeps entries marked by every set, DIFF
+         * keeps entries never marked. */
+        StrTableInit(&table, size);
+        for (size_t j = 0; j < size; ++j) {
+            size_t len;
+            const char *str = RedisModule_CallReplyStringPtr(
+                    RedisModule_CallReplyArrayElement(reply[0], j), &len);
+            StrTableAdd(&table, str, len);
+        }
+        for (i = 1; i < sets_count; ++i) {
+            size_t n = RedisModule_CallReplyLength(reply[i]);
+            for (size_t j = 0; j < n; ++j) {
+                size_t len;
+                const char *str = RedisModule_CallReplyStringPtr(
+                        RedisModule_CallReplyArrayElement(reply[i], j), &len);
+                StrEntry *e = StrTableFind(&table, str, len);
+                if (e == NULL)
+                    continue;
+                /* For INTER, only entries marked by all the previous sets
+                 * matter */
+                if (options->set_op == TABULAR_DIFF)
+                    e->value = 1;
+                else if (e->value == i - 1)
+                    e->value = i;
+            }
+        }
+        int wanted = options->set_op == TABULAR_INTER ? sets_count - 1 : 0;
+        *members = RedisModule_Alloc((size ? size : 1) * sizeof(RedisModuleString *));
+        for (size_t j = 0; j < size; ++j) {
+            size_t len;
+            const char *str = RedisModule_CallReplyStringPtr(
+                    RedisModule_CallReplyArrayElement(reply[0], j), &len);
+            if (StrTableFind(&table, str, len)->value == wanted)
+                (*members)[(*count)++] = RedisModule_CreateString(ctx, str, len);
+        }
+    }
+    StrTableFree(&table);
+
+    for (i = 0; i < sets_count; ++i)
+        RedisModule_FreeCallReply(reply[i]);
+    return REDISMODULE_OK;
+}
@@ -30,44 +30,495 @@
 ** ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
 ** POSSIBILITY OF SUCH DAMAGE.
 */
+#include <math.h>
 #include <stdlib.h>
 #include <string.h>
+#include "batch.h"
+#include "cache.h"
 #include "count.h"
+#include "counter.h"
+#include "delta.h"
+#include "facet.h"
 #include "filter.h"
+#include "index.h"
+#include "join.h"
+#include "members.h"
 #include "sort.h"
+#include "stats.h"
 
-static RedisModuleString **GetArray(RedisModuleCtx *ctx, int size, int block_size, TabularHeader *header, RedisModuleString *set) {
-    size_t i, j;
-    RedisModuleString **array = RedisModule_Alloc(size * sizeof(RedisModuleString *));
+/* The rows read at once when filtering stops with the window */
+#define FILTER_CHUNK 256
 
-    RedisModuleCallReply *reply = RedisModule_Call(ctx, "SMEMBERS", "s", set);
-    for (i = block_size - 1, j = 0; i < size; i += block_size, ++j) {
-        size_t len;
-        const char *str = RedisModule_CallReplyStringPtr(
-                RedisModule_CallReplyArrayElement(reply, j), &len);
-        array[i] = RedisModule_CreateString(ctx, str, len);
+/* The rows sampled by APPROX to estimate a count */
+#define APPROX_SAMPLES 1000
+
+/* The options of TABULAR.GET and TABULAR.COUNT */
+#define GET_FLAGS (TABULAR_SORT | TABULAR_STORE | TABULAR_FILTER \
+                   | TABULAR_WITHFIELDS | TABULAR_SETS | TABULAR_SINCE \
+                   | TABULAR_APPROX | TABULAR_FORMAT)
+#define COUNT_FLAGS (TABULAR_STORE | TABULAR_FILTER | TABULAR_SETS \
+                     | TABULAR_AGGREGATE | TABULAR_FACETS | TABULAR_FORMAT)
+
+/* The rows shared by the queries of the running TABULAR.BATCH */
+static Batch *batch = NULL;
+
+/**
+ *  Members Gets the rows keys like GetMembers, they are taken from the
+ *  running batch when it has them.
+ */
+static int Members(RedisModuleCtx *ctx, RedisModuleString *set,
+                   TabularOptions *options, RedisModuleString ***members,
+                   long long *count) {
+    if (batch && BatchMembers(ctx, batch, set, options, members, count)
+                 == REDISMODULE_OK)
+        return REDISMODULE_OK;
+    return GetMembers(ctx, set, options, members, count);
+}
+
+/**
+ *  FreeMembers Frees the rows keys given by Members
+ */
+static void FreeMembers(RedisModuleCtx *ctx, RedisModuleString **members,
+                        long long count) {
+    for (long long i = 0; i < count; ++i)
+        RedisModule_FreeString(ctx, members[i]);
+    RedisModule_Free(members);
+}
+
+/**
+ *  NewArray Allocates the array to work on, with the row key at the end of
+ *  each row. Values are not read yet, they are NULL.
+ *
+ * @param members The rows keys, the array takes their ownership and members
+ *                is freed.
+ * @param size The array size, that is the members count times block_size
+ * @param block_size The number of columns
+ *
+ * @return The array
+ */
+static RedisModuleString **NewArray(RedisModuleString **members,
+                                    long long size, int block_size) {
+    long long i, j;
+    RedisModuleString **array = RedisModule_Calloc(size ? size : 1,
+                                                   sizeof(RedisModuleString *));
+
+    for (i = block_size - 1, j = 0; i < size; i += block_size, ++j)
+        array[i] = members[j];
+    RedisModule_Free(members);
+    return array;
+}
+
+/**
+ *  ReadRows Reads the values of the header fields for some rows of the
+ *  array. Values of indexed fields are taken from their index, so that rows
+ *  share them, unless the column is filtered: the filter then checks the
+ *  value of the hash, which the index may have missed. Values of join
+ *  columns are taken from the referenced hashes.
+ *  The TABULAR_KEY_FIELD column is the row key, it never opens the hash.
+ *
+ * @param ctx The Redis context
+ * @param array The array
+ * @param begin The index of the first row to read
+ * @param end The index following the last row to read
+ * @param block_size The number of columns
+ * @param header The columns description
+ * @param join The join columns of header, or NULL
+ */
+static void ReadRows(RedisModuleCtx *ctx, RedisModuleString **array,
+                     long long begin, long long end, int block_size,
+                     TabularHeader *header, Join *join) {
+    long long i, j;
+    Index *indexes[block_size];
+    int columns[block_size];
+    int joins[block_size];
+    int keys[block_size];
+    int read_hash = 0;
+    int batched = 0;
+    for (i = 0; i < block_size - 1; ++i) {
+        keys[i] = IsKeyField(header[i].field);
+        joins[i] = JoinColumn(join, i);
+        indexes[i] = NULL;
+        columns[i] = -1;
+        if (keys[i])
+            continue;
+        if (joins[i] < 0 && header[i].tool == TABULAR_NONE)
+            indexes[i] = IndexGet(ctx, header[i].field);
+        if (joins[i] < 0 && !indexes[i] && batch)
+            columns[i] = BatchColumn(batch, header[i].field);
+        if (columns[i] >= 0)
+            batched = 1;
+        else if (!indexes[i])
+            read_hash = 1;
     }
-    RedisModule_FreeCallReply(reply);
 
-    for (j = 0; j < size; j += block_size) {
-        RedisModuleKey *key = RedisModule_OpenKey(
-                ctx, array[j + block_size - 1], REDISMODULE_READ);
-        if (key) {
-            TabularHeader *lst;
-            for (lst = header, i = 0; i < block_size - 1; lst++, ++i) {
-                RedisModuleString *value;
-                RedisModule_HashGet(key, REDISMODULE_HASH_NONE, lst->field, &value, NULL);
-                array[j + i] = value;
+    for (j = begin; j < end; j += block_size) {
+        RedisModuleKey *key = NULL;
+        /* Rows outside the batch set are read from their hash */
+        long long row = batched ? BatchRow(batch, array[j + block_size - 1]) : -1;
+        if (read_hash || (batched && row < 0))
+            key = RedisModule_OpenKey(ctx, array[j + block_size - 1], REDISMODULE_READ);
+        TabularHeader *lst;
+        for (lst = header, i = 0; i < block_size - 1; lst++, ++i) {
+            RedisModuleString *value = NULL;
+            if (keys[i]) {
+                value = array[j + block_size - 1];
+                RedisModule_RetainString(ctx, value);
             }
-            RedisModule_CloseKey(key);
+            else if (joins[i] >= 0)
+                value = JoinValue(ctx, join, joins[i], key);
+            else if (indexes[i])
+                value = IndexValue(ctx, indexes[i], array[j + block_size - 1]);
+            else if (columns[i] >= 0 && row >= 0)
+                value = BatchValue(ctx, batch, row, columns[i]);
+            else if (key)
+                RedisModule_HashGet(key, REDISMODULE_HASH_NONE, lst->field, &value, NULL);
+            array[j + i] = value;
         }
-        else
-            for (i = 0; i < block_size - 1; ++i)
-                array[j + i] = NULL;
+        if (key)
+            RedisModule_CloseKey(key);
     }
+}
+
+/**
+ *  GetArray Builds the array to work on. Each row is made of the values of
+ *  the header fields followed by the row key.
+ *
+ * @param ctx The Redis context
+ * @param members The rows keys, the array takes their ownership and members
+ *                is freed.
+ * @param size The array size, that is the members count times block_size
+ * @param block_size The number of columns
+ * @param header The columns description
+ * @param join The join columns of header, or NULL
+ *
+ * @return The array
+ */
+static RedisModuleString **GetArray(RedisModuleCtx *ctx,
+                                    RedisModuleString **members,
+                                    long long size, int block_size,
+                                    TabularHeader *header, Join *join) {
+    RedisModuleString **array = NewArray(members, size, block_size);
+    ReadRows(ctx, array, 0, size, block_size, header, join);
     return array;
 }
 
+/**
+ *  FilterWindow Reads and filters rows by chunks, until the rows of the
+ *  window are found. It is used when rows are not sorted, so that rows after
+ *  the window are not read. Kept rows are moved at the beginning of array,
+ *  in the same order.
+ *
+ * @param ctx The Redis context
+ * @param array The array built with NewArray
+ * @param size The array size
+ * @param header The columns description
+ * @param join The join columns of header, or NULL
+ * @param block_size The number of columns
+ * @param wanted The size of the rows up to the end of the window
+ * @param[out] read The index following the last read row
+ *
+ * @return The size of the kept rows
+ */
+static long long FilterWindow(RedisModuleCtx *ctx, RedisModuleString **array,
+                              long long size, TabularHeader *header,
+                              Join *join, int block_size, long long wanted,
+                              long long *read) {
+    long long kept = 0;
+    long long pos = 0;
+    while (pos < size && kept < wanted) {
+        long long chunk = wanted - kept;
+        if (chunk < FILTER_CHUNK * block_size)
+            chunk = FILTER_CHUNK * block_size;
+        long long end = size - pos > chunk ? pos + chunk : size;
+        ReadRows(ctx, array, pos, end, block_size, header, join);
+        long long n = Filter(ctx, array + pos, end - pos, header, block_size);
+        for (long long r = 0; r < n; r += block_size)
+            Swap(array, block_size, kept + r, pos + r);
+        kept += n;
+        pos = end;
+    }
+    *read = pos;
+    return kept;
+}
+
+/**
+ *  EstimateCount Estimates how many unread rows match the filter, from a
+ *  random sample of them.
+ *
+ * @param ctx The Redis context
+ * @param array The array, rows from begin are not read yet
+ * @param begin The index of the first unread row
+ * @param size The array size
+ * @param header The columns description
+ * @param join The join columns of header, or NULL
+ * @param block_size The number of columns
+ * @param[out] error The half width of the 95% confidence interval
+ *
+ * @return The estimated count
+ */
+static long long EstimateCount(RedisModuleCtx *ctx, RedisModuleString **array,
+                               long long begin, long long size,
+                               TabularHeader *header, Join *join,
+                               int block_size, long long *error) {
+    long long rows = (size - begin) / block_size;
+    long long samples = rows < APPROX_SAMPLES ? rows : APPROX_SAMPLES;
+
+    /* The sample is moved at the beginning of the unread rows */
+    for (long long i = 0; i < samples; ++i) {
+        long long j = i + random() % (rows - i);
+        Swap(array, block_size, begin + i * block_size, begin + j * block_size);
+    }
+    long long end = begin + samples * block_size;
+    ReadRows(ctx, array, begin, end, block_size, header, join);
+    long long n = Filter(ctx, array + begin, end - begin, header, block_size)
+            / block_size;
+
+    *error = 0;
+    if (samples == rows)
+        return n;
+    /* The interval uses the adjusted proportion, so that it is not empty when
+     * no row of the sample matches */
+    double p = (n + 2.0) / (samples + 4.0);
+    *error = llround(1.96 * rows * sqrt(p * (1 - p) / samples
+                                        * (rows - samples) / (rows - 1)));
+    return llround((double)n * rows / samples);
+}
+
+/**
+ *  AddCount Records the rows count of a TABULAR.GET reply, with APPROX it is
+ *  an array of the count and of its error bound.
+ */
+static void AddCount(CacheEntry *reply, long long count, long long error,
+                     TabularOptions *options) {
+    if (options->approx) {
+        CacheAddArray(reply, 2);
+        CacheAddLongLong(reply, count);
+        CacheAddLongLong(reply, error);
+    }
+    else
+        CacheAddLongLong(reply, count);
+}
+
+/**
+ *  ReplyWithFields Replies rows of the window, each one as an array made of
+ *  the row key followed by the values of the fields asked with WITHFIELDS.
+ *  Values already in array are reused, the others are fetched from the hash,
+ *  only for rows of the window.
+ *
+ * @param ctx The Redis context
+ * @param reply The entry recording the reply
+ * @param array The sorted array
+ * @param header The array header
+ * @param block_size The number of columns in array
+ * @param ldown The index of the first row of the window
+ * @param lup The index of the last row of the window
+ * @param options The command options containing the fields to return
+ */
+static void ReplyWithFields(RedisModuleCtx *ctx, CacheEntry *reply,
+                            RedisModuleString **array,
+                            TabularHeader *header, int block_size,
+                            long long ldown, long long lup,
+                            TabularOptions *options) {
+    int count = options->with_fields_count;
+    int col[count];
+    int fetch = 0;
+
+    /* For each field, we look for its column in array */
+    for (int f = 0; f < count; ++f) {
+        col[f] = -1;
+        for (int i = 0; i < block_size - 1; ++i) {
+            if (RedisModule_StringCompare(options->with_fields[f],
+                                          header[i].field) == 0) {
+                col[f] = i;
+                break;
+            }
+        }
+        if (col[f] < 0 && !IsKeyField(options->with_fields[f]))
+            fetch = 1;
+    }
+
+    for (long long i = ldown; i <= lup; i += block_size) {
+        RedisModuleKey *key = NULL;
+        if (fetch)
+            key = RedisModule_OpenKey(ctx, array[i + block_size - 1],
+                                      REDISMODULE_READ);
+        CacheAddArray(reply, count + 1);
+        CacheAddString(ctx, reply, array[i + block_size - 1]);
+        for (int f = 0; f < count; ++f) {
+            RedisModuleString *value = NULL;
+            if (col[f] >= 0)
+                value = array[i + col[f]];
+            else if (IsKeyField(options->with_fields[f])) {
+                value = array[i + block_size - 1];
+                RedisModule_RetainString(ctx, value);
+            }
+            else if (key && JoinField(options->with_fields[f]))
+                value = JoinRead(ctx, key, options->with_fields[f], reply);
+            else if (key) {
+                RedisModule_HashGet(key, REDISMODULE_HASH_NONE,
+                                    options->with_fields[f], &value, NULL);
+            }
+
+            if (value)
+                CacheAddString(ctx, reply, value);
+            else
+                CacheAddNull(reply);
+
+            if (col[f] < 0 && value)
+                RedisModule_FreeString(ctx, value);
+        }
+        if (key)
+            RedisModule_CloseKey(key);
+    }
+}
+
+/**
+ *  KeysPositions Answers a keys position request, for commands registered
+ *  with getkeys-api. Keys are the main set, the sets combined with it, the
+ *  SOURCES keys, the sets of IN filters and the STORE key.
+ *
+ * @param ctx The Redis context
+ * @param argv An array of arguments
+ * @param argc The arguments count with the command
+ * @param set The index of the main set in argv, 0 if there is none
+ * @param offset The index of the first option in argv
+ * @param flag The options accepted by the command
+ *
+ * @return REDISMODULE_OK
+ */
+static int KeysPositions(RedisModuleCtx *ctx, RedisModuleString **argv,
+                         int argc, int set, int offset, int flag) {
+    if (set > 0 && set < argc)
+        RedisModule_KeyAtPos(ctx, set);
+    if (argc <= offset)
+        return REDISMODULE_OK;
+
+    int block_size;
+    RedisModuleString *key_store = NULL;
+    TabularOptions options;
+    TabularHeader *header = ParseArgv(argv + offset, argc - offset, &block_size,
+                                      &key_store, &options, flag);
+    if (!header)
+        return REDISMODULE_OK;
+
+    /* Options point into argv, positions are found by comparing pointers */
+    for (int i = 0; i < options.sets_count; ++i)
+        RedisModule_KeyAtPos(ctx, options.sets - argv + i);
+    for (int i = 0; i < options.sources_count; ++i)
+        RedisModule_KeyAtPos(ctx, options.sources - argv + i);
+    for (int i = offset; i < argc; ++i) {
+        const char *a = RedisModule_StringPtrLen(argv[i], NULL);
+        int key = argv[i] == key_store;
+        for (int j = 0; !key && j < block_size; ++j)
+            key = header[j].tool == TABULAR_IN && header[j].search == a;
+        if (key)
+            RedisModule_KeyAtPos(ctx, i);
+    }
+    RedisModule_Free(header);
+    return REDISMODULE_OK;
+}
+
+/**
+ *  WindowsCount Tells how many windows are given with WINDOWS to TABULAR.GET,
+ *  in place of ldown and lup.
+ *
+ * @param argv An array of arguments
+ * @param argc The arguments count with the command
+ *
+ * @return The windows count, 0 without WINDOWS or -1 if it is malformed.
+ */
+static int WindowsCount(RedisModuleString **argv, int argc) {
+    long long count;
+    if (argc < 4
+        || strcasecmp(RedisModule_StringPtrLen(argv[2], NULL), "WINDOWS"))
+        return 0;
+    if (RedisModule_StringToLongLong(argv[3], &count) == REDISMODULE_ERR
+        || count <= 0 || count > (argc - 4) / 2)
+        return -1;
+    return count;
+}
+
+/**
+ *  GetWindow Reads the bounds of a window
+ *
+ * @param bounds The windows bounds in argv
+ * @param w The window index
+ * @param[out] first The index of the first row
+ * @param[out] last The index of the last row
+ *
+ * @return REDISMODULE_OK or REDISMODULE_ERR if a bound is not an integer
+ */
+static int GetWindow(RedisModuleString **bounds, int w, long long *first,
+                     long long *last) {
+    if (RedisModule_StringToLongLong(bounds[2 * w], first) == REDISMODULE_ERR
+        || RedisModule_StringToLongLong(bounds[2 * w + 1], last) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+    if (*first > *last) {
+        long long tmp = *first;
+        *first = *last;
+        *last = tmp;
+    }
+    return REDISMODULE_OK;
+}
+
+/**
+ *  AddRows Records the rows of a window, as their keys or, with WITHFIELDS,
+ *  as arrays of their key and fields.
+ *
+ * @param ctx The Redis context
+ * @param reply The entry recording the reply
+ * @param array The sorted array
+ * @param header The array header
+ * @param block_size The number of columns in array
+ * @param ldown The index of the first row of the window
+ * @param lup The index of the last row of the window
+ * @param options The command options
+ */
+static void AddRows(RedisModuleCtx *ctx, CacheEntry *reply,
+                    RedisModuleString **array, TabularHeader *header,
+                    int block_size, long long ldown, long long lup,
+                    TabularOptions *options) {
+    if (options->with_fields_count > 0)
+        ReplyWithFields(ctx, reply, array, header, block_size, ldown, lup,
+                        options);
+    else
+        for (long long i = ldown; i <= lup; i += block_size)
+            CacheAddString(ctx, reply, array[i + block_size - 1]);
+}
+
+/**
+ *  AddWindow Records a window given with WINDOWS, as an array of its rows
+ *
+ * @param ctx The Redis context
+ * @param reply The entry recording the reply
+ * @param array The sorted array
+ * @param header The array header
+ * @param block_size The number of columns in array
+ * @param size The size of the filtered rows
+ * @param first The index of the first row of the window
+ * @param last The index of the last row of the window
+ * @param options The command options
+ */
+static void AddWindow(RedisModuleCtx *ctx, CacheEntry *reply,
+                      RedisModuleString **array, TabularHeader *header,
+                      int block_size, long long size, long long first,
+                      long long last, TabularOptions *options) {
+    /* Bounds are clamped to the rows before being turned into cells */
+    long long rows = size / block_size;
+    if (first < 0)
+        first = 0;
+    if (last >= rows)
+        last = rows - 1;
+    if (first > last) {
+        CacheAddArray(reply, 0);
+        return;
+    }
+    long long ldown = first * block_size;
+    long long lup = last * block_size;
+    CacheAddArray(reply, (lup - ldown) / block_size + 1);
+    AddRows(ctx, reply, array, header, block_size, ldown, lup, options);
+}
+
 /**
  *  An implementation of a sort function
  *  The first argument is a Redis set to sort
@@ -77,38 +528,93 @@ static RedisModuleString **GetArray(RedisModuleCtx *ctx, int size, int block_siz
  * @param argv An array of arguments
  * @param argc The arguments count with the command. That is to say
  *             "tabular.get 2" gives argc=2
+ * @param readonly 1 for TABULAR.RO_GET, STORE is then refused
  *
  * @return REDISMODULE_ERR or REDISMODULE_OK
  */
-static int TabularGet_RedisCommand(RedisModuleCtx *ctx,
-                                   RedisModuleString **argv,
-                                   int argc) {
+static int TabularGet(RedisModuleCtx *ctx, RedisModuleString **argv, int argc,
+                      int readonly) {
     long long key_count = 0;
     long long first, last;
     int block_size = 0;
+    int flag = GET_FLAGS;
+
+    /* Windows given with WINDOWS replace ldown and lup */
+    int windows = WindowsCount(argv, argc);
+    int offset = windows > 0 ? 4 + 2 * windows : 4;
+
+    if (RedisModule_IsKeysPositionRequest(ctx))
+        return KeysPositions(ctx, argv, argc, 1, offset, flag);
 
     if (argc < 4) {
         return RedisModule_WrongArity(ctx);
     }
 
+    /* Indexes being built progress a little with each command */
+    IndexStep(ctx);
+
     RedisModuleString *set = argv[1];
-    if (RedisModule_StringToLongLong(argv[2], &first) == REDISMODULE_ERR)
-        return RedisModule_ReplyWithError(
-                ctx,
-                "Err: The second argument must be an integer");
-    if (RedisModule_StringToLongLong(argv[3], &last) == REDISMODULE_ERR)
+    if (windows < 0)
         return RedisModule_ReplyWithError(
                 ctx,
-                "Err: The third argument must be an integer");
-    if (first > last) {
-        long long tmp = first;
-        first = last;
-        last = tmp;
+                "Err: WINDOWS must be followed by a count and as many ldown lup pairs");
+    if (windows == 0) {
+        if (RedisModule_StringToLongLong(argv[2], &first) == REDISMODULE_ERR)
+            return RedisModule_ReplyWithError(
+                    ctx,
+                    "Err: The second argument must be an integer");
+        if (RedisModule_StringToLongLong(argv[3], &last) == REDISMODULE_ERR)
+            return RedisModule_ReplyWithError(
+                    ctx,
+                    "Err: The third argument must be an integer");
+        if (first > last) {
+            long long tmp = first;
+            first = last;
+            last = tmp;
+        }
+    }
+
+    /* The rows are sorted from the first to the last row of all windows */
+    for (int w = 0; w < windows; ++w) {
+        long long down, up;
+        if (GetWindow(argv + 4, w, &down, &up) == REDISMODULE_ERR)
+            return RedisModule_ReplyWithError(
+                    ctx,
+                    "Err: The windows bounds must be integers");
+        if (w == 0 || down < first)
+            first = down;
+        if (w == 0 || up > last)
+            last = up;
     }
 
     RedisModuleString *key_store = NULL;
-    TabularHeader *header = ParseArgv(argv + 4, argc - 4, &block_size, &key_store,
-            TABULAR_SORT | TABULAR_STORE | TABULAR_FILTER);
+    TabularOptions options;
+    TabularHeader *header = ParseArgv(argv + offset, argc - offset, &block_size,
+            &key_store, &options, flag);
+    if (header && readonly && key_store) {
+        RedisModule_Free(header);
+        return RedisModule_ReplyWithError(
+                ctx,
+                "Err: STORE is not allowed in a read-only command");
+    }
+    if (header && key_store && options.since) {
+        RedisModule_Free(header);
+        return RedisModule_ReplyWithError(
+                ctx,
+                "Err: SINCE is not allowed with STORE");
+    }
+    if (header && windows && (key_store || options.since)) {
+        RedisModule_Free(header);
+        return RedisModule_ReplyWithError(
+                ctx,
+                "Err: WINDOWS is not allowed with STORE or SINCE");
+    }
+    if (header && options.packed && (key_store || options.since)) {
+        RedisModule_Free(header);
+        return RedisModule_ReplyWithError(
+                ctx,
+                "Err: FORMAT PACKED is not allowed with STORE or SINCE");
+    }
     RedisModuleString *keystore_size_str = NULL;
     if (key_store) {
         size_t len;
@@ -119,55 +625,154 @@ static int TabularGet_RedisCommand(RedisModuleCtx *ctx,
     if (!header) {
         return RedisModule_ReplyWithError(
                 ctx,
-                "Err: The syntax is TABULAR.GET key ldown lup {STORE key}? {SORT {field {ALPHA|NUM|REVALPHA|REVNUM}}*}? {FILTER {field {MATCH|EQUAL|IN} 'expr'}*}?");
+                "Err: The syntax is TABULAR.GET key {ldown lup|WINDOWS count {ldown lup}*} {{UNION|INTER|DIFF} count key*}? {STORE key}? {SORT {field {ALPHA|NUM|FLOAT|IALPHA|COLLATE|REVALPHA|REVNUM|REVFLOAT|REVIALPHA|REVCOLLATE} {NULLS {FIRST|LAST}}?}*}? {FILTER {field {MATCH|EQUAL|IN} 'expr'}*}? {WITHFIELDS count field*}? {SINCE token}? {NOCOUNT|APPROX}? {FORMAT {RESP|PACKED}}?");
     }
 
     /* A block contains each column asked in the command line + the field
      * key */
     ++block_size;
 
-    RedisModuleCallReply *reply = RedisModule_Call(ctx, "SCARD", "s", set);
+    /* Without STORE, the reply may be cached. It is recorded otherwise. A
+     * reply relative to a version given with SINCE is not cached. */
+    CacheEntry *reply = NULL;
+    if (key_store == NULL) {
+        if (!options.since && CacheReplyIfCached(ctx, argv + 1, argc - 1)) {
+            RedisModule_Free(header);
+            return REDISMODULE_OK;
+        }
+        reply = CacheCreate(ctx, argv + 1, argc - 1);
+    }
 
-    if (RedisModule_CallReplyType(reply) != REDISMODULE_REPLY_INTEGER)
+    RedisModuleString **members;
+    long long count;
+    if (Members(ctx, set, &options, &members, &count) == REDISMODULE_ERR) {
+        RedisModule_Free(header);
+        if (reply)
+            CacheDiscard(ctx, reply);
+        if (keystore_size_str)
+            RedisModule_FreeString(ctx, keystore_size_str);
         return RedisModule_ReplyWithError(
                 ctx,
                 "Err: Unable to get the set card");
-    int size = RedisModule_CallReplyInteger(reply) * block_size;
-    int orig_size = 0;
-    RedisModule_FreeCallReply(reply);
+    }
+
+    /* The reply depends on the sets read and on all their rows, even the
+     * ones filtered out */
+    if (reply && !options.since) {
+        size_t len;
+        const char *k = RedisModule_StringPtrLen(set, &len);
+        CacheDepend(reply, k, len);
+        for (int i = 0; i < options.sets_count; ++i) {
+            k = RedisModule_StringPtrLen(options.sets[i], &len);
+            CacheDepend(reply, k, len);
+        }
+        for (int i = 0; i < block_size - 1; ++i) {
+            if (header[i].tool == TABULAR_IN)
+                CacheDepend(reply, header[i].search, strlen(header[i].search));
+        }
+        for (long long i = 0; i < count; ++i) {
+            k = RedisModule_StringPtrLen(members[i], &len);
+            CacheDepend(reply, k, len);
+        }
+    }
+    FilterKeys(ctx, header, block_size - 1, members, &count);
+    IndexRestrict(ctx, header, block_size - 1, members, &count);
+    StatsEstimate(ctx, set, header, block_size - 1, count);
+    long long size;
+    if (ArraySize(count, block_size, &size) == REDISMODULE_ERR) {
+        FreeMembers(ctx, members, count);
+        RedisModule_Free(header);
+        if (reply)
+            CacheDiscard(ctx, reply);
+        if (keystore_size_str)
+            RedisModule_FreeString(ctx, keystore_size_str);
+        return RedisModule_ReplyWithError(
+                ctx,
+                "Err: The set has too many rows");
+    }
+    long long orig_size = 0;
+    Join *join = JoinCreate(ctx, header, block_size - 1);
 
     RedisModuleString **array = NULL;
     char type[block_size];
+    char nulls[block_size];
     type[block_size - 1] = 'a';
+    nulls[block_size - 1] = 0;
+    StrTable *dicts[block_size];
+    dicts[block_size - 1] = NULL;
     TabularHeader *lst;
     int i;
     int should_sort = 0;
+    int should_filter = 0;
     for (lst = header, i = 0; i < block_size - 1; lst++, i++) {
         type[i] = lst->type;
+        nulls[i] = lst->nulls;
+        dicts[i] = NULL;
         if (type[i])
             should_sort = 1;
+        if (lst->tool != TABULAR_NONE)
+            should_filter = 1;
+        /* Indexed strings are sorted by their dictionary codes, when they
+         * are read from the index */
+        if ((type[i] == 'a' || type[i] == 'A') && lst->tool == TABULAR_NONE) {
+            Index *index = IndexGet(ctx, lst->field);
+            if (index) {
+                dicts[i] = IndexCodes(index);
+                type[i] = type[i] == 'a' ? 'd' : 'D';
+            }
+        }
     }
 
-    int ldown = first * block_size;
+    /* Bounds are clamped to the rows before being turned into cells, so that
+     * they cannot overflow. A window before the first row is empty. */
+    if (first < 0)
+        first = 0;
+    if (last < 0 || first > count)
+        first = count;
+    if (last > count)
+        last = count;
+    long long ldown = first * block_size;
 
     /* The window is outside data. We force size to 0. */
     /* We already have to compute size because of its need for the filter. */
-    if (ldown >= size)
+    if (ldown >= size) {
+        FreeMembers(ctx, members, count);
         size = 0;
+    }
 
+    long long read = size;
     if (size > 0) {
-        array = GetArray(ctx, size, block_size, header, set);
         orig_size = size;
-        size = Filter(ctx, array, size, header, block_size);
+        if (!should_sort && should_filter
+            && (options.nocount || options.approx)) {
+            array = NewArray(members, size, block_size);
+            size = FilterWindow(ctx, array, size, header, join, block_size,
+                                last < count ? (last + 1) * block_size : size,
+                                &read);
+        }
+        else {
+            array = GetArray(ctx, members, size, block_size, header, join);
+            size = Filter(ctx, array, size, header, block_size);
+        }
     }
 
     key_count = size / block_size;
 
+    /* Rows after the window are not read with NOCOUNT or APPROX */
+    long long error = 0;
+    if (read < orig_size) {
+        if (options.approx)
+            key_count += EstimateCount(ctx, array, read, orig_size, header,
+                                       join, block_size, &error);
+        else
+            key_count = -1;
+    }
+
     /* The window is outside data. We force size to 0.
      * After the filter, size may have changed */
     if (ldown >= size)
         size = 0;
-    int lup = last * block_size;
+    long long lup = last * block_size;
     if (lup >= size)
         lup = size - block_size;
     if (lup < ldown)
@@ -175,22 +780,46 @@ static int TabularGet_RedisCommand(RedisModuleCtx *ctx,
 
     if (should_sort) {
         QuickSort(
-                array, type, block_size,
+                array, type, nulls, dicts, block_size,
                 0, size - block_size,
                 ldown, lup);
     }
 
     if (key_store == NULL) {
-        if (size > 0) {
-            int s = (lup - ldown) / block_size + 2;
-            RedisModule_ReplyWithArray(ctx, s);
-            RedisModule_ReplyWithLongLong(ctx, key_count);
-            for (size_t i = ldown; i <= lup; i += block_size)
-                RedisModule_ReplyWithString(ctx, array[i + block_size - 1]);
+        if (windows) {
+            CacheAddArray(reply, windows + 1);
+            AddCount(reply, key_count, error, &options);
+            for (int w = 0; w < windows; ++w) {
+                long long down, up;
+                GetWindow(argv + 4, w, &down, &up);
+                AddWindow(ctx, reply, array, header, block_size, size, down,
+                          up, &options);
+            }
+        }
+        else if (size > 0) {
+            long long s = (lup - ldown) / block_size + 2;
+            CacheAddArray(reply, s);
+            AddCount(reply, key_count, error, &options);
+            AddRows(ctx, reply, array, header, block_size, ldown, lup,
+                    &options);
+        }
+        else {
+            CacheAddArray(reply, 1);
+            AddCount(reply, key_count, error, &options);
+        }
+        if (options.since) {
+            DeltaReply(ctx, reply, argv, argc, options.since,
+                       options.since_token);
+            CacheDiscard(ctx, reply);
         }
         else {
-            RedisModule_ReplyWithArray(ctx, 1);
-            RedisModule_ReplyWithLongLong(ctx, key_count);
+            /* The reply also depends on the hashes read through join
+             * columns */
+            JoinDepend(join, reply);
+            if (options.packed)
+                CachePack(ctx, reply);
+            CacheReply(ctx, reply);
+            CacheStore(ctx, reply);
         }
     }
     else {
@@ -199,78 +828,118 @@ static int TabularGet_RedisCommand(RedisModuleCtx *ctx,
         RedisModule_DeleteKey(key);
         if (size > 0) {
             double w = 0;
-            for (size_t i = ldown; i <= lup; i += block_size, ++w) {
+            for (long long i = ldown; i <= lup; i += block_size, ++w) {
                 RedisModule_ZsetAdd(key, w, array[i + block_size - 1], NULL);
             }
             RedisModule_CloseKey(key);
         }
-        reply = RedisModule_Call(ctx, "SET", "sl",
+        RedisModuleCallReply *reply = RedisModule_Call(ctx, "SET", "sl",
                 keystore_size_str, key_count);
         RedisModule_FreeCallReply(reply);
         RedisModule_ReplyWithSimpleString(ctx, "OK");
         RedisModule_FreeString(ctx, keystore_size_str);
     }
 
-    for (size_t i = 0; i < orig_size; ++i) {
+    for (long long i = 0; i < orig_size; ++i) {
         if (array[i])
             RedisModule_FreeString(ctx, array[i]);
     }
     RedisModule_Free(array);
     RedisModule_Free(header);
+    JoinFree(ctx, join);
     return REDISMODULE_OK;
 }
 
-static int TabularFilter_RedisCommand(RedisModuleCtx *ctx,
-                                      RedisModuleString **argv,
-                                      int argc) {
+static int TabularGet_RedisCommand(RedisModuleCtx *ctx,
+                                   RedisModuleString **argv,
+                                   int argc) {
+    return TabularGet(ctx, argv, argc, 0);
+}
+
+static int TabularRoGet_RedisCommand(RedisModuleCtx *ctx,
+                                     RedisModuleString **argv,
+                                     int argc) {
+    return TabularGet(ctx, argv, argc, 1);
+}
+
+static int TabularFilter(RedisModuleCtx *ctx, RedisModuleString **argv,
+                         int argc, int readonly) {
     int block_size = 0;
+    int flag = TABULAR_STORE | TABULAR_FILTER | TABULAR_SETS;
+
+    if (RedisModule_IsKeysPositionRequest(ctx))
+        return KeysPositions(ctx, argv, argc, 1, 2, flag);
 
     if (argc < 3)
         return RedisModule_WrongArity(ctx);
 
+    /* Indexes being built progress a little with each command */
+    IndexStep(ctx);
+
     RedisModuleString *set = argv[1];
 
     RedisModuleString *key_store = NULL;
+    TabularOptions options;
     TabularHeader *header = ParseArgv(argv + 2, argc - 2, &block_size, &key_store,
-            TABULAR_STORE | TABULAR_FILTER);
+            &options, flag);
+    if (header && readonly && key_store) {
+        RedisModule_Free(header);
+        return RedisModule_ReplyWithError(
+                ctx,
+                "Err: STORE is not allowed in a read-only command");
+    }
 
     if (!header) {
         return RedisModule_ReplyWithError(
                 ctx,
-                "Err: The syntax is TABULAR.FILTER key {STORE key}? {FILTER {field {MATCH|EQUAL|IN} 'expr'}*}?");
+                "Err: The syntax is TABULAR.FILTER key {{UNION|INTER|DIFF} count key*}? {STORE key}? {FILTER {field {MATCH|EQUAL|IN} 'expr'}*}?");
     }
 
-    RedisModuleCallReply *reply = RedisModule_Call(ctx, "SCARD", "s", set);
-
-    if (RedisModule_CallReplyType(reply) != REDISMODULE_REPLY_INTEGER)
+    RedisModuleString **members;
+    long long count;
+    if (Members(ctx, set, &options, &members, &count) == REDISMODULE_ERR) {
+        RedisModule_Free(header);
         return RedisModule_ReplyWithError(
                 ctx,
                 "Err: Unable to get the set card");
+    }
+    FilterKeys(ctx, header, block_size, members, &count);
+    IndexRestrict(ctx, header, block_size, members, &count);
+    StatsEstimate(ctx, set, header, block_size, count);
     ++block_size;
-    int size = RedisModule_CallReplyInteger(reply) * block_size;
-    RedisModule_FreeCallReply(reply);
+    long long size;
+    if (ArraySize(count, block_size, &size) == REDISMODULE_ERR) {
+        FreeMembers(ctx, members, count);
+        RedisModule_Free(header);
+        return RedisModule_ReplyWithError(
+                ctx,
+                "Err: The set has too many rows");
+    }
 
-    RedisModuleString **array = GetArray(ctx, size, block_size, header, set);
+    Join *join = JoinCreate(ctx, header, block_size - 1);
+    RedisModuleString **array = GetArray(ctx, members, size, block_size, header,
+                                         join);
+    JoinFree(ctx, join);
 
-    int orig_size = size;
+    long long orig_size = size;
     if (size > 0)
         size = Filter(ctx, array, size, header, block_size);
 
     if (key_store == NULL) {
         if (size > 0) {
             RedisModule_ReplyWithArray(ctx, size / block_size);
-            for (size_t i = 0; i < size; i += block_size)
+            for (long long i = 0; i < size; i += block_size)
                 RedisModule_ReplyWithString(ctx, array[i + block_size - 1]);
         }
         else
             RedisModule_ReplyWithArray(ctx, 0);
     }
     else {
-        reply = RedisModule_Call(ctx, "UNLINK", "s", key_store);
+        RedisModuleCallReply *reply = RedisModule_Call(ctx, "UNLINK", "s", key_store);
         RedisModule_FreeCallReply(reply);
         if (size > 0) {
             int bs = block_size * 16;
-            size_t i = 0;
+            long long i = 0;
             for (i = 0; i + bs <= size; i += bs) {
                 reply = RedisModule_Call(ctx, "SADD", "sssssssssssssssss", key_store,
                                          array[i + block_size - 1],
@@ -300,7 +969,7 @@ static int TabularFilter_RedisCommand(RedisModuleCtx *ctx,
         RedisModule_ReplyWithSimpleString(ctx, "OK");
     }
 
-    for (size_t i = 0; i < orig_size; ++i) {
+    for (long long i = 0; i < orig_size; ++i) {
         if (array[i])
             RedisModule_FreeString(ctx, array[i]);
     }
@@ -309,69 +978,1005 @@ static int TabularFilter_RedisCommand(RedisModuleCtx *ctx,
     return REDISMODULE_OK;
 }
 
-static int TabularCount_RedisCommand(RedisModuleCtx *ctx,
-                                     RedisModuleString **argv,
-                                     int argc) {
+static int TabularFilter_RedisCommand(RedisModuleCtx *ctx,
+                                      RedisModuleString **argv,
+                                      int argc) {
+    return TabularFilter(ctx, argv, argc, 0);
+}
+
+static int TabularRoFilter_RedisCommand(RedisModuleCtx *ctx,
+                                        RedisModuleString **argv,
+                                        int argc) {
+    return TabularFilter(ctx, argv, argc, 1);
+}
+
+static int TabularCount(RedisModuleCtx *ctx, RedisModuleString **argv,
+                        int argc, int readonly) {
     int block_size = 0;
+    int flag = COUNT_FLAGS;
+
+    if (RedisModule_IsKeysPositionRequest(ctx))
+        return KeysPositions(ctx, argv, argc, 1, 2, flag);
 
     if (argc < 3)
         return RedisModule_WrongArity(ctx);
 
+    /* Indexes being built progress a little with each command */
+    IndexStep(ctx);
+
     RedisModuleString *set = argv[1];
 
     RedisModuleString *key_store = NULL;
+    TabularOptions options;
     TabularHeader *header = ParseArgv(argv + 2, argc - 2, &block_size, &key_store,
-            TABULAR_STORE | TABULAR_FILTER);
+            &options, flag);
+    if (header && readonly && key_store) {
+        RedisModule_Free(header);
+        return RedisModule_ReplyWithError(
+                ctx,
+                "Err: STORE is not allowed in a read-only command");
+    }
 
+    if (header && options.facets_count > 0 && options.aggregates_count > 0) {
+        RedisModule_Free(header);
+        header = NULL;
+    }
+    if (header && options.packed && (key_store || options.facets_count > 0)) {
+        RedisModule_Free(header);
+        return RedisModule_ReplyWithError(
+                ctx,
+                "Err: FORMAT PACKED is not allowed with STORE or FACETS");
+    }
     if (!header) {
         return RedisModule_ReplyWithError(
                 ctx,
-                "Err: The syntax is TABULAR.COUNT key {STORE key}? {FILTER {field {MATCH|EQUAL|IN} 'expr'}*}?");
+                "Err: The syntax is TABULAR.COUNT key {{UNION|INTER|DIFF} count key*}? {STORE key}? {FILTER {field {MATCH|EQUAL|IN} 'expr'}*}? {AGGREGATE count {{SUM|MIN|MAX|AVG|DISTINCT} field}* | FACETS count {field {LIMIT n}?}*}? {FORMAT {RESP|PACKED}}?");
     }
 
-    RedisModuleCallReply *reply = RedisModule_Call(ctx, "SCARD", "s", set);
-
-    if (RedisModule_CallReplyType(reply) != REDISMODULE_REPLY_INTEGER)
+    RedisModuleString **members;
+    long long count;
+    if (Members(ctx, set, &options, &members, &count) == REDISMODULE_ERR) {
+        RedisModule_Free(header);
         return RedisModule_ReplyWithError(
                 ctx,
                 "Err: Unable to get the set card");
+    }
     ++block_size;
-    int size = RedisModule_CallReplyInteger(reply) * block_size;
-    RedisModule_FreeCallReply(reply);
 
-    RedisModuleString **array = GetArray(ctx, size, block_size, header, set);
+    /* A count on a single indexed field is done without opening rows */
+    Index *index = NULL;
+    if (block_size == 2 && options.aggregates_count == 0
+            && options.facets_count == 0
+            && (header->tool == TABULAR_MATCH || header->tool == TABULAR_EQUAL))
+        index = IndexGet(ctx, header->field);
+    if (index) {
+        CountList *cnt = IndexCount(ctx, index, header, members, count);
+        if (options.packed)
+            CountReplyPacked(ctx, cnt, NULL, 0);
+        else if (key_store == NULL)
+            CountReply(ctx, cnt, NULL, 0);
+        else
+            CountReplyStore(ctx, cnt, key_store, NULL, 0);
+        FreeIndexCountList(ctx, cnt);
+
+        FreeMembers(ctx, members, count);
+        RedisModule_Free(header);
+        return REDISMODULE_OK;
+    }
+
+    /* Counted groups need all the rows, facets only the filtered ones */
+    if (options.facets_count > 0) {
+        FilterKeys(ctx, header, block_size - 1, members, &count);
+        IndexRestrict(ctx, header, block_size - 1, members, &count);
+        StatsEstimate(ctx, set, header, block_size - 1, count);
+    }
+    long long size;
+    if (ArraySize(count, block_size, &size) == REDISMODULE_ERR) {
+        FreeMembers(ctx, members, count);
+        RedisModule_Free(header);
+        return RedisModule_ReplyWithError(
+                ctx,
+                "Err: The set has too many rows");
+    }
+
+    Join *join = JoinCreate(ctx, header, block_size - 1);
+    RedisModuleString **array = GetArray(ctx, members, size, block_size, header,
+                                         join);
+    JoinFree(ctx, join);
+
+    /* In FACETS mode, filters only select rows */
+    if (options.facets_count > 0) {
+        long long filtered = size > 0 ? Filter(ctx, array, size, header, block_size) : 0;
+        Facet *facets = CountFacets(&options, array, filtered, header, block_size);
+        if (key_store == NULL)
+            FacetsReply(ctx, facets, options.facets_count);
+        else
+            FacetsReplyStore(ctx, facets, options.facets_count, key_store);
+        FreeFacets(facets, options.facets_count);
+
+        for (long long i = 0; i < size; ++i) {
+            if (array[i])
+                RedisModule_FreeString(ctx, array[i]);
+        }
+        RedisModule_Free(array);
+        RedisModule_Free(header);
+        return REDISMODULE_OK;
+    }
 
-    CountList *cnt = Count(ctx, array, size, header, block_size);
+    CountAggregate *aggs = CountAggregates(&options, header, block_size);
+    CountList *cnt = Count(ctx, array, size, header, block_size,
+                           aggs, options.aggregates_count);
 
-    if (key_store == NULL)
-        CountReply(ctx, cnt);
+    if (options.packed)
+        CountReplyPacked(ctx, cnt, aggs, options.aggregates_count);
+    else if (key_store == NULL)
+        CountReply(ctx, cnt, aggs, options.aggregates_count);
     else
-        CountReplyStore(ctx, cnt, key_store);
+        CountReplyStore(ctx, cnt, key_store, aggs, options.aggregates_count);
 
-    for (size_t i = 0; i < size; ++i) {
+    for (long long i = 0; i < size; ++i) {
         if (array[i])
             RedisModule_FreeString(ctx, array[i]);
     }
     RedisModule_Free(array);
     RedisModule_Free(header);
-    FreeCountList(cnt);
+    RedisModule_Free(aggs);
+    FreeCountList(cnt, options.aggregates_count);
     return REDISMODULE_OK;
 }
 
-int RedisModule_OnLoad(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
-    if (RedisModule_Init(ctx, "tabular", 1, REDISMODULE_APIVER_1)
-        == REDISMODULE_ERR) return REDISMODULE_ERR;
+static int TabularCount_RedisCommand(RedisModuleCtx *ctx,
+                                     RedisModuleString **argv,
+                                     int argc) {
+    return TabularCount(ctx, argv, argc, 0);
+}
 
-    if (RedisModule_CreateCommand(ctx, "tabular.get",
-        TabularGet_RedisCommand, "write deny-oom", 1, 1, 1) == REDISMODULE_ERR)
-        return REDISMODULE_ERR;
+static int TabularRoCount_RedisCommand(RedisModuleCtx *ctx,
+                                       RedisModuleString **argv,
+                                       int argc) {
+    return TabularCount(ctx, argv, argc, 1);
+}
 
-    if (RedisModule_CreateCommand(ctx, "tabular.filter",
-        TabularFilter_RedisCommand, "write deny-oom", 1, 1, 1) == REDISMODULE_ERR)
-        return REDISMODULE_ERR;
+/**
+ *  GetSource Reads a sorted result to merge. A sorted set, as stored by
+ *  TABULAR.GET with STORE, gives row keys whose values are read in their
+ *  hashes. A list gives each row key followed by the values of the sorted
+ *  fields, so that results of other servers can be merged.
+ *
+ * @param ctx The Redis context
+ * @param source The key of the sorted result
+ * @param header The sorted columns
+ * @param block_size The number of columns
+ * @param[out] count The number of rows read
+ * @param[out] total The number of rows of the whole result, read in the key
+ *                   "<source>:size" if it exists, count otherwise.
+ *
+ * @return The rows in the layout of GetArray, or NULL if source is neither
+ *         a sorted set nor a list.
+ */
+static RedisModuleString **GetSource(RedisModuleCtx *ctx,
+                                     RedisModuleString *source,
+                                     TabularHeader *header, int block_size,
+                                     long long *count, long long *total) {
+    RedisModuleKey *key = RedisModule_OpenKey(ctx, source, REDISMODULE_READ);
+    int type = RedisModule_KeyType(key);
+    if (key)
+        RedisModule_CloseKey(key);
+
+    RedisModuleString **array;
+    RedisModuleCallReply *reply;
+    *count = 0;
+    if (type == REDISMODULE_KEYTYPE_ZSET) {
+        reply = RedisModule_Call(ctx, "ZRANGE", "sll", source, 0LL, -1LL);
+        *count = RedisModule_CallReplyLength(reply);
+        RedisModuleString **members = RedisModule_Alloc(
+                (*count ? *count : 1) * sizeof(RedisModuleString *));
+        for (long long i = 0; i < *count; ++i)
+            members[i] = RedisModule_CreateStringFromCallReply(
+                    RedisModule_CallReplyArrayElement(reply, i));
+        RedisModule_FreeCallReply(reply);
+        Join *join = JoinCreate(ctx, header, block_size - 1);
+        array = GetArray(ctx, members, *count * block_size, block_size, header,
+                         join);
+        JoinFree(ctx, join);
+    }
+    else if (type == REDISMODULE_KEYTYPE_LIST) {
+        reply = RedisModule_Call(ctx, "LRANGE", "sll", source, 0LL, -1LL);
+        *count = RedisModule_CallReplyLength(reply) / block_size;
+        array = RedisModule_Alloc(
+                (*count ? *count * block_size : 1) * sizeof(RedisModuleString *));
+        for (long long i = 0; i < *count * block_size; i += block_size) {
+            /* The row key is first in the list and last in the array */
+            array[i + block_size - 1] = RedisModule_CreateStringFromCallReply(
+                    RedisModule_CallReplyArrayElement(reply, i));
+            for (int j = 0; j < block_size - 1; ++j)
+                array[i + j] = RedisModule_CreateStringFromCallReply(
+                        RedisModule_CallReplyArrayElement(reply, i + j + 1));
+        }
+        RedisModule_FreeCallReply(reply);
+    }
+    else if (type == REDISMODULE_KEYTYPE_EMPTY)
+        array = RedisModule_Alloc(sizeof(RedisModuleString *));
+    else
+        return NULL;
+
+    *total = *count;
+    RedisModuleString *size_key = RedisModule_CreateStringPrintf(
+            ctx, "%s:size", RedisModule_StringPtrLen(source, NULL));
+    reply = RedisModule_Call(ctx, "GET", "s", size_key);
+    RedisModuleString *size = RedisModule_CreateStringFromCallReply(reply);
+    if (size) {
+        long long value;
+        if (RedisModule_StringToLongLong(size, &value) == REDISMODULE_OK)
+            *total = value;
+        RedisModule_FreeString(ctx, size);
+    }
+    RedisModule_FreeCallReply(reply);
+    RedisModule_FreeString(ctx, size_key);
+    return array;
+}
+
+/**
+ *  TABULAR.MERGE ldown lup SOURCES count key* {STORE key}? SORT count {field type}*
+ *
+ *  Merges results already sorted with the same SORT, for example computed on
+ *  several servers, and gives the window of the merged result with the sum
+ *  of the sources sizes. The reply and the stored keys are the ones of
+ *  TABULAR.GET.
+ *
+ * @param ctx The Redis context
+ * @param argv An array of arguments
+ * @param argc The arguments count with the command
+ *
+ * @return REDISMODULE_ERR or REDISMODULE_OK
+ */
+static int TabularMerge_RedisCommand(RedisModuleCtx *ctx,
+                                     RedisModuleString **argv,
+                                     int argc) {
+    long long first, last;
+    int block_size = 0;
+    int flag = TABULAR_SORT | TABULAR_STORE | TABULAR_SOURCES;
+
+    if (RedisModule_IsKeysPositionRequest(ctx))
+        return KeysPositions(ctx, argv, argc, 0, 3, flag);
+
+    if (argc < 6)
+        return RedisModule_WrongArity(ctx);
+
+    IndexStep(ctx);
+
+    if (RedisModule_StringToLongLong(argv[1], &first) == REDISMODULE_ERR)
+        return RedisModule_ReplyWithError(
+                ctx,
+                "Err: The first argument must be an integer");
+    if (RedisModule_StringToLongLong(argv[2], &last) == REDISMODULE_ERR)
+        return RedisModule_ReplyWithError(
+                ctx,
+                "Err: The second argument must be an integer");
+    if (first > last) {
+        long long tmp = first;
+        first = last;
+        last = tmp;
+    }
+
+    RedisModuleString *key_store = NULL;
+    TabularOptions options;
+    TabularHeader *header = ParseArgv(argv + 3, argc - 3, &block_size, &key_store,
+            &options, flag);
+    if (header && (options.sources_count == 0 || block_size == 0)) {
+        RedisModule_Free(header);
+        header = NULL;
+    }
+    if (!header) {
+        return RedisModule_ReplyWithError(
+                ctx,
+                "Err: The syntax is TABULAR.MERGE ldown lup SOURCES count key* {STORE key}? SORT count {field {ALPHA|NUM|FLOAT|IALPHA|COLLATE|REVALPHA|REVNUM|REVFLOAT|REVIALPHA|REVCOLLATE} {NULLS {FIRST|LAST}}?}*");
+    }
+
+    /* As with TABULAR.GET, rows are finally ordered by their keys */
+    ++block_size;
+    char type[block_size];
+    char nulls[block_size];
+    type[block_size - 1] = 'a';
+    nulls[block_size - 1] = 0;
+    for (int i = 0; i < block_size - 1; ++i) {
+        type[i] = header[i].type;
+        nulls[i] = header[i].nulls;
+    }
+
+    int count = options.sources_count;
+    RedisModuleString **parts[count];
+    long long bounds[count + 1];
+    long long key_count = 0;
+    bounds[0] = 0;
+    for (int s = 0; s < count; ++s) {
+        long long rows;
+        long long total;
+        parts[s] = GetSource(ctx, options.sources[s], header, block_size,
+                             &rows, &total);
+        if (!parts[s]) {
+            for (int p = 0; p < s; ++p) {
+                for (long long i = 0; i < bounds[p + 1] - bounds[p]; ++i) {
+                    if (parts[p][i])
+                        RedisModule_FreeString(ctx, parts[p][i]);
+                }
+                RedisModule_Free(parts[p]);
+            }
+            RedisModule_Free(header);
+            return RedisModule_ReplyWithError(
+                    ctx,
+                    "Err: Sources must be sorted sets or lists");
+        }
+        bounds[s + 1] = bounds[s] + rows * block_size;
+        key_count += total;
+    }
+
+    long long size = bounds[count];
+    RedisModuleString **array = RedisModule_Alloc(
+            (size ? size : 1) * sizeof(RedisModuleString *));
+    for (int s = 0; s < count; ++s) {
+        memcpy(array + bounds[s], parts[s],
+               (bounds[s + 1] - bounds[s]) * sizeof(RedisModuleString *));
+        RedisModule_Free(parts[s]);
+    }
+
+    long long window = last - first + 1;
+    if (window > size / block_size)
+        window = size / block_size;
+    long long *rows = RedisModule_Alloc(
+            (window > 0 ? window : 1) * sizeof(long long));
+    long long n = Merge(array, bounds, count, type, nulls, block_size,
+                  first, last, rows);
+
+    if (key_store == NULL) {
+        RedisModule_ReplyWithArray(ctx, n + 1);
+        RedisModule_ReplyWithLongLong(ctx, key_count);
+        for (long long i = 0; i < n; ++i)
+            RedisModule_ReplyWithString(ctx, array[rows[i] + block_size - 1]);
+    }
+    else {
+        RedisModuleKey *key = RedisModule_OpenKey(
+                ctx, key_store, REDISMODULE_WRITE);
+        RedisModule_DeleteKey(key);
+        for (long long i = 0; i < n; ++i)
+            RedisModule_ZsetAdd(key, i, array[rows[i] + block_size - 1], NULL);
+        RedisModule_CloseKey(key);
+        RedisModuleString *keystore_size_str = RedisModule_CreateStringPrintf(
+                ctx, "%s:size", RedisModule_StringPtrLen(key_store, NULL));
+        RedisModuleCallReply *reply = RedisModule_Call(ctx, "SET", "sl",
+                keystore_size_str, key_count);
+        RedisModule_FreeCallReply(reply);
+        RedisModule_FreeString(ctx, keystore_size_str);
+        RedisModule_ReplyWithSimpleString(ctx, "OK");
+    }
+
+    for (long long i = 0; i < size; ++i) {
+        if (array[i])
+            RedisModule_FreeString(ctx, array[i]);
+    }
+    RedisModule_Free(array);
+    RedisModule_Free(rows);
+    RedisModule_Free(header);
+    return REDISMODULE_OK;
+}
+
+/**
+ *  BatchQuery Builds the arguments of a query of TABULAR.BATCH, as if it was
+ *  sent alone.
+ *
+ * @param argv The TABULAR.BATCH arguments
+ * @param idx The index of the query command in argv
+ * @param nargs The query arguments count
+ * @param[out] sub The query arguments
+ *
+ * @return The query arguments count with the command
+ */
+static int BatchQuery(RedisModuleString **argv, int idx, int nargs,
+                      RedisModuleString **sub) {
+    sub[0] = argv[idx];
+    sub[1] = argv[1];
+    for (int i = 0; i < nargs; ++i)
+        sub[i + 2] = argv[idx + 2 + i];
+    return nargs + 2;
+}
+
+/**
+ *  TABULAR.BATCH key count {{GET|COUNT} nargs arg*}*
+ *
+ *  Runs several TABULAR.GET and TABULAR.COUNT queries on the same set. Each
+ *  query is given by its command, the count of its arguments and these
+ *  arguments, the key excepted. The members of the set and the fields used
+ *  by the queries are read once, then each query filters, sorts or counts
+ *  these rows. The reply is the array of the queries replies.
+ *
+ * @param ctx The Redis context
+ * @param argv An array of arguments
+ * @param argc The arguments count with the command
+ *
+ * @return REDISMODULE_ERR or REDISMODULE_OK
+ */
+static int TabularBatch_RedisCommand(RedisModuleCtx *ctx,
+                                     RedisModuleString **argv,
+                                     int argc) {
+    long long count;
+    if (argc < 3)
+        return RedisModule_WrongArity(ctx);
+
+    /* Queries are checked before any reply */
+    int idx = 3;
+    if (RedisModule_StringToLongLong(argv[2], &count) == REDISMODULE_ERR
+        || count <= 0)
+        idx = -1;
+    for (long long q = 0; idx >= 0 && q < count; ++q) {
+        long long nargs;
+        const char *cmd = idx < argc
+                          ? RedisModule_StringPtrLen(argv[idx], NULL) : "";
+        if ((strcasecmp(cmd, "GET") && strcasecmp(cmd, "COUNT"))
+            || idx + 1 >= argc
+            || RedisModule_StringToLongLong(argv[idx + 1], &nargs) == REDISMODULE_ERR
+            || nargs < 0 || nargs > argc - idx - 2)
+            idx = -1;
+        else
+            idx += 2 + nargs;
+    }
+    if (idx != argc)
+        return RedisModule_ReplyWithError(
+                ctx,
+                "Err: The syntax is TABULAR.BATCH key count {{GET|COUNT} nargs arg*}*");
+
+    /* The fields of the queries that are not indexed */
+    RedisModuleString **fields = RedisModule_Alloc(argc * sizeof(RedisModuleString *));
+    RedisModuleString **sub = RedisModule_Alloc(argc * sizeof(RedisModuleString *));
+    int fields_count = 0;
+    idx = 3;
+    for (long long q = 0; q < count; ++q) {
+        long long nargs;
+        RedisModule_StringToLongLong(argv[idx + 1], &nargs);
+        int n = BatchQuery(argv, idx, nargs, sub);
+        idx += 2 + nargs;
+
+        int get = strcasecmp(RedisModule_StringPtrLen(sub[0], NULL), "GET") == 0;
+        int windows = get ? WindowsCount(sub, n) : 0;
+        int offset = get ? (windows > 0 ? 4 + 2 * windows : 4) : 2;
+        if (offset > n)
+            continue;
+        int block_size;
+        RedisModuleString *key_store;
+        TabularOptions options;
+        TabularHeader *header = ParseArgv(sub + offset, n - offset,
+                                          &block_size, &key_store, &options,
+                                          get ? GET_FLAGS : COUNT_FLAGS);
+        if (!header)
+            continue;
+        for (int i = 0; i < block_size; ++i) {
+            int f = 0;
+            while (f < fields_count
+                   && RedisModule_StringCompare(header[i].field, fields[f]))
+                f++;
+            /* Filtered columns are read from the hashes even if indexed */
+            if (f == fields_count
+                && (header[i].tool != TABULAR_NONE
+                    || !IndexGet(ctx, header[i].field))
+                && !JoinField(header[i].field) && !IsKeyField(header[i].field))
+                fields[fields_count++] = header[i].field;
+        }
+        RedisModule_Free(header);
+    }
+
+    batch = BatchCreate(ctx, argv[1], fields, fields_count);
+    RedisModule_ReplyWithArray(ctx, count);
+    idx = 3;
+    for (long long q = 0; q < count; ++q) {
+        long long nargs;
+        RedisModule_StringToLongLong(argv[idx + 1], &nargs);
+        int n = BatchQuery(argv, idx, nargs, sub);
+        idx += 2 + nargs;
+        if (strcasecmp(RedisModule_StringPtrLen(sub[0], NULL), "GET") == 0)
+            TabularGet(ctx, sub, n, 0);
+        else
+            TabularCount(ctx, sub, n, 0);
+    }
+    if (batch)
+        BatchFree(ctx, batch);
+    batch = NULL;
+
+    RedisModule_Free(fields);
+    RedisModule_Free(sub);
+    return REDISMODULE_OK;
+}
+
+/**
+ *  TABULAR.INDEX CREATE field {TRIGRAM}? | DROP field
+ *
+ *  Creates or removes an inverted index on a hash field of the current
+ *  database. EQUAL and IN filters on an indexed field only read the rows
+ *  having one of the searched values, and a count on a single indexed field
+ *  reads no row at all. With TRIGRAM, MATCH filters on the field only read
+ *  the rows containing the literal parts of the pattern. Indexes are kept up
+ *  to date with keyspace notifications, they are stored in keys so that they
+ *  are persisted and replicated.
+ *
+ * @param ctx The Redis context
+ * @param argv An array of arguments
+ * @param argc The arguments count with the command
+ *
+ * @return REDISMODULE_ERR or REDISMODULE_OK
+ */
+static int TabularIndex_RedisCommand(RedisModuleCtx *ctx,
+                                     RedisModuleString **argv,
+                                     int argc) {
+    if (argc != 3 && argc != 4)
+        return RedisModule_WrongArity(ctx);
+
+    IndexStep(ctx);
+
+    const char *action = RedisModule_StringPtrLen(argv[1], NULL);
+    int trigram = argc == 4;
+    if (trigram && strcasecmp(RedisModule_StringPtrLen(argv[3], NULL), "trigram"))
+        action = NULL;
+
+    if (action && strcasecmp(action, "create") == 0) {
+        if (JoinField(argv[2]) || IsKeyField(argv[2]))
+            return RedisModule_ReplyWithError(
+                    ctx,
+                    "Err: Join columns and @key cannot be indexed");
+        if (IndexCreate(ctx, argv[2], trigram) == REDISMODULE_ERR)
+            return RedisModule_ReplyWithError(
+                    ctx,
+                    "Err: This field is already indexed");
+    }
+    else if (action && strcasecmp(action, "drop") == 0 && !trigram) {
+        if (IndexDrop(ctx, argv[2]) == REDISMODULE_ERR)
+            return RedisModule_ReplyWithError(
+                    ctx,
+                    "Err: This field is not indexed");
+    }
+    else
+        return RedisModule_ReplyWithError(
+                ctx,
+                "Err: The syntax is TABULAR.INDEX {CREATE field {TRIGRAM}?|DROP field}");
+
+    RedisModule_ReplicateVerbatim(ctx);
+    return RedisModule_ReplyWithSimpleString(ctx, "OK");
+}
+
+/**
+ *  TABULAR.COUNTER CREATE name set field+ | DROP name | GET name
+ *
+ *  Maintains the rows count of a set by the values of some fields. The
+ *  counts are kept up to date with keyspace notifications, a row changing
+ *  of values moves from its old group to its new one, so that GET replies
+ *  in O(groups) without reading the rows. GET gives an array of groups, each
+ *  one made of the values of the fields, nil if missing, and of the count.
+ *  Counters are stored in keys, like indexes.
+ *
+ * @param ctx The Redis context
+ * @param argv An array of arguments
+ * @param argc The arguments count with the command
+ *
+ * @return REDISMODULE_ERR or REDISMODULE_OK
+ */
+static int TabularCounter_RedisCommand(RedisModuleCtx *ctx,
+                                       RedisModuleString **argv,
+                                       int argc) {
+    /* Only CREATE names a key, the set, counters keys are derived from
+     * their names */
+    if (RedisModule_IsKeysPositionRequest(ctx)) {
+        if (argc >= 5
+            && strcasecmp(RedisModule_StringPtrLen(argv[1], NULL), "create") == 0)
+            RedisModule_KeyAtPos(ctx, 3);
+        return REDISMODULE_OK;
+    }
+
+    if (argc < 3)
+        return RedisModule_WrongArity(ctx);
+
+    const char *action = RedisModule_StringPtrLen(argv[1], NULL);
+    if (argc == 3 && strcasecmp(action, "get") == 0) {
+        if (CounterReplyWithGroups(ctx, argv[2]) == REDISMODULE_ERR)
+            return RedisModule_ReplyWithError(
+                    ctx,
+                    "Err: There is no such counter");
+        return REDISMODULE_OK;
+    }
+    else if (argc >= 5 && strcasecmp(action, "create") == 0) {
+        if (CounterCreate(ctx, argv[2], argv[3], argv + 4, argc - 4)
+            == REDISMODULE_ERR)
+            return RedisModule_ReplyWithError(
+                    ctx,
+                    "Err: This counter already exists");
+    }
+    else if (argc == 3 && strcasecmp(action, "drop") == 0) {
+        if (CounterDrop(ctx, argv[2]) == REDISMODULE_ERR)
+            return RedisModule_ReplyWithError(
+                    ctx,
+                    "Err: There is no such counter");
+    }
+    else
+        return RedisModule_ReplyWithError(
+                ctx,
+                "Err: The syntax is TABULAR.COUNTER {CREATE name set field+|DROP name|GET name}");
+
+    RedisModule_ReplicateVerbatim(ctx);
+    return RedisModule_ReplyWithSimpleString(ctx, "OK");
+}
+
+/**
+ *  TABULAR.CACHE {STATS|CLEAR|SIZE bytes}
+ *
+ *  Manages the cache of TABULAR.GET replies. STATS gives the hits, misses,
+ *  evictions and invalidations counters with the cache usage, CLEAR empties
+ *  the cache and SIZE changes its memory cap, 0 disabling it.
+ *
+ * @param ctx The Redis context
+ * @param argv An array of arguments
+ * @param argc The arguments count with the command
+ *
+ * @return REDISMODULE_ERR or REDISMODULE_OK
+ */
+static int TabularCache_RedisCommand(RedisModuleCtx *ctx,
+                                     RedisModuleString **argv,
+                                     int argc) {
+    if (argc != 2 && argc != 3)
+        return RedisModule_WrongArity(ctx);
+
+    const char *action = RedisModule_StringPtrLen(argv[1], NULL);
+    long long size;
+    if (argc == 2 && strcasecmp(action, "stats") == 0) {
+        CacheReplyWithStats(ctx);
+        return REDISMODULE_OK;
+    }
+    else if (argc == 2 && strcasecmp(action, "clear") == 0)
+        CacheClear(ctx);
+    else if (argc == 3 && strcasecmp(action, "size") == 0
+             && RedisModule_StringToLongLong(argv[2], &size) == REDISMODULE_OK
+             && size >= 0)
+        CacheResize(ctx, size);
+    else
+        return RedisModule_ReplyWithError(
+                ctx,
+                "Err: The syntax is TABULAR.CACHE {STATS|CLEAR|SIZE bytes}");
+
+    return RedisModule_ReplyWithSimpleString(ctx, "OK");
+}
+
+/**
+ *  AddStage Replies with a stage of a query plan: its name, its description,
+ *  the estimated rows count after it, and the actual one or nil.
+ *
+ * @param ctx The Redis context
+ * @param name The stage name
+ * @param detail The stage description, it is freed
+ * @param estimate The estimated rows count
+ * @param actual The actual rows count
+ * @param analyze 1 if the actual count is known
+ */
+static void AddStage(RedisModuleCtx *ctx, const char *name,
+                     RedisModuleString *detail, double estimate,
+                     long long actual, int analyze) {
+    RedisModule_ReplyWithArray(ctx, 4);
+    RedisModule_ReplyWithSimpleString(ctx, name);
+    RedisModule_ReplyWithString(ctx, detail);
+    RedisModule_FreeString(ctx, detail);
+    RedisModule_ReplyWithLongLong(ctx, llround(estimate));
+    if (analyze)
+        RedisModule_ReplyWithLongLong(ctx, actual);
+    else
+        RedisModule_ReplyWithNull(ctx);
+}
+
+/**
+ *  FilterDetail Describes the filter of a column, as "field TOOL search"
+ */
+static RedisModuleString *FilterDetail(RedisModuleCtx *ctx,
+                                       TabularHeader *column) {
+    const char *tool = column->tool == TABULAR_MATCH ? "MATCH"
+                       : column->tool == TABULAR_EQUAL ? "EQUAL" : "IN";
+    return RedisModule_CreateStringPrintf(
+            ctx, "%s %s %s", RedisModule_StringPtrLen(column->field, NULL),
+            tool, column->search);
+}
+
+/**
+ *  TABULAR.EXPLAIN {ANALYZE}? key ldown lup {options of TABULAR.GET}?
+ *
+ *  Describes how TABULAR.GET runs a query, as an array of stages. Each
+ *  stage gives its name, its description, the rows count estimated from the
+ *  fields statistics and, with ANALYZE, the actual count. ANALYZE runs the
+ *  query without replying its rows nor storing them. The stages are:
+ *  - scan: the set members, combined with UNION, INTER or DIFF.
+ *  - key: a filter on the row key, applied to the set members before any
+ *    hash is read.
+ *  - index: a filter restricting the rows with an index, without reading
+ *    them.
+ *  - filter: a filter applied to the rows read, from the most selective one
+ *    when the rows are many enough for statistics to be used.
+ *  - top-k: a sort stopping at the window, when it is a part of the rows.
+ *  - sort: a full sort.
+ *  - window: the rows returned, without sort. With NOCOUNT or APPROX, rows
+ *    are read only until the window is filled.
+ *
+ * @param ctx The Redis context
+ * @param argv An array of arguments
+ * @param argc The arguments count with the command
+ *
+ * @return REDISMODULE_ERR or REDISMODULE_OK
+ */
+static int TabularExplain_RedisCommand(RedisModuleCtx *ctx,
+                                       RedisModuleString **argv,
+                                       int argc) {
+    int analyze = argc > 1
+                  && strcasecmp(RedisModule_StringPtrLen(argv[1], NULL), "analyze") == 0;
+    if (RedisModule_IsKeysPositionRequest(ctx))
+        return KeysPositions(ctx, argv, argc, 1 + analyze, 4 + analyze, GET_FLAGS);
+    argv += analyze;
+    argc -= analyze;
+    if (argc < 4)
+        return RedisModule_WrongArity(ctx);
+
+    IndexStep(ctx);
+
+    RedisModuleString *set = argv[1];
+    long long first, last;
+    if (RedisModule_StringToLongLong(argv[2], &first) == REDISMODULE_ERR
+        || RedisModule_StringToLongLong(argv[3], &last) == REDISMODULE_ERR)
+        return RedisModule_ReplyWithError(
+                ctx,
+                "Err: The window bounds must be integers");
+    if (first > last) {
+        long long tmp = first;
+        first = last;
+        last = tmp;
+    }
+
+    int block_size;
+    TabularOptions options;
+    TabularHeader *header = ParseArgv(argv + 4, argc - 4, &block_size, NULL,
+                                      &options, GET_FLAGS);
+    if (!header)
+        return RedisModule_ReplyWithError(
+                ctx,
+                "Err: The syntax is TABULAR.EXPLAIN {ANALYZE}? key ldown lup {options of TABULAR.GET}?");
+
+    RedisModuleString **members;
+    long long count;
+    if (Members(ctx, set, &options, &members, &count) == REDISMODULE_ERR) {
+        RedisModule_Free(header);
+        return RedisModule_ReplyWithError(
+                ctx,
+                "Err: Unable to get the set card");
+    }
+    long long size;
+    if (ArraySize(count, block_size + 1, &size) == REDISMODULE_ERR) {
+        FreeMembers(ctx, members, count);
+        RedisModule_Free(header);
+        return RedisModule_ReplyWithError(
+                ctx,
+                "Err: The set has too many rows");
+    }
+
+    RedisModule_ReplyWithArray(ctx, REDISMODULE_POSTPONED_ARRAY_LEN);
+    long stages = 1;
+    const char *set_name = RedisModule_StringPtrLen(set, NULL);
+    if (options.set_op == TABULAR_SET_NONE)
+        AddStage(ctx, "scan", RedisModule_CreateStringPrintf(ctx, "%s", set_name),
+                 count, count, analyze);
+    else
+        AddStage(ctx, "scan", RedisModule_CreateStringPrintf(
+                         ctx, "%s %s %d sets", set_name,
+                         options.set_op == TABULAR_UNION ? "UNION"
+                         : options.set_op == TABULAR_INTER ? "INTER" : "DIFF",
+                         options.sets_count),
+                 count, count, analyze);
+    double estimate = count;
+    int columns = block_size;
+
+    /* Filters on the row key are applied to the keys alone, they are used
+     * even without ANALYZE and their count is exact */
+    for (int j = 0; j < columns; ++j) {
+        TabularHeader column = header[j];
+        if (FilterKeys(ctx, &column, 1, members, &count) == 0)
+            continue;
+        estimate = count;
+        AddStage(ctx, "key", FilterDetail(ctx, &header[j]), estimate, count,
+                 analyze);
+        stages++;
+        header[j].tool = column.tool;
+    }
+
+    /* Indexes restrict the rows without reading them, they are used even
+     * without ANALYZE. A trigram index keeps the rows that may match. */
+    int indexed[columns + 1];
+    for (int j = 0; j < columns; ++j) {
+        indexed[j] = 0;
+        Index *index = header[j].tool != TABULAR_NONE
+                       ? IndexGet(ctx, header[j].field) : NULL;
+        if (!index || (header[j].tool == TABULAR_MATCH && !index->trigram))
+            continue;
+        indexed[j] = 1;
+        estimate *= StatsSelectivity(ctx, set, &header[j]);
+        TabularHeader column = header[j];
+        IndexRestrict(ctx, &column, 1, members, &count);
+        AddStage(ctx, "index", FilterDetail(ctx, &header[j]), estimate, count,
+                 analyze);
+        stages++;
+        header[j].tool = column.tool;
+    }
+
+    int ordered = StatsEstimate(ctx, set, header, columns, count);
+    ++block_size;
+    /* Restricted rows are fewer, their size was checked with all the rows */
+    size = count * block_size;
+    RedisModuleString **array = NULL;
+    if (analyze) {
+        Join *join = JoinCreate(ctx, header, columns);
+        array = GetArray(ctx, members, size, block_size, header, join);
+        JoinFree(ctx, join);
+    }
+    else
+        FreeMembers(ctx, members, count);
+    long long orig_size = size;
+
+    int order[block_size];
+    int filters = FilterOrder(header, block_size, order);
+    for (int f = 0; f < filters; ++f) {
+        int j = order[f];
+        if (!indexed[j])
+            estimate *= ordered ? header[j].selectivity
+                        : StatsSelectivity(ctx, set, &header[j]);
+        if (analyze && size > 0) {
+            TabularHeader one[columns];
+            memcpy(one, header, columns * sizeof(TabularHeader));
+            for (int k = 0; k < columns; ++k) {
+                if (k != j)
+                    one[k].tool = TABULAR_NONE;
+            }
+            size = Filter(ctx, array, size, one, block_size);
+        }
+        AddStage(ctx, "filter", FilterDetail(ctx, &header[j]), estimate,
+                 size / block_size, analyze);
+        stages++;
+    }
+
+    /* Sorted fields come first in the header */
+    int sorted = columns > 0 && header[0].type;
+    long long rows = size / block_size;
+    if (sorted) {
+        RedisModuleString *detail = RedisModule_CreateString(ctx, "", 0);
+        for (int j = 0; j < columns && header[j].type; ++j) {
+            size_t len;
+            const char *field = RedisModule_StringPtrLen(header[j].field, &len);
+            if (j > 0)
+                RedisModule_StringAppendBuffer(ctx, detail, ", ", 2);
+            RedisModule_StringAppendBuffer(ctx, detail, field, len);
+        }
+        AddStage(ctx, last + 1 < estimate ? "top-k" : "sort", detail, estimate,
+                 rows, analyze);
+        stages++;
+    }
+
+    RedisModuleString *detail = RedisModule_CreateStringPrintf(
+            ctx, "rows %lld..%lld", first, last);
+    if (!sorted && filters > 0 && (options.nocount || options.approx))
+        RedisModule_StringAppendBuffer(ctx, detail, ", stops once filled", 19);
+    double returned = (estimate < last + 1 ? estimate : last + 1) - first;
+    rows = (rows < last + 1 ? rows : last + 1) - first;
+    AddStage(ctx, "window", detail, returned > 0 ? returned : 0,
+             rows > 0 ? rows : 0, analyze);
+    stages++;
+    RedisModule_ReplySetArrayLength(ctx, stages);
+
+    for (long long i = 0; i < orig_size && array; ++i) {
+        if (array[i])
+            RedisModule_FreeString(ctx, array[i]);
+    }
+    RedisModule_Free(array);
+    RedisModule_Free(header);
+    return REDISMODULE_OK;
+}
+
+/**
+ *  TABULAR.STATS key field
+ *
+ *  Gives the statistics of a field over the rows of a set, used to estimate
+ *  the filters selectivity. They are computed from a random sample of rows,
+ *  and sampled again when enough keys changed.
+ *
+ * @param ctx The Redis context
+ * @param argv An array of arguments
+ * @param argc The arguments count with the command
+ *
+ * @return REDISMODULE_ERR or REDISMODULE_OK
+ */
+static int TabularStats_RedisCommand(RedisModuleCtx *ctx,
+                                     RedisModuleString **argv,
+                                     int argc) {
+    if (argc != 3)
+        return RedisModule_WrongArity(ctx);
+
+    StatsReply(ctx, StatsGet(ctx, argv[1], argv[2]));
+    return REDISMODULE_OK;
+}
+
+int RedisModule_OnLoad(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    if (RedisModule_Init(ctx, "tabular", 1, REDISMODULE_APIVER_1)
+        == REDISMODULE_ERR) return REDISMODULE_ERR;
+
+    if (IndexRegisterType(ctx) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
+    if (CounterRegisterType(ctx) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
+    if (CacheInit(ctx, argv, argc) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
+    if (RedisModule_CreateCommand(ctx, "tabular.get",
+        TabularGet_RedisCommand, "write deny-oom getkeys-api", 1, 1, 1) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
+    if (RedisModule_CreateCommand(ctx, "tabular.filter",
+        TabularFilter_RedisCommand, "write deny-oom getkeys-api", 1, 1, 1) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
 
     if (RedisModule_CreateCommand(ctx, "tabular.count",
-        TabularCount_RedisCommand, "write deny-oom", 1, 1, 1) == REDISMODULE_ERR)
+        TabularCount_RedisCommand, "write deny-oom getkeys-api", 1, 1, 1) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
+    if (RedisModule_CreateCommand(ctx, "tabular.ro_get",
+        TabularRoGet_RedisCommand, "readonly getkeys-api", 1, 1, 1) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
+    if (RedisModule_CreateCommand(ctx, "tabular.ro_filter",
+        TabularRoFilter_RedisCommand, "readonly getkeys-api", 1, 1, 1) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
+    if (RedisModule_CreateCommand(ctx, "tabular.ro_count",
+        TabularRoCount_RedisCommand, "readonly getkeys-api", 1, 1, 1) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
+    if (RedisModule_CreateCommand(ctx, "tabular.merge",
+        TabularMerge_RedisCommand, "write deny-oom getkeys-api", 0, 0, 0) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
+    if (RedisModule_CreateCommand(ctx, "tabular.batch",
+        TabularBatch_RedisCommand, "write deny-oom", 1, 1, 1) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
+    if (RedisModule_CreateCommand(ctx, "tabular.index",
+        TabularIndex_RedisCommand, "write deny-oom", 0, 0, 0) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
+    if (RedisModule_CreateCommand(ctx, "tabular.counter",
+        TabularCounter_RedisCommand, "write deny-oom getkeys-api", 0, 0, 0) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
+    if (RedisModule_CreateCommand(ctx, "tabular.explain",
+        TabularExplain_RedisCommand, "readonly getkeys-api", 0, 0, 0) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
+    if (RedisModule_CreateCommand(ctx, "tabular.stats",
+        TabularStats_RedisCommand, "readonly", 1, 1, 1) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
+    if (RedisModule_CreateCommand(ctx, "tabular.cache",
+        TabularCache_RedisCommand, "readonly", 0, 0, 0) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
+    if (RedisModule_SubscribeToKeyspaceEvents(ctx, REDISMODULE_NOTIFY_ALL,
+        IndexNotify) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
+    if (RedisModule_SubscribeToKeyspaceEvents(ctx, REDISMODULE_NOTIFY_ALL,
+        CacheNotify) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
+    if (RedisModule_SubscribeToKeyspaceEvents(ctx, REDISMODULE_NOTIFY_ALL,
+        CounterNotify) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
+    if (RedisModule_SubscribeToKeyspaceEvents(ctx, REDISMODULE_NOTIFY_ALL,
+        StatsNotify) == REDISMODULE_ERR)
         return REDISMODULE_ERR;
     return REDISMODULE_OK;
 }
@@ -0,0 +1,127 @@
+/*
+** BSD 3-Clause License
+**
+** Copyright (c) 2018, David Boucher
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**
+** * Redistributions of source code must retain the above copyright notice,
+**   this list of conditions and the following disclaimer.
+**
+** * Redistributions in binary form must reproduce the above copyright notice,
+**   this list of conditions and the following disclaimer in the documentation
+**   and/or other materials provided with the distribution.
+**
+** * Neither the name of the copyright holder nor the names of its
+**   contributors may be used to endorse or promote products derived from
+**   this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+** LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+** CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+** SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+** INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+** CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+** ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+** POSSIBILITY OF SUCH DAMAGE.
+*/
+#include <string.h>
+#include "packed.h"
+
+/**
+ *  PackedInit Initializes an empty packed reply
+ */
+void PackedInit(Packed *packed) {
+    packed->size = 256;
+    packed->buf = RedisModule_Alloc(packed->size);
+    packed->len = 0;
+}
+
+/**
+ *  Reserve Makes room for len more bytes
+ */
+static void Reserve(Packed *packed, size_t len) {
+    if (packed->len + len <= packed->size)
+        return;
+    while (packed->len + len > packed->size)
+        packed->size *= 2;
+    packed->buf = RedisModule_Realloc(packed->buf, packed->size);
+}
+
+/**
+ *  PackedVarint Appends an unsigned integer, seven bits per byte from the
+ *  lowest ones, the high bit telling that another byte follows.
+ */
+void PackedVarint(Packed *packed, unsigned long long value) {
+    Reserve(packed, 10);
+    do {
+        unsigned char byte = value & 0x7f;
+        value >>= 7;
+        packed->buf[packed->len++] = byte | (value ? 0x80 : 0);
+    } while (value);
+}
+
+/**
+ *  PackedSigned Appends a signed integer, zigzag encoded so that small
+ *  negative numbers stay short: 0, -1, 1, -2... become 0, 1, 2, 3...
+ */
+void PackedSigned(Packed *packed, long long value) {
+    PackedVarint(packed, ((unsigned long long)value << 1)
+                         ^ (unsigned long long)(value >> 63));
+}
+
+/**
+ *  PackedBuffer Appends a string, as its length followed by its bytes
+ */
+void PackedBuffer(Packed *packed, const char *str, size_t len) {
+    PackedVarint(packed, len);
+    Reserve(packed, len);
+    memcpy(packed->buf + packed->len, str, len);
+    packed->len += len;
+}
+
+/**
+ *  PackedString Appends a Redis string, as its length followed by its bytes
+ */
+void PackedString(Packed *packed, RedisModuleString *str) {
+    size_t len;
+    const char *s = RedisModule_StringPtrLen(str, &len);
+    PackedBuffer(packed, s, len);
+}
+
+/**
+ *  PackedDouble Appends a double, little endian
+ */
+void PackedDouble(Packed *packed, double value) {
+    unsigned long long bits;
+    memcpy(&bits, &value, sizeof(bits));
+    Reserve(packed, 8);
+    for (int i = 0; i < 8; ++i)
+        packed->buf[packed->len++] = (bits >> (8 * i)) & 0xff;
+}
+
+/**
+ *  PackedTag Appends a one byte tag
+ */
+void PackedTag(Packed *packed, char tag) {
+    Reserve(packed, 1);
+    packed->buf[packed->len++] = tag;
+}
+
+/**
+ *  PackedFinish Gives the packed reply as a string and frees its buffer
+ *
+ * @return The string, to free with RedisModule_FreeString
+ */
+RedisModuleString *PackedFinish(RedisModuleCtx *ctx, Packed *packed) {
+    RedisModuleString *retval = RedisModule_CreateString(ctx, packed->buf,
+                                                         packed->len);
+    RedisModule_Free(packed->buf);
+    packed->buf = NULL;
+    return retval;
+}
@@ -0,0 +1,57 @@
+#ifndef __PACKED_H__
+#define __PACKED_H__
+/*
+** BSD 3-Clause License
+**
+** Copyright (c) 2018, David Boucher
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**
+** * Redistributions of source code must retain the above copyright notice,
+**   this list of conditions and the following disclaimer.
+**
+** * Redistributions in binary form must reproduce the above copyright notice,
+**   this list of conditions and the following disclaimer in the documentation
+**   and/or other materials provided with the distribution.
+**
+** * Neither the name of the copyright holder nor the names of its
+**   contributors may be used to endorse or promote products derived from
+**   this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+** LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+** CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+** SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+** INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+** CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+** ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+** POSSIBILITY OF SUCH DAMAGE.
+*/
+#include <stddef.h>
+#include "redismodule.h"
+
+/* A reply being encoded in the packed layout of FORMAT PACKED. Lengths and
+ * counts are unsigned LEB128 varints, signed integers are zigzag encoded
+ * first, doubles are 8 bytes IEEE 754 little endian. */
+typedef struct _Packed Packed;
+struct _Packed {
+    char *buf;
+    size_t len;
+    size_t size;
+};
+
+void PackedInit(Packed *packed);
+void PackedVarint(Packed *packed, unsigned long long value);
+void PackedSigned(Packed *packed, long long value);
+void PackedBuffer(Packed *packed, const char *str, size_t len);
+void PackedString(Packed *packed, RedisModuleString *str);
+void PackedDouble(Packed *packed, double value);
+void PackedTag(Packed *packed, char tag);
+RedisModuleString *PackedFinish(RedisModuleCtx *ctx, Packed *packed);
+
+#endif /*__PACKED_H__*/
@@ -30,34 +30,288 @@
 ** ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
 ** POSSIBILITY OF SUCH DAMAGE.
 */
+#include <ctype.h>
+#include <math.h>
+#include <stdlib.h>
 #include <string.h>
 #include "sort.h"
 #include "tabular.h"
 
+/* Powers of ten exactly representable as doubles */
+static const double powers_of_ten[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+/**
+ *  ParseDouble Converts a string to a double. Plain decimal numbers with at
+ *  most 15 significant digits are converted directly, the result is then
+ *  exact. Other strings (exponents, long mantissas, ...) are given to strtod.
+ *
+ * @param str The string to parse
+ * @param len The string length
+ *
+ * @return The parsed value, 0 if str is not a number.
+ */
+static double ParseDouble(const char *str, size_t len) {
+    const char *p = str;
+    const char *end = str + len;
+    unsigned long long mantissa = 0;
+    int digits = 0;
+    int decimals = 0;
+    int neg = 0;
+
+    if (p < end && (*p == '-' || *p == '+')) {
+        neg = (*p == '-');
+        p++;
+    }
+    for (; p < end && *p >= '0' && *p <= '9'; ++p, ++digits)
+        mantissa = mantissa * 10 + (*p - '0');
+    if (p < end && *p == '.') {
+        for (++p; p < end && *p >= '0' && *p <= '9'; ++p, ++digits, ++decimals)
+            mantissa = mantissa * 10 + (*p - '0');
+    }
+    if (p == end && digits > 0 && digits <= 15) {
+        double retval = (double)mantissa / powers_of_ten[decimals];
+        return neg ? -retval : retval;
+    }
+
+    /* Slow path */
+    char *endptr;
+    double retval = strtod(str, &endptr);
+    if (endptr == str || *endptr || isnan(retval))
+        return 0;
+    return retval;
+}
+
+/**
+ *  Prefix Computes the abbreviated key of a string, that is its eight first
+ *  bytes in big endian order, completed with zeros if the string is shorter.
+ *  Comparing two prefixes gives the same order as comparing the eight first
+ *  bytes of the strings.
+ *
+ * @param str The string
+ * @param len The string length
+ *
+ * @return The abbreviated key
+ */
+static unsigned long long Prefix(const char *str, size_t len) {
+    unsigned long long retval = 0;
+    size_t i;
+    for (i = 0; i < 8 && i < len; ++i)
+        retval = (retval << 8) | (unsigned char)str[i];
+    return retval << (8 * (8 - i));
+}
+
+/**
+ *  CollationKey Computes the collation key of a string, that is a string such
+ *  that the memcmp of two keys gives the order wanted for the two strings.
+ *
+ * @param str The string to transform
+ * @param len The string length
+ * @param type 'i' or 'I' for a case insensitive order, 'c' or 'C' for the
+ *             order given by the current locale.
+ * @param[out] key The computed key, to free with RedisModule_Free
+ */
+static void CollationKey(const char *str, size_t len, char type, SortKey *key) {
+    if (type == 'i' || type == 'I') {
+        key->coll.str = RedisModule_Alloc(len + 1);
+        for (size_t i = 0; i < len; ++i)
+            key->coll.str[i] = tolower((unsigned char)str[i]);
+        key->coll.len = len;
+    }
+    else {  /* 'c' or 'C' */
+        size_t size = 2 * len + 1;
+        key->coll.str = RedisModule_Alloc(size);
+        key->coll.len = strxfrm(key->coll.str, str, size);
+        if (key->coll.len >= size) {
+            key->coll.str = RedisModule_Realloc(key->coll.str, key->coll.len + 1);
+            strxfrm(key->coll.str, str, key->coll.len + 1);
+        }
+    }
+    key->prefix = Prefix(key->coll.str, key->coll.len);
+}
+
+/**
+ *  BuildKeys Computes once the sort key of each cell of the columns to sort
+ *  that are not simply compared with strcmp.
+ *
+ * @param array The array to sort
+ * @param type An array of the columns types
+ * @param dicts The dictionaries of the 'd' and 'D' columns
+ * @param block_size The group size in the array
+ * @param size The number of cells in array
+ *
+ * @return An array of size cells, parallel to array. It must be freed with
+ *         FreeKeys.
+ */
+static SortKey *BuildKeys(RedisModuleString **array, char *type,
+                          StrTable **dicts, int block_size, long long size) {
+    SortKey *keys = RedisModule_Alloc(size * sizeof(SortKey));
+    for (int k = 0; k < block_size; ++k) {
+        size_t len;
+        switch (type[k]) {
+            case 'a':
+            case 'A':
+                /* Strings are compared with strcmp, so they stop at the first
+                 * zero */
+                for (long long i = k; i < size; i += block_size) {
+                    const char *str = RedisModule_StringPtrLen(array[i], &len);
+                    keys[i].prefix = Prefix(str, strnlen(str, 8));
+                }
+                break;
+            case 'd':
+            case 'D':
+                /* Missing values have no code and come first */
+                for (long long i = k; i < size; i += block_size) {
+                    StrEntry *e = NULL;
+                    if (array[i]) {
+                        const char *str = RedisModule_StringPtrLen(array[i], &len);
+                        e = StrTableFind(dicts[k], str, len);
+                    }
+                    keys[i].num = e ? e->value : -1;
+                }
+                break;
+            case 'n':
+            case 'N':
+                for (long long i = k; i < size; i += block_size) {
+                    if (!array[i]
+                        || RedisModule_StringToLongLong(array[i], &keys[i].num) == REDISMODULE_ERR)
+                        keys[i].num = 0;
+                }
+                break;
+            case 'f':
+            case 'F':
+                for (long long i = k; i < size; i += block_size) {
+                    if (array[i]) {
+                        const char *str = RedisModule_StringPtrLen(array[i], &len);
+                        keys[i].fnum = ParseDouble(str, len);
+                    }
+                    else
+                        keys[i].fnum = 0;
+                }
+                break;
+            case 'i':
+            case 'I':
+            case 'c':
+            case 'C':
+                for (long long i = k; i < size; i += block_size) {
+                    if (array[i]) {
+                        const char *str = RedisModule_StringPtrLen(array[i], &len);
+                        CollationKey(str, len, type[k], &keys[i]);
+                    }
+                    else {
+                        keys[i].coll.str = NULL;
+                        keys[i].coll.len = 0;
+                        keys[i].prefix = 0;
+                    }
+                }
+                break;
+        }
+    }
+    return keys;
+}
+
+/**
+ *  FreeKeys Frees the sort keys array built by BuildKeys
+ *
+ * @param keys The sort keys
+ * @param type An array of the columns types
+ * @param block_size The group size in the array
+ * @param size The number of cells in keys
+ */
+static void FreeKeys(SortKey *keys, char *type, int block_size,
+                     long long size) {
+    for (int k = 0; k < block_size; ++k) {
+        if (type[k] == 'i' || type[k] == 'I' || type[k] == 'c' || type[k] == 'C') {
+            for (long long i = k; i < size; i += block_size) {
+                if (keys[i].coll.str)
+                    RedisModule_Free(keys[i].coll.str);
+            }
+        }
+    }
+    RedisModule_Free(keys);
+}
+
+/**
+ *  SwapRows Exchanges two rows of array and their sort keys
+ *
+ * @param array The array to work on.
+ * @param keys The sort keys parallel to array.
+ * @param block_size Number of columns in the tabular
+ * @param i The index of the first element
+ * @param j The index of the second element
+ */
+static void SwapRows(RedisModuleString **array, SortKey *keys, int block_size,
+                     long long i, long long j) {
+    Swap(array, block_size, i, j);
+    for (int k = 0; k < block_size; ++k) {
+        SortKey tmp = keys[i + k];
+        keys[i + k] = keys[j + k];
+        keys[j + k] = tmp;
+    }
+}
+
 /**
  *  Le is a function returning 1 if array[i] <= array[j] following type
  *
  * @param array An array of RedisModuleStrings
+ * @param keys The numeric values of array cells, parsed before the sort
  * @param type A char giving values types,
  *          * 'a' for strings ordered from the lesser to the greater
  *          * 'A' for strings ordered from the greater to the lesser
  *          * 'n' for numbers ordered from the lesser to the greater
  *          * 'N' for numbers ordered from the greater to the lesser
+ *          * 'f' for floats ordered from the lesser to the greater
+ *          * 'F' for floats ordered from the greater to the lesser
+ *          * 'i' for strings ordered case insensitively from the lesser to
+ *            the greater
+ *          * 'I' for strings ordered case insensitively from the greater to
+ *            the lesser
+ *          * 'c' for strings ordered following the locale from the lesser to
+ *            the greater
+ *          * 'C' for strings ordered following the locale from the greater to
+ *            the lesser
+ *          * 'd' for dictionary encoded strings, ordered as 'a'
+ *          * 'D' for dictionary encoded strings, ordered as 'A'
+ * @param nulls A char giving for each column where missing values go,
+ *          * 'f' missing values are before the others
+ *          * 'l' missing values are after the others
+ *          * 0 missing values are compared as other values
  * @param i * Index of the first element to compare
  * @param j * Index of the second element to compare
  * @param block_size
  *
  * @return 1 if array[i] <= array[j], 0 otherwise.
  */
-static int Le(RedisModuleString **array, char *type, int i, int j, int block_size) {
+static int Le(RedisModuleString **array, SortKey *keys, char *type,
+              char *nulls, long long i, long long j, int block_size) {
     size_t len;
     char *t = type;
-    RedisModuleString *tmp;
-    for (int k = 0; k < block_size; ++k, ++t) {
+    char *n = nulls;
+    for (int k = 0; k < block_size; ++k, ++t, ++n) {
+        if (*n && (!array[i + k] || !array[j + k])) {
+            if (array[i + k] == array[j + k])
+                continue;
+            if (*n == 'f')
+                return array[i + k] == NULL;
+            else    /* 'l' */
+                return array[j + k] == NULL;
+        }
         if (*t == 'a' || *t == 'A') {
-            const char *ai = RedisModule_StringPtrLen(array[i + k], &len);
-            const char *aj = RedisModule_StringPtrLen(array[j + k], &len);
-            int cmp = strcmp(ai, aj);
+            unsigned long long pi = keys[i + k].prefix;
+            unsigned long long pj = keys[j + k].prefix;
+            int cmp;
+            if (pi != pj)
+                cmp = pi < pj ? -1 : 1;
+            else if ((pi & 0xff) == 0)
+                /* Both strings are shorter than eight bytes */
+                cmp = 0;
+            else {
+                const char *ai = RedisModule_StringPtrLen(array[i + k], &len);
+                const char *aj = RedisModule_StringPtrLen(array[j + k], &len);
+                cmp = strcmp(ai + 8, aj + 8);
+            }
             if (cmp) {
                 if (*t == 'a')
                     return cmp < 0;
@@ -65,24 +319,45 @@ static int Le(RedisModuleString **array, char *type, int i, int j, int block_siz
                     return cmp > 0;
             }
         }
-        else if (*t == 'n' || *t == 'N') {
-            long long ai, aj;
-            tmp = array[i + k];
-            if (!tmp
-                || RedisModule_StringToLongLong(tmp, &ai) == REDISMODULE_ERR)
-                ai = 0;
-
-            tmp = array[j + k];
-            if (!tmp
-                || RedisModule_StringToLongLong(tmp, &aj) == REDISMODULE_ERR)
-                aj = 0;
+        else if (*t == 'n' || *t == 'N' || *t == 'd' || *t == 'D') {
+            long long ai = keys[i + k].num;
+            long long aj = keys[j + k].num;
             if (ai != aj) {
-                if (*t == 'n')
+                if (*t == 'n' || *t == 'd')
                     return ai < aj;
-                else    /* 'N' */
+                else    /* 'N' or 'D' */
                     return ai > aj;
             }
         }
+        else if (*t == 'f' || *t == 'F') {
+            double ai = keys[i + k].fnum;
+            double aj = keys[j + k].fnum;
+            if (ai != aj) {
+                if (*t == 'f')
+                    return ai < aj;
+                else    /* 'F' */
+                    return ai > aj;
+            }
+        }
+        else if (*t == 'i' || *t == 'I' || *t == 'c' || *t == 'C') {
+            SortKey *ki = &keys[i + k];
+            SortKey *kj = &keys[j + k];
+            int cmp;
+            if (ki->prefix != kj->prefix)
+                cmp = ki->prefix < kj->prefix ? -1 : 1;
+            else {
+                size_t l = ki->coll.len < kj->coll.len ? ki->coll.len : kj->coll.len;
+                cmp = l > 8 ? memcmp(ki->coll.str + 8, kj->coll.str + 8, l - 8) : 0;
+                if (!cmp)
+                    cmp = (ki->coll.len > kj->coll.len) - (ki->coll.len < kj->coll.len);
+            }
+            if (cmp) {
+                if (*t == 'i' || *t == 'c')
+                    return cmp < 0;
+                else    /* 'I' or 'C' */
+                    return cmp > 0;
+            }
+        }
     }
     return 1;
 }
@@ -94,52 +369,173 @@ static int Le(RedisModuleString **array, char *type, int i, int j, int block_siz
  * @param array The array to sort. Columns are flat, that is to say for an array
  *              containing two columns name and value, array is as follows
  *              array[0] = a name, array[1] = a value, array[2] = a name, etc...
+ * @param keys The sort keys parallel to array
  * @param type An array of types for each column of the array
+ * @param nulls An array of nulls policies for each column of the array
  * @param block_size The group size in the array
  * @param begin The lower bound of the window wanted by the user
  * @param last The upper bound of the window wanted by the user
  *
  * @return The pivot index used by the algorithm
  */
-static int Partition(RedisModuleString **array, char *type, int block_size,
-                     int begin, int last) {
-    int store_idx = begin;
-    for (int i = begin; i < last; i += block_size) {
-        if (Le(array, type, i, last, block_size)) {
-            Swap(array, block_size, i, store_idx);
+static long long Partition(RedisModuleString **array, SortKey *keys,
+                           char *type, char *nulls, int block_size,
+                           long long begin, long long last) {
+    long long store_idx = begin;
+    for (long long i = begin; i < last; i += block_size) {
+        if (Le(array, keys, type, nulls, i, last, block_size)) {
+            SwapRows(array, keys, block_size, i, store_idx);
             store_idx += block_size;
         }
     }
-    Swap(array, block_size, store_idx, last);
+    SwapRows(array, keys, block_size, store_idx, last);
     return store_idx;
 }
 
 /**
- *  QuickSort The main function of the QuickSort algorithm. This
- *  implementation contains an optimization, so that the sort is not totally
- *  done on data ouside of the window scope.
+ *  QuickSortRange The recursive part of the QuickSort algorithm.
  *
  * @param array The array to sort
+ * @param keys The sort keys parallel to array
  * @param type An array of the columns types.
+ * @param nulls An array of the columns nulls policies.
+ * @param block_size the group size in the array
  * @param begin The lower bound of elements to sort
  * @param last The upper bound of elements to sort
  * @param ldown The lower bound of the window wanted by the user
  * @param lup The upper bound of the window wanted by the user
- * @param block_size the group size in the array
- *
- * The order is total only from ldown to lup.
  */
-void QuickSort(RedisModuleString **array, char *type, int block_size,
-                      int begin, int last, int ldown, int lup) {
-    int pivot_idx = 0;
+static void QuickSortRange(RedisModuleString **array, SortKey *keys,
+                           char *type, char *nulls, int block_size,
+                           long long begin, long long last,
+                           long long ldown, long long lup) {
+    long long pivot_idx = 0;
     if (begin < last) {
-        pivot_idx = Partition(array, type, block_size, begin, last);
+        pivot_idx = Partition(array, keys, type, nulls, block_size, begin, last);
         if (pivot_idx - block_size >= ldown) {
-            QuickSort(array, type, block_size, begin, pivot_idx - block_size, ldown, lup);
+            QuickSortRange(array, keys, type, nulls, block_size,
+                           begin, pivot_idx - block_size, ldown, lup);
         }
         if (pivot_idx + block_size <= lup) {
-            QuickSort(array, type, block_size, pivot_idx + block_size, last, ldown, lup);
+            QuickSortRange(array, keys, type, nulls, block_size,
+                           pivot_idx + block_size, last, ldown, lup);
         }
     }
 }
 
+/**
+ *  QuickSort The main function of the QuickSort algorithm. This
+ *  implementation contains an optimization, so that the sort is not totally
+ *  done on data ouside of the window scope. Numeric values, collation keys and
+ *  string prefixes are computed once before the sort.
+ *
+ * @param array The array to sort
+ * @param type An array of the columns types.
+ * @param nulls An array of the columns nulls policies.
+ * @param block_size the group size in the array
+ * @param begin The lower bound of elements to sort
+ * @param last The upper bound of elements to sort
+ * @param ldown The lower bound of the window wanted by the user
+ * @param lup The upper bound of the window wanted by the user
+ *
+ * The order is total only from ldown to lup.
+ */
+void QuickSort(RedisModuleString **array, char *type, char *nulls,
+               StrTable **dicts, int block_size, long long begin,
+               long long last, long long ldown, long long lup) {
+    if (begin >= last)
+        return;
+    SortKey *keys = BuildKeys(array, type, dicts, block_size, last + block_size);
+    QuickSortRange(array, keys, type, nulls, block_size,
+                   begin, last, ldown, lup);
+    FreeKeys(keys, type, block_size, last + block_size);
+}
+
+/**
+ *  HeapLess Tells if the current row of a part comes before the current row
+ *  of another part. Equal rows are ordered by part, so that the merge is
+ *  stable.
+ */
+static int HeapLess(RedisModuleString **array, SortKey *keys, char *type,
+                    char *nulls, int block_size, long long *pos, int a,
+                    int b) {
+    if (!Le(array, keys, type, nulls, pos[b], pos[a], block_size))
+        return 1;
+    return Le(array, keys, type, nulls, pos[a], pos[b], block_size) && a < b;
+}
+
+/**
+ *  SiftDown Restores the heap order below the node i of the heap
+ */
+static void SiftDown(RedisModuleString **array, SortKey *keys, char *type,
+                     char *nulls, int block_size, long long *pos, int *heap,
+                     int n, int i) {
+    for (;;) {
+        int min = i;
+        int l = 2 * i + 1;
+        int r = l + 1;
+        if (l < n && HeapLess(array, keys, type, nulls, block_size, pos,
+                              heap[l], heap[min]))
+            min = l;
+        if (r < n && HeapLess(array, keys, type, nulls, block_size, pos,
+                              heap[r], heap[min]))
+            min = r;
+        if (min == i)
+            return;
+        int tmp = heap[i];
+        heap[i] = heap[min];
+        heap[min] = tmp;
+        i = min;
+    }
+}
+
+/**
+ *  Merge Merges sorted parts of an array with a k-way merge. Only the rows of
+ *  the window are given, rows after it are not looked at.
+ *
+ * @param array The array containing the parts one after the other, each one
+ *              sorted following type and nulls.
+ * @param bounds The index in array of the first cell of each part,
+ *               bounds[count] is the number of cells in array.
+ * @param count The number of parts
+ * @param type An array of the columns types.
+ * @param nulls An array of the columns nulls policies.
+ * @param block_size the group size in the array
+ * @param ldown The rank of the first row of the window
+ * @param lup The rank of the last row of the window
+ * @param[out] rows The indexes in array of the rows of the window, in order
+ *
+ * @return The number of rows put in rows
+ */
+long long Merge(RedisModuleString **array, long long *bounds, int count,
+                char *type, char *nulls, int block_size, long long ldown,
+                long long lup, long long *rows) {
+    long long size = bounds[count];
+    if (size == 0 || count == 0)
+        return 0;
+
+    SortKey *keys = BuildKeys(array, type, NULL, block_size, size);
+    long long pos[count];
+    int heap[count];
+    int n = 0;
+    for (int s = 0; s < count; ++s) {
+        pos[s] = bounds[s];
+        if (pos[s] < bounds[s + 1])
+            heap[n++] = s;
+    }
+    for (int i = n / 2 - 1; i >= 0; --i)
+        SiftDown(array, keys, type, nulls, block_size, pos, heap, n, i);
+
+    long long retval = 0;
+    for (long long rank = 0; n > 0 && rank <= lup; ++rank) {
+        int s = heap[0];
+        if (rank >= ldown)
+            rows[retval++] = pos[s];
+        pos[s] += block_size;
+        if (pos[s] >= bounds[s + 1])
+            heap[0] = heap[--n];
+        SiftDown(array, keys, type, nulls, block_size, pos, heap, n, 0);
+    }
+    FreeKeys(keys, type, block_size, size);
+    return retval;
+}
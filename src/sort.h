@@ -33,8 +33,31 @@
 ** POSSIBILITY OF SUCH DAMAGE.
 */
 #include "redismodule.h"
+#include "strtable.h"
 
-void QuickSort(RedisModuleString **array, char *type, int block_size,
-                      int begin, int last, int ldown, int lup);
+/* A sort key is the value of a cell computed once before the sort, so that
+ * comparisons do not have to parse or transform strings again. Numeric cells
+ * are parsed, collated cells are replaced by a string to compare with
+ * memcmp, dictionary encoded cells by their code. For strings, prefix
+ * contains their first eight bytes in big endian order, so that most
+ * comparisons are a single integer comparison. */
+typedef struct _SortKey {
+    union {
+        long long num;
+        double fnum;
+        struct {
+            char *str;
+            size_t len;
+        } coll;
+    };
+    unsigned long long prefix;
+} SortKey;
+
+void QuickSort(RedisModuleString **array, char *type, char *nulls,
+               StrTable **dicts, int block_size, long long begin,
+               long long last, long long ldown, long long lup);
+long long Merge(RedisModuleString **array, long long *bounds, int count,
+                char *type, char *nulls, int block_size, long long ldown,
+                long long lup, long long *rows);
 
 #endif /*__SORT_H__*/
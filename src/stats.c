@@ -0,0 +1,429 @@
+/*
+** BSD 3-Clause License
+**
+** Copyright (c) 2018, David Boucher
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**
+** * Redistributions of source code must retain the above copyright notice,
+**   this list of conditions and the following disclaimer.
+**
+** * Redistributions in binary form must reproduce the above copyright notice,
+**   this list of conditions and the following disclaimer in the documentation
+**   and/or other materials provided with the distribution.
+**
+** * Neither the name of the copyright holder nor the names of its
+**   contributors may be used to endorse or promote products derived from
+**   this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+** LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+** CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+** SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+** INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+** CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+** ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+** POSSIBILITY OF SUCH DAMAGE.
+*/
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "filter.h"
+#include "stats.h"
+
+/* The statistics, the most recently used first */
+static FieldStats *stats_list = NULL;
+static FieldStats *stats_last = NULL;
+static int stats_count = 0;
+
+/* The number of keyspace changes, the statistics of a field are sampled
+ * again when enough changes happened since their sample */
+static long long changes = 0;
+
+/* A sampled value with its number, used to sort the sample */
+typedef struct _StatsValue StatsValue;
+struct _StatsValue {
+    RedisModuleString *str;
+    double num;
+};
+
+static int CmpNumbers(const void *a, const void *b) {
+    double da = ((const StatsValue *)a)->num;
+    double db = ((const StatsValue *)b)->num;
+    return da < db ? -1 : da > db;
+}
+
+/**
+ *  CmpStrings Compares two strings, bytes then lengths
+ */
+static int CmpStrings(RedisModuleString *a, RedisModuleString *b) {
+    size_t la, lb;
+    const char *sa = RedisModule_StringPtrLen(a, &la);
+    const char *sb = RedisModule_StringPtrLen(b, &lb);
+    int cmp = memcmp(sa, sb, la < lb ? la : lb);
+    if (cmp)
+        return cmp;
+    return la < lb ? -1 : la > lb;
+}
+
+static int CmpValues(const void *a, const void *b) {
+    return CmpStrings(((const StatsValue *)a)->str, ((const StatsValue *)b)->str);
+}
+
+/**
+ *  FreeStats Frees the sample of statistics, and the statistics if all is
+ *  set.
+ */
+static void FreeStats(RedisModuleCtx *ctx, FieldStats *stats, int all) {
+    for (int i = 0; i < stats->values_count; ++i)
+        RedisModule_FreeString(ctx, stats->values[i]);
+    RedisModule_Free(stats->values);
+    stats->values = NULL;
+    stats->values_count = 0;
+    if (all) {
+        RedisModule_Free(stats->set);
+        RedisModule_Free(stats->field);
+        RedisModule_Free(stats);
+    }
+}
+
+/**
+ *  Summarize Computes the statistics of a sorted sample. The distinct values
+ *  are estimated with the GEE estimator, the values seen once in the sample
+ *  standing for sqrt(rows / sample) values each.
+ *
+ * @param stats The statistics, with their sorted values
+ */
+static void Summarize(FieldStats *stats) {
+    long long f1 = 0, repeated = 0;
+    stats->mcv_count = 0;
+    for (int i = 0; i < stats->values_count;) {
+        int j = i + 1;
+        while (j < stats->values_count
+               && CmpStrings(stats->values[i], stats->values[j]) == 0)
+            j++;
+        int freq = j - i;
+        if (freq == 1)
+            f1++;
+        else {
+            repeated++;
+            /* The most common values are kept by decreasing frequency */
+            int k = stats->mcv_count < STATS_MCV ? stats->mcv_count++ : STATS_MCV;
+            while (k > 0 && stats->mcv_freq[k - 1] < freq) {
+                if (k < STATS_MCV) {
+                    stats->mcv[k] = stats->mcv[k - 1];
+                    stats->mcv_freq[k] = stats->mcv_freq[k - 1];
+                }
+                k--;
+            }
+            if (k < STATS_MCV) {
+                stats->mcv[k] = i;
+                stats->mcv_freq[k] = freq;
+            }
+        }
+        i = j;
+    }
+
+    if (stats->sample == 0) {
+        stats->nulls = 0;
+        stats->distinct = 0;
+        return;
+    }
+    double scale = (double)stats->rows / stats->sample;
+    stats->nulls = llround(stats->sample_nulls * scale);
+    long long present = stats->rows - stats->nulls;
+    stats->distinct = llround(sqrt(scale) * f1) + repeated;
+    if (stats->distinct > present)
+        stats->distinct = present;
+}
+
+/**
+ *  Sample Reads the field of a random sample of the set rows and computes
+ *  the statistics.
+ *
+ * @param ctx The Redis context
+ * @param stats The statistics
+ * @param set The set
+ * @param field The field
+ */
+static void Sample(RedisModuleCtx *ctx, FieldStats *stats,
+                   RedisModuleString *set, RedisModuleString *field) {
+    FreeStats(ctx, stats, 0);
+    RedisModuleCallReply *reply = RedisModule_Call(ctx, "SCARD", "s", set);
+    stats->rows = RedisModule_CallReplyType(reply) == REDISMODULE_REPLY_INTEGER
+                  ? RedisModule_CallReplyInteger(reply) : 0;
+    RedisModule_FreeCallReply(reply);
+
+    reply = RedisModule_Call(ctx, "SRANDMEMBER", "sl", set, (long long)STATS_SAMPLE);
+    size_t n = 0;
+    if (RedisModule_CallReplyType(reply) == REDISMODULE_REPLY_ARRAY)
+        n = RedisModule_CallReplyLength(reply);
+    StatsValue *values = RedisModule_Alloc((n ? n : 1) * sizeof(StatsValue));
+    int count = 0;
+    int numeric = 1;
+    for (size_t i = 0; i < n; ++i) {
+        RedisModuleString *row = RedisModule_CreateStringFromCallReply(
+                RedisModule_CallReplyArrayElement(reply, i));
+        RedisModuleKey *key = RedisModule_OpenKey(ctx, row, REDISMODULE_READ);
+        RedisModuleString *value = NULL;
+        if (key && RedisModule_KeyType(key) == REDISMODULE_KEYTYPE_HASH)
+            RedisModule_HashGet(key, REDISMODULE_HASH_NONE, field, &value, NULL);
+        if (key)
+            RedisModule_CloseKey(key);
+        RedisModule_FreeString(ctx, row);
+        if (!value)
+            continue;
+        values[count].str = value;
+        if (numeric && RedisModule_StringToDouble(value, &values[count].num)
+                       == REDISMODULE_ERR)
+            numeric = 0;
+        count++;
+    }
+    if (reply)
+        RedisModule_FreeCallReply(reply);
+
+    /* Equal values must be adjacent, numbers are also sorted as strings
+     * when their writings differ, as 1 and 1.0 */
+    qsort(values, count, sizeof(StatsValue), numeric ? CmpNumbers : CmpValues);
+    for (int i = 0; numeric && i + 1 < count; ++i) {
+        if (values[i].num == values[i + 1].num
+            && CmpStrings(values[i].str, values[i + 1].str))
+            numeric = 0;
+    }
+    if (!numeric)
+        qsort(values, count, sizeof(StatsValue), CmpValues);
+
+    stats->sample = n;
+    stats->sample_nulls = n - count;
+    stats->numeric = numeric;
+    stats->values = RedisModule_Alloc((count ? count : 1) * sizeof(RedisModuleString *));
+    for (int i = 0; i < count; ++i)
+        stats->values[i] = values[i].str;
+    stats->values_count = count;
+    RedisModule_Free(values);
+    Summarize(stats);
+    stats->changes = changes;
+}
+
+/**
+ *  StatsGet Gives the statistics of a field over the rows of a set of the
+ *  current database. They are sampled if unknown, or if the database changed
+ *  enough since their sample. Only the STATS_MAX most recently used ones
+ *  are kept.
+ *
+ * @param ctx The Redis context
+ * @param set The set
+ * @param field The field
+ *
+ * @return The statistics, valid until the next call
+ */
+FieldStats *StatsGet(RedisModuleCtx *ctx, RedisModuleString *set,
+                     RedisModuleString *field) {
+    int db = RedisModule_GetSelectedDb(ctx);
+    size_t slen, flen;
+    const char *s = RedisModule_StringPtrLen(set, &slen);
+    const char *f = RedisModule_StringPtrLen(field, &flen);
+    FieldStats *stats = stats_list;
+    while (stats && (stats->db != db || stats->set_len != slen
+                     || stats->field_len != flen
+                     || memcmp(stats->set, s, slen)
+                     || memcmp(stats->field, f, flen)))
+        stats = stats->next;
+
+    if (stats) {
+        /* Moved at the head of the list */
+        if (stats->prev) {
+            stats->prev->next = stats->next;
+            if (stats->next)
+                stats->next->prev = stats->prev;
+            else
+                stats_last = stats->prev;
+            stats->prev = NULL;
+            stats->next = stats_list;
+            stats_list->prev = stats;
+            stats_list = stats;
+        }
+        if (changes - stats->changes
+            > STATS_MIN_CHANGES + STATS_CHANGE_RATIO * stats->rows)
+            Sample(ctx, stats, set, field);
+        return stats;
+    }
+
+    stats = RedisModule_Calloc(1, sizeof(FieldStats));
+    stats->db = db;
+    stats->set = RedisModule_Alloc(slen);
+    memcpy(stats->set, s, slen);
+    stats->set_len = slen;
+    stats->field = RedisModule_Alloc(flen);
+    memcpy(stats->field, f, flen);
+    stats->field_len = flen;
+    stats->next = stats_list;
+    if (stats_list)
+        stats_list->prev = stats;
+    else
+        stats_last = stats;
+    stats_list = stats;
+    if (++stats_count > STATS_MAX) {
+        FieldStats *last = stats_last;
+        stats_last = last->prev;
+        stats_last->next = NULL;
+        FreeStats(ctx, last, 1);
+        stats_count--;
+    }
+    Sample(ctx, stats, set, field);
+    return stats;
+}
+
+/**
+ *  StatsSelectivity Estimates the fraction of the rows of a set satisfying
+ *  the filter of a column.
+ *
+ *  - MATCH is evaluated on the distinct sampled values.
+ *  - EQUAL gives the frequency of a most common value. Other values share
+ *    the rows left by the most common ones, unless the whole set has been
+ *    sampled.
+ *  - IN counts each member of the searched set as a distinct value.
+ *
+ * @param ctx The Redis context
+ * @param set The set
+ * @param column The column description, with its filter
+ *
+ * @return The estimated fraction, 1 if the set is empty
+ */
+double StatsSelectivity(RedisModuleCtx *ctx, RedisModuleString *set,
+                        TabularHeader *column) {
+    FieldStats *stats = StatsGet(ctx, set, column->field);
+    if (stats->sample == 0 || column->tool == TABULAR_NONE)
+        return 1;
+
+    double retval = 0;
+    double present = 1 - (double)stats->sample_nulls / stats->sample;
+    if (column->tool == TABULAR_MATCH) {
+        long long matched = 0;
+        for (int i = 0; i < stats->values_count;) {
+            int j = i + 1;
+            while (j < stats->values_count
+                   && CmpStrings(stats->values[i], stats->values[j]) == 0)
+                j++;
+            if (FilterMatch(ctx, column, stats->values[i]))
+                matched += j - i;
+            i = j;
+        }
+        if (FilterMatch(ctx, column, NULL))
+            matched += stats->sample_nulls;
+        retval = (double)matched / stats->sample;
+    }
+    else if (column->tool == TABULAR_EQUAL) {
+        size_t len = strlen(column->search);
+        int freq = 0;
+        for (int i = 0; i < stats->values_count; ++i) {
+            size_t vlen;
+            const char *v = RedisModule_StringPtrLen(stats->values[i], &vlen);
+            if (vlen == len && memcmp(v, column->search, len) == 0)
+                freq++;
+        }
+        double common = 0;
+        for (int i = 0; i < stats->mcv_count; ++i)
+            common += stats->mcv_freq[i];
+        if (freq > 1 || stats->sample >= stats->rows)
+            retval = (double)freq / stats->sample;
+        else if (stats->distinct > stats->mcv_count)
+            retval = (present - common / stats->sample)
+                     / (stats->distinct - stats->mcv_count);
+    }
+    else if (column->tool == TABULAR_IN) {
+        RedisModuleCallReply *reply = RedisModule_Call(
+                ctx, "SCARD", "c", column->search);
+        long long card = RedisModule_CallReplyType(reply) == REDISMODULE_REPLY_INTEGER
+                         ? RedisModule_CallReplyInteger(reply) : 0;
+        RedisModule_FreeCallReply(reply);
+        if (stats->distinct > 0)
+            retval = present * card / stats->distinct;
+    }
+    return retval < 0 ? 0 : retval > 1 ? 1 : retval;
+}
+
+/**
+ *  StatsEstimate Estimates the selectivity of the filters of a query, so
+ *  that the most selective ones are applied first. Nothing is estimated
+ *  with less than two filters or STATS_MIN_ROWS rows.
+ *
+ * @param ctx The Redis context
+ * @param set The set
+ * @param header The columns description
+ * @param columns The number of columns in header
+ * @param count The number of rows to filter
+ *
+ * @return 1 if the selectivities have been estimated, 0 otherwise.
+ */
+int StatsEstimate(RedisModuleCtx *ctx, RedisModuleString *set,
+                  TabularHeader *header, int columns, long long count) {
+    int filters = 0;
+    for (int j = 0; j < columns; ++j) {
+        if (header[j].tool != TABULAR_NONE)
+            filters++;
+    }
+    if (filters < 2 || count < STATS_MIN_ROWS)
+        return 0;
+
+    for (int j = 0; j < columns; ++j) {
+        if (header[j].tool != TABULAR_NONE)
+            header[j].selectivity = StatsSelectivity(ctx, set, &header[j]);
+    }
+    return 1;
+}
+
+/**
+ *  StatsReply Replies with statistics, as an array of names and values: the
+ *  rows count, the sample size, the estimated missing and distinct values,
+ *  the most common values each followed by its estimated count and the
+ *  bounds of an equi-depth histogram of the sampled values.
+ *
+ * @param ctx The Redis context
+ * @param stats The statistics
+ */
+void StatsReply(RedisModuleCtx *ctx, FieldStats *stats) {
+    RedisModule_ReplyWithArray(ctx, 12);
+    RedisModule_ReplyWithSimpleString(ctx, "rows");
+    RedisModule_ReplyWithLongLong(ctx, stats->rows);
+    RedisModule_ReplyWithSimpleString(ctx, "sample");
+    RedisModule_ReplyWithLongLong(ctx, stats->sample);
+    RedisModule_ReplyWithSimpleString(ctx, "nulls");
+    RedisModule_ReplyWithLongLong(ctx, stats->nulls);
+    RedisModule_ReplyWithSimpleString(ctx, "distinct");
+    RedisModule_ReplyWithLongLong(ctx, stats->distinct);
+
+    RedisModule_ReplyWithSimpleString(ctx, "mcv");
+    RedisModule_ReplyWithArray(ctx, 2 * stats->mcv_count);
+    for (int i = 0; i < stats->mcv_count; ++i) {
+        RedisModule_ReplyWithString(ctx, stats->values[stats->mcv[i]]);
+        RedisModule_ReplyWithLongLong(
+                ctx, llround((double)stats->mcv_freq[i] * stats->rows / stats->sample));
+    }
+
+    RedisModule_ReplyWithSimpleString(ctx, "histogram");
+    int buckets = stats->values_count < STATS_BUCKETS
+                  ? stats->values_count : STATS_BUCKETS;
+    RedisModule_ReplyWithArray(ctx, buckets ? buckets + 1 : 0);
+    for (int i = 0; buckets && i <= buckets; ++i) {
+        long long idx = (long long)i * (stats->values_count - 1) / buckets;
+        RedisModule_ReplyWithString(ctx, stats->values[idx]);
+    }
+}
+
+/**
+ *  StatsNotify The keyspace notifications callback counting the changes, so
+ *  that statistics are sampled again after enough of them.
+ *
+ * @return REDISMODULE_OK
+ */
+int StatsNotify(RedisModuleCtx *ctx, int type, const char *event,
+                RedisModuleString *key) {
+    changes++;
+    return REDISMODULE_OK;
+}
@@ -0,0 +1,96 @@
+#ifndef __STATS_H__
+#define __STATS_H__
+/*
+** BSD 3-Clause License
+**
+** Copyright (c) 2018, David Boucher
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**
+** * Redistributions of source code must retain the above copyright notice,
+**   this list of conditions and the following disclaimer.
+**
+** * Redistributions in binary form must reproduce the above copyright notice,
+**   this list of conditions and the following disclaimer in the documentation
+**   and/or other materials provided with the distribution.
+**
+** * Neither the name of the copyright holder nor the names of its
+**   contributors may be used to endorse or promote products derived from
+**   this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+** LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+** CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+** SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+** INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+** CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+** ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+** POSSIBILITY OF SUCH DAMAGE.
+*/
+#include "redismodule.h"
+#include "tabular.h"
+
+/* The number of rows sampled to compute the statistics of a field */
+#define STATS_SAMPLE 1000
+
+/* Below this number of rows to filter, filters are applied in the order of
+ * the command, sampling would cost as much as filtering */
+#define STATS_MIN_ROWS 10000
+
+/* The number of most common values and of histogram buckets */
+#define STATS_MCV 8
+#define STATS_BUCKETS 10
+
+/* The number of fields whose statistics are kept */
+#define STATS_MAX 64
+
+/* Statistics are sampled again after 50 changes plus 10% of the rows */
+#define STATS_MIN_CHANGES 50
+#define STATS_CHANGE_RATIO 0.1
+
+/* Statistics of a field over the rows of a set, computed from a sample */
+typedef struct _FieldStats FieldStats;
+struct _FieldStats {
+    int db;
+    char *set;
+    size_t set_len;
+    char *field;
+    size_t field_len;
+    /* The set card, and estimations of the rows without the field and of the
+     * distinct values */
+    long long rows;
+    long long nulls;
+    long long distinct;
+    /* The sampled rows, their values sorted without the missing ones */
+    int sample;
+    int sample_nulls;
+    RedisModuleString **values;
+    int values_count;
+    int numeric;
+    /* The most common values, as indexes in values, with their sample
+     * frequencies */
+    int mcv[STATS_MCV];
+    int mcv_freq[STATS_MCV];
+    int mcv_count;
+    /* The changes counter when the sample was taken */
+    long long changes;
+    FieldStats *prev;
+    FieldStats *next;
+};
+
+FieldStats *StatsGet(RedisModuleCtx *ctx, RedisModuleString *set,
+                     RedisModuleString *field);
+double StatsSelectivity(RedisModuleCtx *ctx, RedisModuleString *set,
+                        TabularHeader *column);
+int StatsEstimate(RedisModuleCtx *ctx, RedisModuleString *set,
+                  TabularHeader *header, int columns, long long count);
+void StatsReply(RedisModuleCtx *ctx, FieldStats *stats);
+int StatsNotify(RedisModuleCtx *ctx, int type, const char *event,
+                RedisModuleString *key);
+
+#endif /*__STATS_H__*/
@@ -0,0 +1,175 @@
+/*
+** BSD 3-Clause License
+**
+** Copyright (c) 2018, David Boucher
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**
+** * Redistributions of source code must retain the above copyright notice,
+**   this list of conditions and the following disclaimer.
+**
+** * Redistributions in binary form must reproduce the above copyright notice,
+**   this list of conditions and the following disclaimer in the documentation
+**   and/or other materials provided with the distribution.
+**
+** * Neither the name of the copyright holder nor the names of its
+**   contributors may be used to endorse or promote products derived from
+**   this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+** LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+** CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+** SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+** INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+** CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+** ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+** POSSIBILITY OF SUCH DAMAGE.
+*/
+#include <string.h>
+#include "redismodule.h"
+#include "strtable.h"
+
+/**
+ *  Hash The FNV-1a hash of a string
+ *
+ * @param str The string
+ * @param len Its length
+ *
+ * @return The hash value
+ */
+static size_t Hash(const char *str, size_t len) {
+    unsigned long long h = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; ++i) {
+        h ^= (unsigned char)str[i];
+        h *= 1099511628211ULL;
+    }
+    return (size_t)h;
+}
+
+/**
+ *  Slot Looks for a string in the table
+ *
+ * @param table The table
+ * @param str The string to look for
+ * @param len The string length
+ *
+ * @return The entry containing the string if found, otherwise the free entry
+ *         where it can be inserted, its str is then NULL.
+ */
+static StrEntry *Slot(StrTable *table, const char *str, size_t len) {
+    size_t idx = Hash(str, len) & table->mask;
+    for (;;) {
+        StrEntry *e = &table->entries[idx];
+        if (e->str == NULL
+            || (e->len == len && memcmp(e->str, str, len) == 0))
+            return e;
+        idx = (idx + 1) & table->mask;
+    }
+}
+
+/**
+ *  StrTableInit Allocates an empty table. It grows when needed, size is
+ *  just a hint to avoid rehashing.
+ *
+ * @param table The table to initialize
+ * @param size The expected number of strings
+ */
+void StrTableInit(StrTable *table, size_t size) {
+    size_t capacity = 16;
+    while (capacity < 2 * size)
+        capacity <<= 1;
+    table->entries = RedisModule_Calloc(capacity, sizeof(StrEntry));
+    table->mask = capacity - 1;
+    table->used = 0;
+}
+
+/**
+ *  StrTableFind Looks for a string in the table
+ *
+ * @param table The table
+ * @param str The string to look for
+ * @param len The string length
+ *
+ * @return The entry containing the string or NULL if not found.
+ */
+StrEntry *StrTableFind(StrTable *table, const char *str, size_t len) {
+    StrEntry *e = Slot(table, str, len);
+    return e->str ? e : NULL;
+}
+
+/**
+ *  StrTableAdd Adds a string to the table if not already there
+ *
+ * @param table The table
+ * @param str The string to add
+ * @param len The string length
+ *
+ * @return The entry containing the string, a new entry has a value of 0 and
+ *         a NULL ptr. The entry is valid until the next table change.
+ */
+StrEntry *StrTableAdd(StrTable *table, const char *str, size_t len) {
+    StrEntry *e = Slot(table, str, len);
+    if (e->str)
+        return e;
+
+    /* The load factor is kept under 1/2 */
+    if (2 * (table->used + 1) > table->mask + 1) {
+        StrEntry *old = table->entries;
+        size_t capacity = table->mask + 1;
+        table->entries = RedisModule_Calloc(2 * capacity, sizeof(StrEntry));
+        table->mask = 2 * capacity - 1;
+        for (size_t i = 0; i < capacity; ++i) {
+            if (old[i].str)
+                *Slot(table, old[i].str, old[i].len) = old[i];
+        }
+        RedisModule_Free(old);
+        e = Slot(table, str, len);
+    }
+    e->str = str;
+    e->len = len;
+    e->value = 0;
+    e->ptr = NULL;
+    table->used++;
+    return e;
+}
+
+/**
+ *  StrTableDel Removes an entry from the table. Following entries of the
+ *  same cluster are shifted back, so that no tombstone is needed.
+ *
+ * @param table The table
+ * @param entry The entry to remove, as returned by StrTableFind
+ */
+void StrTableDel(StrTable *table, StrEntry *entry) {
+    size_t i = entry - table->entries;
+    size_t j = i;
+    for (;;) {
+        j = (j + 1) & table->mask;
+        StrEntry *e = &table->entries[j];
+        if (e->str == NULL)
+            break;
+        /* e can fill the hole at i only if its home slot is not in (i, j] */
+        size_t home = Hash(e->str, e->len) & table->mask;
+        if (i <= j ? (i < home && home <= j) : (i < home || home <= j))
+            continue;
+        table->entries[i] = *e;
+        i = j;
+    }
+    table->entries[i].str = NULL;
+    table->used--;
+}
+
+/**
+ *  StrTableFree Frees the table content
+ *
+ * @param table The table
+ */
+void StrTableFree(StrTable *table) {
+    RedisModule_Free(table->entries);
+    table->entries = NULL;
+}
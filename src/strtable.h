@@ -0,0 +1,61 @@
+#ifndef __STRTABLE_H__
+#define __STRTABLE_H__
+/*
+** BSD 3-Clause License
+**
+** Copyright (c) 2018, David Boucher
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**
+** * Redistributions of source code must retain the above copyright notice,
+**   this list of conditions and the following disclaimer.
+**
+** * Redistributions in binary form must reproduce the above copyright notice,
+**   this list of conditions and the following disclaimer in the documentation
+**   and/or other materials provided with the distribution.
+**
+** * Neither the name of the copyright holder nor the names of its
+**   contributors may be used to endorse or promote products derived from
+**   this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+** LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+** CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+** SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+** INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+** CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+** ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+** POSSIBILITY OF SUCH DAMAGE.
+*/
+#include <stddef.h>
+
+/* An entry of a string table. Strings are not copied, they must live as long
+ * as the table. */
+typedef struct _StrEntry StrEntry;
+struct _StrEntry {
+    const char *str;
+    size_t len;
+    long long value;
+    void *ptr;
+};
+
+/* A hash table of strings with open addressing */
+typedef struct _StrTable StrTable;
+struct _StrTable {
+    StrEntry *entries;
+    size_t mask;
+    size_t used;
+};
+
+void StrTableInit(StrTable *table, size_t size);
+StrEntry *StrTableFind(StrTable *table, const char *str, size_t len);
+StrEntry *StrTableAdd(StrTable *table, const char *str, size_t len);
+void StrTableDel(StrTable *table, StrEntry *entry);
+void StrTableFree(StrTable *table);
+
+#endif /*__STRTABLE_H__*/
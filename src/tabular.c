@@ -41,7 +41,8 @@
  * @param i The index of the first element
  * @param j The index of the second element
  */
-void Swap(RedisModuleString **array, int block_size, int i, int j) {
+void Swap(RedisModuleString **array, int block_size, long long i,
+          long long j) {
     for (int k = 0; k < block_size; ++k) {
         RedisModuleString *tmp = array[i + k];
         array[i + k] = array[j + k];
@@ -49,6 +50,34 @@ void Swap(RedisModuleString **array, int block_size, int i, int j) {
     }
 }
 
+/**
+ *  ArraySize Computes the number of cells of an array of rows
+ *
+ * @param rows The number of rows
+ * @param block_size The number of columns
+ * @param[out] size The number of cells
+ *
+ * @return REDISMODULE_OK or REDISMODULE_ERR if the array would have more than
+ *         TABULAR_MAX_CELLS cells.
+ */
+int ArraySize(long long rows, int block_size, long long *size) {
+    if (rows < 0 || block_size <= 0 || rows > TABULAR_MAX_CELLS / block_size)
+        return REDISMODULE_ERR;
+    *size = rows * block_size;
+    return REDISMODULE_OK;
+}
+
+/**
+ *  IsKeyField Tells if a field is the TABULAR_KEY_FIELD pseudo-field, whose
+ *  value is the row key. It is never read in the row hash.
+ */
+int IsKeyField(RedisModuleString *field) {
+    size_t len;
+    const char *str = RedisModule_StringPtrLen(field, &len);
+    return len == strlen(TABULAR_KEY_FIELD)
+           && memcmp(str, TABULAR_KEY_FIELD, len) == 0;
+}
+
 /**
  *  SwapHeaders A function to exchange columns in the header
  *
@@ -62,6 +91,29 @@ static void SwapHeaders(TabularHeader *a, TabularHeader *b) {
     memcpy(b, &tmp, sizeof(TabularHeader));
 }
 
+/**
+ *  AddColumn Adds a column to the header if not already there. A new column
+ *  is neither sorted nor filtered.
+ *
+ * @param header The header
+ * @param[in,out] size The header size
+ * @param field The column field
+ */
+static void AddColumn(TabularHeader *header, int *size, RedisModuleString *field) {
+    int i = 0;
+    while (i < *size && RedisModule_StringCompare(field, header[i].field))
+        i++;
+    if (i == *size) {
+        (*size)++;
+        header[i].field = field;
+        header[i].type = 0;
+        header[i].nulls = 0;
+        header[i].tool = TABULAR_NONE;
+        header[i].search = NULL;
+        header[i].selectivity = 1;
+    }
+}
+
 /**
  *  ParseArgv A function to parse the argv array from the fourth element.
  *
@@ -70,16 +122,24 @@ static void SwapHeaders(TabularHeader *a, TabularHeader *b) {
  * @param[out] size The resulting block size
  * @param[out] key_store If the keyword 'STORE' is used, key_store will contain
  *                          the key where the result will be stored.
+ * @param[out] options Other options found in argv, it can be NULL if flag
+ *                     does not ask for them.
  * @param flag An union of flags to specify what category to parse
  *
  * @return The array header
  */
 TabularHeader *ParseArgv(RedisModuleString **argv, int argc, int *size,
-                         RedisModuleString **key_store, int flag) {
+                         RedisModuleString **key_store,
+                         TabularOptions *options, int flag) {
     size_t len;
     int idx = 0;
-    TabularHeader *retval = RedisModule_Alloc(argc / 2 * sizeof (TabularHeader));
+    /* Each column takes at least one argument, FACETS fields may take only
+     * one */
+    TabularHeader *retval = RedisModule_Alloc((argc ? argc : 1)
+                                              * sizeof (TabularHeader));
     *size = 0;
+    if (options)
+        memset(options, 0, sizeof(TabularOptions));
     TabularHeader *tmp = retval;
     while (idx < argc) {
         const char *a = RedisModule_StringPtrLen(argv[idx], &len);
@@ -95,6 +155,163 @@ TabularHeader *ParseArgv(RedisModuleString **argv, int argc, int *size,
                 return NULL;
             }
         }
+        else if ((flag & TABULAR_WITHFIELDS)
+                 && strncasecmp(a, "WITHFIELDS", len) == 0) {
+            long long count;
+            idx++;
+            if (idx >= argc
+                || RedisModule_StringToLongLong(argv[idx], &count) == REDISMODULE_ERR
+                || count <= 0 || count > argc - idx - 1) {
+                RedisModule_Free(retval);
+                return NULL;
+            }
+            idx++;
+            options->with_fields = argv + idx;
+            options->with_fields_count = count;
+            idx += count;
+        }
+        else if ((flag & TABULAR_SETS)
+                 && (strcasecmp(a, "UNION") == 0 || strcasecmp(a, "INTER") == 0
+                     || strcasecmp(a, "DIFF") == 0)) {
+            long long count;
+            if (options->set_op != TABULAR_SET_NONE) {
+                RedisModule_Free(retval);
+                return NULL;
+            }
+            if (strcasecmp(a, "UNION") == 0)
+                options->set_op = TABULAR_UNION;
+            else if (strcasecmp(a, "INTER") == 0)
+                options->set_op = TABULAR_INTER;
+            else
+                options->set_op = TABULAR_DIFF;
+            idx++;
+            if (idx >= argc
+                || RedisModule_StringToLongLong(argv[idx], &count) == REDISMODULE_ERR
+                || count <= 0 || count > argc - idx - 1) {
+                RedisModule_Free(retval);
+                return NULL;
+            }
+            idx++;
+            options->sets = argv + idx;
+            options->sets_count = count;
+            idx += count;
+        }
+        else if ((flag & TABULAR_SOURCES)
+                 && strncasecmp(a, "SOURCES", len) == 0) {
+            long long count;
+            idx++;
+            if (idx >= argc
+                || RedisModule_StringToLongLong(argv[idx], &count) == REDISMODULE_ERR
+                || count <= 0 || count > argc - idx - 1) {
+                RedisModule_Free(retval);
+                return NULL;
+            }
+            idx++;
+            options->sources = argv + idx;
+            options->sources_count = count;
+            idx += count;
+        }
+        else if ((flag & TABULAR_SINCE) && strncasecmp(a, "SINCE", len) == 0) {
+            options->since = argv + idx;
+            idx++;
+            if (idx >= argc
+                || RedisModule_StringToLongLong(argv[idx], &options->since_token) == REDISMODULE_ERR
+                || options->since_token < 0) {
+                RedisModule_Free(retval);
+                return NULL;
+            }
+            idx++;
+        }
+        else if ((flag & TABULAR_APPROX) && strncasecmp(a, "NOCOUNT", len) == 0) {
+            options->nocount = 1;
+            idx++;
+        }
+        else if ((flag & TABULAR_APPROX) && strncasecmp(a, "APPROX", len) == 0) {
+            options->approx = 1;
+            idx++;
+        }
+        else if ((flag & TABULAR_FORMAT) && strcasecmp(a, "FORMAT") == 0) {
+            idx++;
+            if (idx >= argc) {
+                RedisModule_Free(retval);
+                return NULL;
+            }
+            a = RedisModule_StringPtrLen(argv[idx], &len);
+            if (strcasecmp(a, "PACKED") == 0)
+                options->packed = 1;
+            else if (strcasecmp(a, "RESP") == 0)
+                options->packed = 0;
+            else {
+                RedisModule_Free(retval);
+                return NULL;
+            }
+            idx++;
+        }
+        else if ((flag & TABULAR_AGGREGATE)
+                 && strncasecmp(a, "AGGREGATE", len) == 0) {
+            long long count;
+            idx++;
+            if (idx >= argc
+                || RedisModule_StringToLongLong(argv[idx], &count) == REDISMODULE_ERR
+                || count <= 0 || count > (argc - idx - 1) / 2) {
+                RedisModule_Free(retval);
+                return NULL;
+            }
+            idx++;
+            options->aggregates = argv + idx;
+            options->aggregates_count = count;
+            while (count > 0) {
+                a = RedisModule_StringPtrLen(argv[idx], &len);
+                if (strcasecmp(a, "SUM") && strcasecmp(a, "MIN")
+                    && strcasecmp(a, "MAX") && strcasecmp(a, "AVG")
+                    && strcasecmp(a, "DISTINCT")) {
+                    RedisModule_Free(retval);
+                    return NULL;
+                }
+                idx++;
+                /* Aggregated fields are columns without filter */
+                AddColumn(retval, size, argv[idx]);
+                idx++;
+                count--;
+            }
+        }
+        else if ((flag & TABULAR_FACETS)
+                 && strncasecmp(a, "FACETS", len) == 0) {
+            long long count;
+            idx++;
+            if (idx >= argc
+                || RedisModule_StringToLongLong(argv[idx], &count) == REDISMODULE_ERR
+                || count <= 0 || count > argc - idx - 1) {
+                RedisModule_Free(retval);
+                return NULL;
+            }
+            idx++;
+            options->facets = argv + idx;
+            options->facets_count = count;
+            while (count > 0 && idx < argc) {
+                AddColumn(retval, size, argv[idx]);
+                idx++;
+                /* An optional LIMIT n can follow the field */
+                if (idx + 1 < argc) {
+                    long long limit;
+                    a = RedisModule_StringPtrLen(argv[idx], &len);
+                    if (strcasecmp(a, "LIMIT") == 0
+                        && RedisModule_StringToLongLong(argv[idx + 1], &limit) == REDISMODULE_OK) {
+                        if (limit < 0) {
+                            RedisModule_Free(retval);
+                            return NULL;
+                        }
+                        idx += 2;
+                    }
+                }
+                count--;
+            }
+            if (count > 0) {
+                RedisModule_Free(retval);
+                return NULL;
+            }
+            options->facets_argc = argv + idx - options->facets;
+        }
         else if ((flag & TABULAR_SORT) && strncasecmp(a, "SORT", len) == 0) {
             long long num;
             int row = 0;
@@ -122,6 +339,8 @@ TabularHeader *ParseArgv(RedisModuleString **argv, int argc, int *size,
                     tmp->field = argv[idx];
                     tmp->tool = TABULAR_NONE;
                     tmp->search = NULL;
+                    tmp->nulls = 0;
+                    tmp->selectivity = 1;
                 }
                 /* In the case of SORT coming after FILTER, the sort order can
                  * be perturbed by the filtered fields. Here we force the order
@@ -144,11 +363,39 @@ TabularHeader *ParseArgv(RedisModuleString **argv, int argc, int *size,
                     tmp->type = 'n';
                 else if (strncasecmp(a, "REVNUM", len) == 0)
                     tmp->type = 'N';
+                else if (strncasecmp(a, "FLOAT", len) == 0)
+                    tmp->type = 'f';
+                else if (strncasecmp(a, "REVFLOAT", len) == 0)
+                    tmp->type = 'F';
+                else if (strncasecmp(a, "IALPHA", len) == 0)
+                    tmp->type = 'i';
+                else if (strncasecmp(a, "REVIALPHA", len) == 0)
+                    tmp->type = 'I';
+                else if (strncasecmp(a, "COLLATE", len) == 0)
+                    tmp->type = 'c';
+                else if (strncasecmp(a, "REVCOLLATE", len) == 0)
+                    tmp->type = 'C';
                 else {
                     RedisModule_Free(retval);
                     return NULL;
                 }
                 idx++;
+                /* An optional NULLS {FIRST|LAST} can follow the type. If the
+                 * word after NULLS is not one of them, NULLS is a field name */
+                if (idx + 1 < argc) {
+                    a = RedisModule_StringPtrLen(argv[idx], &len);
+                    if (strcasecmp(a, "NULLS") == 0) {
+                        a = RedisModule_StringPtrLen(argv[idx + 1], &len);
+                        if (strcasecmp(a, "FIRST") == 0) {
+                            tmp->nulls = 'f';
+                            idx += 2;
+                        }
+                        else if (strcasecmp(a, "LAST") == 0) {
+                            tmp->nulls = 'l';
+                            idx += 2;
+                        }
+                    }
+                }
                 row++;
             }
             if (row < num) {
@@ -177,6 +424,8 @@ TabularHeader *ParseArgv(RedisModuleString **argv, int argc, int *size,
                     (*size)++;
                     tmp->field = argv[idx];
                     tmp->type = 0;
+                    tmp->nulls = 0;
+                    tmp->selectivity = 1;
                 }
                 idx++;
                 if (idx >= argc) {
@@ -32,12 +32,28 @@
 ** ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
 ** POSSIBILITY OF SUCH DAMAGE.
 */
+#include <limits.h>
 #include "redismodule.h"
 
+/* The maximum number of cells of an array of rows. Arrays parallel to it,
+ * as the sort keys, are still sized in bytes without overflow. */
+#define TABULAR_MAX_CELLS (LLONG_MAX / 64)
+
+/* The pseudo-field whose value is the row key itself */
+#define TABULAR_KEY_FIELD "@key"
+
 enum _TabularFilter {
   TABULAR_SORT = 1 << 0,
   TABULAR_STORE = 1 << 1,
   TABULAR_FILTER = 1 << 2,
+  TABULAR_WITHFIELDS = 1 << 3,
+  TABULAR_SETS = 1 << 4,
+  TABULAR_AGGREGATE = 1 << 5,
+  TABULAR_FACETS = 1 << 6,
+  TABULAR_SOURCES = 1 << 7,
+  TABULAR_SINCE = 1 << 8,
+  TABULAR_APPROX = 1 << 9,
+  TABULAR_FORMAT = 1 << 10,
 };
 
 enum _TabularTool {
@@ -49,17 +65,70 @@ enum _TabularTool {
 
 typedef enum _TabularTool TabularTool;
 
+enum _TabularSetOp {
+  TABULAR_SET_NONE,
+  TABULAR_UNION,
+  TABULAR_INTER,
+  TABULAR_DIFF,
+};
+
+typedef enum _TabularSetOp TabularSetOp;
+
 struct _TabularHeader {
     RedisModuleString *field;
     char type;
+    char nulls;
     const char *search;
     TabularTool tool;
+    /* The estimated fraction of rows satisfying the filter, 1 when unknown.
+     * Filters are applied from the most selective one */
+    double selectivity;
 };
 
 typedef struct _TabularHeader TabularHeader;
 
-void Swap(RedisModuleString **array, int block_size, int i, int j);
+/* Options given on the command line that do not concern columns */
+struct _TabularOptions {
+    /* Fields returned with each row, they point into argv */
+    RedisModuleString **with_fields;
+    int with_fields_count;
+    /* Sets combined with the main set, they point into argv */
+    TabularSetOp set_op;
+    RedisModuleString **sets;
+    int sets_count;
+    /* Aggregates computed by TABULAR.COUNT, they are pairs of an operation
+     * and a field pointing into argv */
+    RedisModuleString **aggregates;
+    int aggregates_count;
+    /* Facets computed by TABULAR.COUNT, each one is a field optionally
+     * followed by LIMIT and a number, they point into argv */
+    RedisModuleString **facets;
+    int facets_argc;
+    int facets_count;
+    /* Sorted results merged by TABULAR.MERGE, they point into argv */
+    RedisModuleString **sources;
+    int sources_count;
+    /* The SINCE keyword in argv followed by the token of the version the
+     * reply is relative to */
+    RedisModuleString **since;
+    long long since_token;
+    /* Without sort, the rows after the window are not counted with NOCOUNT,
+     * or their count is estimated from a sample with APPROX */
+    int nocount;
+    int approx;
+    /* With FORMAT PACKED, the reply is a single string in the packed
+     * layout */
+    int packed;
+};
+
+typedef struct _TabularOptions TabularOptions;
+
+void Swap(RedisModuleString **array, int block_size, long long i,
+          long long j);
+int ArraySize(long long rows, int block_size, long long *size);
+int IsKeyField(RedisModuleString *field);
 TabularHeader *ParseArgv(RedisModuleString **argv, int argc, int *size,
-                         RedisModuleString **key_store, int flag);
+                         RedisModuleString **key_store,
+                         TabularOptions *options, int flag);
 
 #endif /*__TABULAR_H__*/
@@ -2,6 +2,7 @@
 
 import re
 import random
+import struct
 import unittest
 from rmtest import ModuleTestCase
 
@@ -25,6 +26,34 @@ def le(array, t, i, j):
         j += 1
     return True
 
+def varint(data, pos):
+    value, shift = 0, 0
+    while True:
+        b = ord(data[pos])
+        pos += 1
+        value |= (b & 0x7f) << shift
+        shift += 7
+        if not b & 0x80:
+            return value, pos
+
+def unpack(data, pos=0):
+    tag = data[pos]
+    pos += 1
+    if tag == '*':
+        n, pos = varint(data, pos)
+        items = []
+        for _ in range(n):
+            item, pos = unpack(data, pos)
+            items.append(item)
+        return items, pos
+    if tag == ':':
+        z, pos = varint(data, pos)
+        return (z >> 1) ^ -(z & 1), pos
+    if tag == '$':
+        n, pos = varint(data, pos)
+        return data[pos:pos + n], pos + n
+    return None, pos
+
 class TestRedisTabular(ModuleTestCase('../build/redistabular.so')):
     def testParseArgvStore(self):
         with self.assertResponseError():
@@ -103,6 +132,17 @@ class TestRedisTabular(ModuleTestCase('../build/redistabular.so')):
         self.assertTrue(len(tab) == 29)
         self.assertTrue(tab[0] == 29)
 
+    def testGetWithLongCommonPrefixAlphaCol(self):
+        for i in range(1, 1000):
+            self.cmd('SADD', 'test', 's' + str(i))
+            self.cmd('HSET', 's' + str(i), 'value', 'LongDescription' + str(random.randint(0, 999)))
+        self.cmd('HSET', 's1', 'value', 'Long')
+        self.assertOk(self.cmd('tabular.get', 'test', 0, 1000, 'store', 'services_sort', 'SORT', 1, 'value', 'alpha'))
+        tab = self.cmd('sort', 'services_sort', 'by', 'nosort', 'get', '*->value')
+        self.assertEqual(tab[0], 'Long')
+        for i in range(0, len(tab) - 1):
+            self.assertTrue(tab[i] <= tab[i + 1]);
+
     def testGetWithASingleRevNumericalCol(self):
         for i in range(1, 1000):
             self.cmd('SADD', 'test', 's' + str(i))
@@ -112,6 +152,106 @@ class TestRedisTabular(ModuleTestCase('../build/redistabular.so')):
         for i in range(0, len(tab) - 1):
             self.assertTrue(int(tab[i]) >= int(tab[i + 1]));
 
+    def testGetWithASingleFloatCol(self):
+        for i in range(1, 1000):
+            self.cmd('SADD', 'test', 's' + str(i))
+            self.cmd('HSET', 's' + str(i), 'value', random.uniform(-1000, 1000))
+        self.cmd('HSET', 's1', 'value', '1e6')
+        self.assertOk(self.cmd('tabular.get', 'test', 0, 1000, 'store', 'services_sort', 'SORT', 1, 'value', 'float'))
+        tab = self.cmd('sort', 'services_sort', 'by', 'nosort', 'get', '*->value')
+        for i in range(0, len(tab) - 1):
+            self.assertTrue(float(tab[i]) <= float(tab[i + 1]));
+        self.assertEqual(tab[-1], '1e6')
+
+    def testGetWithASingleRevFloatCol(self):
+        for i in range(1, 1000):
+            self.cmd('SADD', 'test', 's' + str(i))
+            self.cmd('HSET', 's' + str(i), 'value', random.uniform(-1000, 1000))
+        self.assertOk(self.cmd('tabular.get', 'test', 0, 1000, 'store', 'services_sort', 'SORT', 1, 'value', 'revfloat'))
+        tab = self.cmd('sort', 'services_sort', 'by', 'nosort', 'get', '*->value')
+        for i in range(0, len(tab) - 1):
+            self.assertTrue(float(tab[i]) >= float(tab[i + 1]));
+
+    def testGetWithASingleIAlphaCol(self):
+        names = ['Zeta', 'alpha', 'Beta', 'gamma', 'DELTA', 'epsilon']
+        for i in range(0, len(names)):
+            self.cmd('SADD', 'test', 's' + str(i))
+            self.cmd('HSET', 's' + str(i), 'name', names[i])
+        self.assertOk(self.cmd('tabular.get', 'test', 0, 10, 'store', 'services_sort', 'SORT', 1, 'name', 'ialpha'))
+        tab = self.cmd('sort', 'services_sort', 'by', 'nosort', 'get', '*->name')
+        self.assertEqual(tab, sorted(names, key=lambda x: x.lower()))
+        self.assertOk(self.cmd('tabular.get', 'test', 0, 10, 'store', 'services_sort', 'SORT', 1, 'name', 'revialpha'))
+        tab = self.cmd('sort', 'services_sort', 'by', 'nosort', 'get', '*->name')
+        self.assertEqual(tab, sorted(names, key=lambda x: x.lower(), reverse=True))
+
+    def testGetWithASingleCollateCol(self):
+        # Values longer than 8 bytes sharing a prefix, the test server runs
+        # with the C locale where COLLATE compares bytes
+        values = {}
+        for i in range(1, 300):
+            v = 'Description-' + str(random.randint(0, 999))
+            self.cmd('SADD', 'test', 's' + str(i))
+            self.cmd('HSET', 's' + str(i), 'value', v)
+            values['s' + str(i)] = v
+        tab = self.cmd('tabular.get', 'test', 0, 300, 'SORT', 1, 'value', 'collate')
+        self.assertEqual(tab[0], 299)
+        self.assertEqual(tab[1:], sorted(values.keys(), key=lambda k: (values[k], k)))
+
+    def testSortNullsFirstAndLast(self):
+        for i in range(1, 30):
+            self.cmd('SADD', 'test', 's' + str(i))
+            if i % 3:
+                self.cmd('HSET', 's' + str(i), 'value', i - 15)
+            else:
+                self.cmd('HSET', 's' + str(i), 'other', i)
+        tab = self.cmd('tabular.get', 'test', 0, 30, 'SORT', 1, 'value', 'float', 'nulls', 'first')
+        self.assertEqual(tab[0], 29)
+        for i in range(1, 10):
+            self.assertEqual(self.cmd('hget', tab[i], 'value'), None)
+        tab = self.cmd('tabular.get', 'test', 0, 30, 'SORT', 1, 'value', 'revnum', 'nulls', 'last')
+        self.assertEqual(self.cmd('hget', tab[1], 'value'), '14')
+        for i in range(21, 30):
+            self.assertEqual(self.cmd('hget', tab[i], 'value'), None)
+
+    def testGetWithFields(self):
+        for i in range(1, 30):
+            self.cmd('SADD', 'test', 's' + str(i))
+            self.cmd('HMSET', 's' + str(i), 'value', i, 'name', 'Descr' + str(i))
+        tab = self.cmd('tabular.get', 'test', 0, 9, 'SORT', 1, 'value', 'num',
+                       'WITHFIELDS', 3, 'name', 'value', 'missing')
+        self.assertEqual(tab[0], 29)
+        self.assertEqual(len(tab), 11)
+        for i in range(1, 11):
+            self.assertEqual(tab[i], ['s' + str(i), 'Descr' + str(i), str(i), None])
+
+    def testGetWithFieldsBadArity(self):
+        with self.assertResponseError():
+            self.cmd('tabular.get', 'test', 0, 9, 'WITHFIELDS', 3, 'name')
+
+    def testGetWithSetAlgebra(self):
+        for i in range(1, 31):
+            self.cmd('HSET', 's' + str(i), 'value', i)
+            if i <= 20:
+                self.cmd('SADD', 'a', 's' + str(i))
+            if i > 10:
+                self.cmd('SADD', 'b', 's' + str(i))
+            if i % 2 == 0:
+                self.cmd('SADD', 'c', 's' + str(i))
+        tab = self.cmd('tabular.get', 'a', 0, 100, 'UNION', 1, 'b', 'SORT', 1, 'value', 'num')
+        self.assertEqual(tab, [30] + ['s' + str(i) for i in range(1, 31)])
+        tab = self.cmd('tabular.get', 'a', 0, 100, 'INTER', 2, 'b', 'c', 'SORT', 1, 'value', 'num')
+        self.assertEqual(tab, [5] + ['s' + str(i) for i in range(12, 21, 2)])
+        tab = self.cmd('tabular.get', 'a', 0, 100, 'DIFF', 2, 'b', 'c', 'SORT', 1, 'value', 'num')
+        self.assertEqual(tab, [5] + ['s' + str(i) for i in range(1, 10, 2)])
+        tab = self.cmd('tabular.get', 'a', 0, 100, 'INTER', 1, 'missing')
+        self.assertEqual(tab, [0])
+
+    def testGetWithSetAlgebraBadType(self):
+        self.cmd('SADD', 'a', 's1')
+        self.cmd('SET', 'b', 'foo')
+        with self.assertResponseError():
+            self.cmd('tabular.get', 'a', 0, 10, 'UNION', 1, 'b')
+
     def testFilterTwoColsFilterBadArity(self):
         for i in range(1, 1000):
             self.cmd('SADD', 'test', 's' + str(i))
@@ -166,6 +306,18 @@ class TestRedisTabular(ModuleTestCase('../build/redistabular.so')):
         for i in range(0, len(tab0)):
             self.assertEqual(tab0[i], '2')
 
+    def testFilterKeepsOrder(self):
+        for i in range(1, 300):
+            self.cmd('SADD', 'test', 's' + str(i))
+            self.cmd('HMSET', 's' + str(i), 'value', i, 'name', 'Descr' + str(i % 3))
+        expected = [k for k in self.cmd('SMEMBERS', 'test')
+                    if '1' in k and int(k[1:]) % 3 != 0]
+        tab = self.cmd('tabular.get', 'test', 0, 300, 'FILTER', 2, 'value', 'MATCH', '*1*',
+                       'name', 'MATCH', 'Descr[12]')
+        self.assertEqual(tab, [len(expected)] + expected)
+        self.assertEqual(self.cmd('tabular.filter', 'test', 'FILTER', 2, 'value', 'MATCH', '*1*',
+                                  'name', 'MATCH', 'Descr[12]'), expected)
+
     def testFilterIn(self):
         for i in range(1, 1001):
             name = 'Descr' + str(i)
@@ -262,6 +414,76 @@ class TestRedisTabular(ModuleTestCase('../build/redistabular.so')):
         tab = self.cmd('get', 'simple_count:count:1')
         self.assertEqual(tab, '150')
 
+    def testCountWithUnion(self):
+        for i in range(1, 301):
+            self.cmd('SADD', 'test' + str(i % 3), 's' + str(i))
+            self.cmd('HSET', 's' + str(i), 'value', i % 2)
+        tab = self.cmd('tabular.count', 'test0', 'UNION', 2, 'test1', 'test2', 'FILTER', 1, 'value', 'EQUAL', '1')
+        self.assertEqual(tab[3], 150L)
+
+    def testCountAggregate(self):
+        for i in range(1, 301):
+            self.cmd('SADD', 'test', 's' + str(i))
+            self.cmd('HMSET', 's' + str(i), 'value', i % 2, 'bytes', i, 'name', 'n' + str(i % 7))
+        tab = self.cmd('tabular.count', 'test', 'FILTER', 1, 'value', 'EQUAL', '1',
+                       'AGGREGATE', 5, 'SUM', 'bytes', 'MIN', 'bytes', 'MAX', 'bytes', 'AVG', 'bytes', 'DISTINCT', 'name')
+        self.assertEqual(tab[0:4], ['value', '1', 'count', 150L])
+        self.assertEqual(tab[4], 'sum(bytes)')
+        self.assertEqual(float(tab[5]), 22500.0)
+        self.assertEqual(tab[6], 'min(bytes)')
+        self.assertEqual(float(tab[7]), 1.0)
+        self.assertEqual(tab[8], 'max(bytes)')
+        self.assertEqual(float(tab[9]), 299.0)
+        self.assertEqual(tab[10], 'avg(bytes)')
+        self.assertEqual(float(tab[11]), 150.0)
+        self.assertEqual(tab[12], 'distinct(name)')
+        self.assertEqual(tab[13], 7L)
+        self.assertEqual(tab[14], 'children')
+
+    def testCountAggregateStore(self):
+        for i in range(1, 301):
+            self.cmd('SADD', 'test', 's' + str(i))
+            self.cmd('HMSET', 's' + str(i), 'value', i % 2, 'bytes', i)
+        self.assertOk(self.cmd('tabular.count', 'test', 'FILTER', 1, 'value', 'EQUAL', '1',
+                               'AGGREGATE', 1, 'SUM', 'bytes', 'STORE', 'agg'))
+        self.assertEqual(float(self.cmd('get', 'agg:sum:bytes:1')), 22500.0)
+
+    def testCountAggregateBadOp(self):
+        with self.assertResponseError():
+            self.cmd('tabular.count', 'test', 'FILTER', 1, 'value', 'EQUAL', '1', 'AGGREGATE', 1, 'FOO', 'bytes')
+
+    def testCountFacets(self):
+        self.cmd('sadd', 'rows', 'r:1', 'r:2', 'r:3', 'r:4',  'r:5')
+        self.cmd('hmset', 'r:1', 'status', '0', 'name', 'Mizar', 'location', 'Tours')
+        self.cmd('hmset', 'r:2', 'status', '0', 'name', 'Altair', 'location', 'Lyon')
+        self.cmd('hmset', 'r:3', 'status', '1', 'name', 'Arctarus', 'location', 'Agen')
+        self.cmd('hmset', 'r:4', 'status', '3', 'name', 'Vega', 'location', 'Bordeaux')
+        self.cmd('hmset', 'r:5', 'status', '4', 'name', 'Vega', 'location', 'Versailles')
+        tab = self.cmd('tabular.count', 'rows', 'FACETS', 3, 'status', 'LIMIT', 2, 'name', 'location')
+        self.assertEqual(tab[0], 'status')
+        self.assertEqual(tab[1], ['0', 2L, '1', 1L])
+        self.assertEqual(tab[2], 'name')
+        self.assertEqual(tab[3], ['Vega', 2L, 'Altair', 1L, 'Arctarus', 1L, 'Mizar', 1L])
+        self.assertEqual(tab[4], 'location')
+        self.assertEqual(len(tab[5]), 10)
+        tab = self.cmd('tabular.count', 'rows', 'FILTER', 1, 'name', 'EQUAL', 'Vega', 'FACETS', 1, 'status')
+        self.assertEqual(tab, ['status', ['3', 1L, '4', 1L]])
+        self.assertOk(self.cmd('tabular.count', 'rows', 'FACETS', 1, 'name', 'STORE', 'test'))
+        self.assertEqual(self.cmd('get', 'test:facet:name:Vega'), '2')
+
+    def testCountFacetsNoLimit(self):
+        self.cmd('sadd', 'rows', 'r:1', 'r:2', 'r:3', 'r:4',  'r:5')
+        self.cmd('hmset', 'r:1', 'status', '0', 'name', 'Mizar', 'location', 'Tours')
+        self.cmd('hmset', 'r:2', 'status', '0', 'name', 'Altair', 'location', 'Lyon')
+        self.cmd('hmset', 'r:3', 'status', '1', 'name', 'Arctarus', 'location', 'Agen')
+        self.cmd('hmset', 'r:4', 'status', '3', 'name', 'Vega', 'location', 'Bordeaux')
+        self.cmd('hmset', 'r:5', 'status', '4', 'name', 'Vega', 'location', 'Versailles')
+        tab = self.cmd('tabular.count', 'rows', 'FACETS', 3, 'status', 'name', 'location')
+        self.assertEqual(tab, ['status', ['0', 2L, '1', 1L, '3', 1L, '4', 1L],
+                               'name', ['Vega', 2L, 'Altair', 1L, 'Arctarus', 1L, 'Mizar', 1L],
+                               'location', ['Agen', 1L, 'Bordeaux', 1L, 'Lyon', 1L,
+                                            'Tours', 1L, 'Versailles', 1L]])
+
     def testCountMultiStore(self):
         for i in range(1, 301):
             self.cmd('SADD', 'test', 's' + str(i))
@@ -311,6 +533,17 @@ class TestRedisTabular(ModuleTestCase('../build/redistabular.so')):
             self.assertEqual(tab0[i], '2')
         self.assertEqual(len(tab0), nb)
 
+    def testFilterEqualNotPrefix(self):
+        for i in range(1, 30):
+            self.cmd('SADD', 'test', 's' + str(i))
+            self.cmd('HMSET', 's' + str(i), 'value', i % 3, 'name', 'Descr' if i % 2 else 'Descr1')
+        self.assertEqual(self.cmd('tabular.filter', 'test', 'FILTER', 1, 'value', 'EQUAL', '25'), [])
+        tab = self.cmd('tabular.filter', 'test', 'FILTER', 1, 'name', 'EQUAL', 'Descr1')
+        self.assertEqual(sorted(tab), sorted('s' + str(i) for i in range(2, 30, 2)))
+        tab = self.cmd('tabular.count', 'test', 'FILTER', 1, 'name', 'EQUAL', 'Descr1')
+        self.assertEqual(tab[1:4], ['Descr1', 'count', 14])
+        self.assertEqual(len(tab), 6)
+
     def testFilterEqualNoStore(self):
         for i in range(1, 200):
             self.cmd('SADD', 'test', 's' + str(i))
@@ -323,5 +556,432 @@ class TestRedisTabular(ModuleTestCase('../build/redistabular.so')):
             s = self.cmd('hmget', tab[i], 'value', 'name')
             self.assertTrue(s[0] == '2' and prog.match(s[1]))
 
+    def testIndexFilter(self):
+        for i in range(1, 200):
+            self.cmd('SADD', 'test', 's' + str(i))
+            self.cmd('HMSET', 's' + str(i), 'value', i % 5,
+                    'name', 'Descr' + str(i))
+        self.assertOk(self.cmd('tabular.index', 'create', 'value'))
+        self.cmd('HSET', 's3', 'value', '2')
+        self.cmd('HDEL', 's7', 'value')
+        self.cmd('DEL', 's12')
+        tab = self.cmd('tabular.filter', 'test', 'FILTER', 1, 'value', 'EQUAL', '2')
+        expected = ['s' + str(i) for i in range(1, 200)
+                    if (i % 5 == 2 or i == 3) and i not in (7, 12)]
+        self.assertEqual(sorted(tab), sorted(expected))
+        tab = self.cmd('tabular.count', 'test', 'FILTER', 1, 'value', 'EQUAL', '2')
+        self.assertEqual(tab[3], len(expected))
+        self.assertOk(self.cmd('tabular.index', 'drop', 'value'))
+        with self.assertResponseError():
+            self.cmd('tabular.index', 'drop', 'value')
+
+    def testIndexTrigram(self):
+        names = ['Mizar', 'Altair', 'Arcturus', 'Vega', 'Alcor', 'Rigel']
+        for i in range(1, 200):
+            self.cmd('SADD', 'test', 's' + str(i))
+            self.cmd('HMSET', 's' + str(i), 'name', names[i % 6] + str(i))
+        self.assertOk(self.cmd('tabular.index', 'create', 'name', 'trigram'))
+        self.cmd('HSET', 's1', 'name', 'Polaris')
+        for pattern, prog in [('*ar*', r'.*ar'), ('*GEL1*', r'.*gel1'),
+                              ('a[lr]c*', r'a[lr]c'), ('*aris', r'.*aris$')]:
+            tab = self.cmd('tabular.filter', 'test', 'FILTER', 1, 'name', 'MATCH', pattern)
+            expected = [k for k in self.cmd('smembers', 'test')
+                        if re.match(prog, self.cmd('hget', k, 'name'), re.I)]
+            self.assertEqual(sorted(tab), sorted(expected))
+        self.assertOk(self.cmd('tabular.index', 'drop', 'name'))
+
+    def testIndexSortAlpha(self):
+        for i in range(1, 1000):
+            self.cmd('SADD', 'test', 's' + str(i))
+            self.cmd('HSET', 's' + str(i), 'value', 'Descr' + str(random.randint(0, 50)))
+        self.assertOk(self.cmd('tabular.index', 'create', 'value'))
+        self.cmd('HSET', 's1', 'value', 'A new value')
+        self.cmd('HDEL', 's2', 'value')
+        for order in ['alpha', 'revalpha']:
+            self.assertOk(self.cmd('tabular.get', 'test', 0, 1000, 'store', 'services_sort',
+                                   'SORT', 1, 'value', order, 'NULLS', 'LAST'))
+            tab = self.cmd('sort', 'services_sort', 'by', 'nosort', 'get', '*->value')
+            self.assertEqual(tab[-1], None)
+            values = tab[:-1]
+            self.assertEqual(values, sorted(values, reverse=(order == 'revalpha')))
+            self.assertTrue('A new value' in values)
+        self.assertOk(self.cmd('tabular.index', 'drop', 'value'))
+
+    def testIndexFilterSorted(self):
+        for i in range(1, 100):
+            self.cmd('SADD', 'test', 's' + str(i))
+            self.cmd('HSET', 's' + str(i), 'value', 'Descr' + str(i % 7))
+        self.assertOk(self.cmd('tabular.index', 'create', 'value'))
+        tab = self.cmd('tabular.get', 'test', 0, 100, 'SORT', 1, 'value', 'REVALPHA',
+                       'FILTER', 1, 'value', 'IN', 'bag')
+        self.assertEqual(tab, [0])
+        self.cmd('SADD', 'bag', 'Descr2', 'Descr5')
+        self.assertOk(self.cmd('tabular.get', 'test', 0, 100, 'STORE', 'result', 'SORT', 1,
+                               'value', 'REVALPHA', 'FILTER', 1, 'value', 'IN', 'bag'))
+        tab = self.cmd('sort', 'result', 'by', 'nosort', 'get', '*->value')
+        self.assertEqual(tab, ['Descr5'] * 14 + ['Descr2'] * 14)
+        tab = self.cmd('tabular.count', 'test', 'FILTER', 1, 'value', 'MATCH', 'Descr[13]')
+        self.assertEqual(dict(zip(tab[1::6], tab[3::6])), {'Descr1': 15, 'Descr3': 14})
+
+    def testIndexReload(self):
+        for i in range(1, 200):
+            self.cmd('SADD', 'test', 's' + str(i))
+            self.cmd('HMSET', 's' + str(i), 'value', i % 5)
+        self.assertOk(self.cmd('tabular.index', 'create', 'value', 'trigram'))
+        self.cmd('debug', 'reload')
+        self.assertEqual(self.cmd('type', 'tabular:index:value'), 'tab-index')
+        self.cmd('HSET', 's5', 'value', '3')
+        tab = self.cmd('tabular.filter', 'test', 'FILTER', 1, 'value', 'EQUAL', '3')
+        expected = ['s' + str(i) for i in range(1, 200) if i % 5 == 3 or i == 5]
+        self.assertEqual(sorted(tab), sorted(expected))
+        self.cmd('flushdb')
+        with self.assertResponseError():
+            self.cmd('tabular.index', 'drop', 'value')
+
+    def testMerge(self):
+        values = {}
+        with self.spawn_server() as other:
+            client = other.client()
+            for i in range(1, 50):
+                v = random.randint(0, 999)
+                self.cmd('SADD', 'test', 'a' + str(i))
+                self.cmd('HSET', 'a' + str(i), 'value', v)
+                values['a' + str(i)] = v
+                v = random.randint(0, 999)
+                client.execute_command('SADD', 'test', 'b' + str(i))
+                client.execute_command('HSET', 'b' + str(i), 'value', v)
+                values['b' + str(i)] = v
+            self.assertOk(self.cmd('tabular.get', 'test', 0, 9, 'STORE', 'part1',
+                                   'SORT', 1, 'value', 'NUM'))
+            tab = client.execute_command('tabular.get', 'test', 0, 9, 'SORT', 1,
+                                         'value', 'NUM', 'WITHFIELDS', 1, 'value')
+        for row in tab[1:]:
+            self.cmd('RPUSH', 'part2', *row)
+        self.cmd('SET', 'part2:size', tab[0])
+
+        tab = self.cmd('tabular.merge', 0, 9, 'SOURCES', 2, 'part1', 'part2',
+                       'SORT', 1, 'value', 'NUM')
+        self.assertEqual(tab[0], 98)
+        expected = sorted(values.keys(), key=lambda k: (values[k], k))[:10]
+        self.assertEqual(tab[1:], expected)
+        with self.assertResponseError():
+            self.cmd('tabular.merge', 0, 9, 'SOURCES', 1, 'test', 'SORT', 1, 'value', 'NUM')
+        self.assertEqual(self.cmd('command', 'getkeys', 'tabular.merge', 0, 9, 'SOURCES', 2,
+                                  'part1', 'part2', 'STORE', 'merged', 'SORT', 1, 'value', 'NUM'),
+                         ['part1', 'part2', 'merged'])
+
+    def testReadOnly(self):
+        for i in range(1, 30):
+            self.cmd('SADD', 'test', 's' + str(i))
+            self.cmd('HMSET', 's' + str(i), 'value', i, 'name', 'Descr' + str(i % 3))
+        self.cmd('SADD', 'bag', 'Descr1')
+        self.assertEqual(self.cmd('tabular.ro_get', 'test', 0, 5, 'SORT', 1, 'value', 'NUM'),
+                         self.cmd('tabular.get', 'test', 0, 5, 'SORT', 1, 'value', 'NUM'))
+        self.assertEqual(sorted(self.cmd('tabular.ro_filter', 'test', 'FILTER', 1, 'name', 'IN', 'bag')),
+                         sorted(self.cmd('tabular.filter', 'test', 'FILTER', 1, 'name', 'IN', 'bag')))
+        self.assertEqual(self.cmd('tabular.ro_count', 'test', 'FILTER', 1, 'name', 'MATCH', '*'),
+                         self.cmd('tabular.count', 'test', 'FILTER', 1, 'name', 'MATCH', '*'))
+        with self.assertResponseError():
+            self.cmd('tabular.ro_get', 'test', 0, 5, 'STORE', 'result')
+        self.assertEqual(self.cmd('command', 'getkeys', 'tabular.ro_filter', 'test',
+                                  'UNION', 1, 'other', 'FILTER', 1, 'name', 'IN', 'bag'),
+                         ['test', 'other', 'bag'])
+
+    def testCache(self):
+        for i in range(1, 30):
+            self.cmd('SADD', 'test', 's' + str(i))
+            self.cmd('HMSET', 's' + str(i), 'value', i)
+        self.cmd('SADD', 'bag', 5)
+        stats = self.cmd('tabular.cache', 'stats')
+        hits = dict(zip(stats[::2], stats[1::2]))['hits']
+        query = ('tabular.get', 'test', 0, 2, 'SORT', 1, 'value', 'REVNUM')
+        self.assertEqual(self.cmd(*query), [29, 's29', 's28', 's27'])
+        self.assertEqual(self.cmd(*query), [29, 's29', 's28', 's27'])
+        self.assertEqual(self.cmd('tabular.ro_get', *query[1:]), [29, 's29', 's28', 's27'])
+        self.assertEqual(self.cmd('dbsize'), 31)
+        stats = self.cmd('tabular.cache', 'stats')
+        self.assertEqual(dict(zip(stats[::2], stats[1::2]))['hits'], hits + 2)
+        self.cmd('HSET', 's1', 'value', 100)
+        self.assertEqual(self.cmd(*query), [29, 's1', 's29', 's28'])
+        query = ('tabular.get', 'test', 0, 5, 'FILTER', 1, 'value', 'IN', 'bag')
+        self.assertEqual(self.cmd(*query), [1, 's5'])
+        self.cmd('SADD', 'bag', 100)
+        self.assertEqual(sorted(self.cmd(*query)[1:]), ['s1', 's5'])
+        self.cmd('FLUSHDB')
+        self.assertEqual(self.cmd(*query), [0])
+        self.cmd('tabular.cache', 'size', 0)
+        stats = self.cmd('tabular.cache', 'stats')
+        self.assertEqual(dict(zip(stats[::2], stats[1::2]))['entries'], 0)
+        self.cmd('tabular.cache', 'size', 32 * 1024 * 1024)
+
+    def testCacheLargeReply(self):
+        for i in range(1, 30):
+            self.cmd('SADD', 'test', 's' + str(i))
+            self.cmd('HMSET', 's' + str(i), 'value', i, 'descr', 'x' * 100000)
+        self.cmd('tabular.cache', 'clear')
+        self.cmd('tabular.cache', 'size', 1024 * 1024)
+        self.cmd('tabular.get', 'test', 0, 2, 'SORT', 1, 'value', 'NUM')
+        stats = self.cmd('tabular.cache', 'stats')
+        evictions = dict(zip(stats[::2], stats[1::2]))['evictions']
+        self.cmd('tabular.get', 'test', 0, 29, 'SORT', 1, 'value', 'NUM', 'WITHFIELDS', 1, 'descr')
+        stats = self.cmd('tabular.cache', 'stats')
+        stats = dict(zip(stats[::2], stats[1::2]))
+        self.assertEqual(stats['entries'], 1)
+        self.assertEqual(stats['evictions'], evictions)
+        self.cmd('tabular.cache', 'size', 32 * 1024 * 1024)
+
+    def testCacheManyDependencies(self):
+        for i in range(1, 3000):
+            self.cmd('SADD', 'test', 's' + str(i))
+            self.cmd('HMSET', 's' + str(i), 'value', i)
+        self.cmd('SADD', 'small', 's1', 's2')
+        self.cmd('tabular.cache', 'clear')
+        self.cmd('tabular.cache', 'size', 64 * 1024)
+        self.cmd('tabular.get', 'small', 0, 2, 'SORT', 1, 'value', 'NUM')
+        stats = self.cmd('tabular.cache', 'stats')
+        evictions = dict(zip(stats[::2], stats[1::2]))['evictions']
+        # A short reply depending on too many rows is not cached
+        self.assertEqual(self.cmd('tabular.get', 'test', 0, 2, 'SORT', 1, 'value', 'NUM'),
+                         [2999, 's1', 's2', 's3'])
+        stats = self.cmd('tabular.cache', 'stats')
+        stats = dict(zip(stats[::2], stats[1::2]))
+        self.assertEqual(stats['entries'], 1)
+        self.assertEqual(stats['evictions'], evictions)
+        self.assertLessEqual(stats['memory'], 64 * 1024)
+        self.cmd('tabular.cache', 'size', 32 * 1024 * 1024)
+
+    def testSince(self):
+        for i in range(1, 30):
+            self.cmd('SADD', 'test', 's' + str(i))
+            self.cmd('HMSET', 's' + str(i), 'value', i)
+        query = ('tabular.get', 'test', 0, 2, 'SORT', 1, 'value', 'NUM')
+        tab = self.cmd(*(query + ('SINCE', 0)))
+        self.assertEqual(tab[1:], [29, 'FULL', 's1', 's2', 's3'])
+        token = tab[0]
+        tab = self.cmd(*(query + ('SINCE', token)))
+        self.assertEqual(tab, [token, 29, 'DELTA', [], [], []])
+        self.cmd('HSET', 's2', 'value', 100)
+        tab = self.cmd(*(query + ('SINCE', token)))
+        self.assertNotEqual(tab[0], token)
+        self.assertEqual(tab[1:], [29, 'DELTA', ['s2'], [2, 's4'], []])
+        self.cmd('HSET', 's1', 'value', 3.5)
+        tab = self.cmd(*(query + ('SINCE', tab[0])))
+        self.assertEqual(tab[1:], [29, 'DELTA', [], [], [0, 's3']])
+        tab = self.cmd('tabular.get', 'test', 0, 5, 'SINCE', tab[0])
+        self.assertEqual(tab[2], 'FULL')
+        with self.assertResponseError():
+            self.cmd('tabular.get', 'test', 0, 2, 'STORE', 'result', 'SINCE', 0)
+
+    def testSinceVersions(self):
+        for i in range(1, 30):
+            self.cmd('SADD', 'test', 's' + str(i))
+            self.cmd('HMSET', 's' + str(i), 'value', i)
+        query = ('tabular.get', 'test', 0, 2, 'SORT', 1, 'value', 'NUM')
+        token = self.cmd(*(query + ('SINCE', 0)))[0]
+        for i in range(1000):
+            self.cmd('tabular.get', 'test', i % 20, i % 20 + 2, 'SINCE', 0)
+        self.assertEqual(self.cmd(*(query + ('SINCE', token))), [token, 29, 'DELTA', [], [], []])
+        for i in range(100):
+            self.cmd('tabular.get', 'test', 0, 2, 'SINCE', 0)
+        self.assertEqual(self.cmd(*(query + ('SINCE', token)))[2], 'FULL')
+
+    def testApprox(self):
+        for i in range(1, 2001):
+            self.cmd('SADD', 'test', 's' + str(i))
+            self.cmd('HMSET', 's' + str(i), 'value', i)
+        exact = len([i for i in range(1, 2001) if '1' in str(i)])
+        query = ('tabular.get', 'test', 0, 4, 'FILTER', 1, 'value', 'MATCH', '*1*')
+        self.assertEqual(self.cmd(*query)[0], exact)
+        tab = self.cmd(*(query + ('NOCOUNT',)))
+        self.assertEqual(tab[0], -1)
+        self.assertEqual(len(tab), 6)
+        tab = self.cmd(*(query + ('APPROX',)))
+        self.assertEqual(len(tab), 6)
+        self.assertLessEqual(abs(tab[0][0] - exact), 3 * tab[0][1])
+        tab = self.cmd(*(query + ('SORT', 1, 'value', 'NUM', 'APPROX')))
+        self.assertEqual(tab[0], [exact, 0])
+        self.assertEqual(tab[1:], ['s1', 's10', 's11', 's12', 's13'])
+        tab = self.cmd('tabular.get', 'test', 0, 4, 'FILTER', 1, 'value', 'EQUAL', '15', 'NOCOUNT')
+        self.assertEqual(tab, [1, 's15'])
+
+    def testWindows(self):
+        for i in range(1, 30):
+            self.cmd('SADD', 'test', 's' + str(i))
+            self.cmd('HMSET', 's' + str(i), 'value', i)
+        tab = self.cmd('tabular.get', 'test', 'WINDOWS', 3, 0, 1, 5, 4, 28, 40,
+                       'SORT', 1, 'value', 'REVNUM')
+        self.assertEqual(tab, [29, ['s29', 's28'], ['s25', 's24'], ['s1']])
+        tab = self.cmd('tabular.get', 'test', 'WINDOWS', 2, 0, 0, 30, 31,
+                       'SORT', 1, 'value', 'NUM', 'WITHFIELDS', 1, 'value')
+        self.assertEqual(tab, [29, [['s1', '1']], []])
+        with self.assertResponseError():
+            self.cmd('tabular.get', 'test', 'WINDOWS', 2, 0, 1)
+        with self.assertResponseError():
+            self.cmd('tabular.get', 'test', 'WINDOWS', 1, 0, 1, 'STORE', 'result')
+
+    def testBatch(self):
+        for i in range(1, 30):
+            self.cmd('SADD', 'test', 's' + str(i))
+            self.cmd('HMSET', 's' + str(i), 'value', i, 'name', 'Descr' + str(i % 3))
+        # Rows without hash
+        self.cmd('SADD', 'test', 's100', 's101')
+        self.cmd('SET', 's101', 'foobar')
+        # The direct queries must not be answered from the replies cached by the batch
+        self.cmd('tabular.cache', 'size', 0)
+        get = ('0', '2', 'SORT', '1', 'value', 'REVNUM', 'FILTER', '1', 'name', 'EQUAL', 'Descr1')
+        count = ('FILTER', '1', 'name', 'MATCH', 'Descr[12]')
+        tab = self.cmd('tabular.batch', 'test', 3, 'GET', len(get), *(get + ('COUNT', len(count)) + count
+                       + ('COUNT', 3, 'FACETS', 1, 'name')))
+        self.assertEqual(tab[0], [10, 's28', 's25', 's22'])
+        self.assertEqual(tab[0], self.cmd('tabular.get', 'test', *get))
+        self.assertEqual(tab[1], self.cmd('tabular.count', 'test', *count))
+        self.assertEqual(tab[2], ['name', ['Descr1', 10L, 'Descr2', 10L, 'Descr0', 9L]])
+        self.assertEqual(tab[2], self.cmd('tabular.count', 'test', 'FACETS', 1, 'name'))
+        self.cmd('tabular.cache', 'size', 32 * 1024 * 1024)
+        with self.assertResponseError():
+            self.cmd('tabular.batch', 'test', 2, 'GET', 2, 0, 1)
+        with self.assertResponseError():
+            self.cmd('tabular.batch', 'test', 1, 'FILTER', 0)
+
+    def testCounter(self):
+        for i in range(1, 30):
+            self.cmd('SADD', 'test', 's' + str(i))
+            self.cmd('HMSET', 's' + str(i), 'value', i, 'name', 'Descr' + str(i % 3))
+        self.assertOk(self.cmd('tabular.counter', 'create', 'byname', 'test', 'name'))
+        self.assertEqual(self.cmd('tabular.counter', 'get', 'byname'),
+                         [['Descr0', 9], ['Descr1', 10], ['Descr2', 10]])
+        self.cmd('HSET', 's1', 'name', 'Descr0')
+        self.cmd('HDEL', 's2', 'name')
+        self.cmd('DEL', 's4')
+        self.cmd('SREM', 'test', 's3')
+        self.cmd('SADD', 'test', 's30')
+        self.cmd('HSET', 's30', 'name', 'Descr3')
+        self.assertEqual(self.cmd('tabular.counter', 'get', 'byname'),
+                         [['Descr0', 9], ['Descr1', 8], ['Descr2', 9], ['Descr3', 1], [None, 2]])
+        with self.assertResponseError():
+            self.cmd('tabular.counter', 'create', 'byname', 'test', 'value')
+        self.assertOk(self.cmd('tabular.counter', 'drop', 'byname'))
+        with self.assertResponseError():
+            self.cmd('tabular.counter', 'get', 'byname')
+        self.assertEqual(self.cmd('command', 'getkeys', 'tabular.counter', 'create',
+                                  'byname', 'test', 'name'), ['test'])
+
+    def testExplain(self):
+        for i in range(1, 30):
+            self.cmd('SADD', 'test', 's' + str(i))
+            self.cmd('HMSET', 's' + str(i), 'value', i, 'name', 'Descr' + str(i % 3))
+        stats = self.cmd('tabular.stats', 'test', 'name')
+        stats = dict(zip(stats[::2], stats[1::2]))
+        self.assertEqual(stats['rows'], 29)
+        self.assertEqual(stats['nulls'], 0)
+        self.assertEqual(stats['distinct'], 3)
+        self.assertEqual(stats['mcv'], ['Descr1', 10, 'Descr2', 10, 'Descr0', 9])
+        self.assertEqual(len(stats['histogram']), 11)
+        query = ('test', 0, 2, 'SORT', 1, 'value', 'NUM', 'FILTER', 1, 'name', 'EQUAL', 'Descr1')
+        self.assertEqual(self.cmd('tabular.explain', 'analyze', *query),
+                         [['scan', 'test', 29, 29], ['filter', 'name EQUAL Descr1', 10, 10],
+                          ['top-k', 'value', 10, 10], ['window', 'rows 0..2', 3, 3]])
+        tab = self.cmd('tabular.explain', *query)
+        self.assertEqual([stage[3] for stage in tab], [None] * 4)
+        self.assertEqual(self.cmd('tabular.get', *query), [10, 's1', 's4', 's7'])
+        query = ('test', 0, 2, 'UNION', 1, 'other', 'FILTER', 1, 'name', 'IN', 'bag')
+        self.assertEqual(self.cmd('command', 'getkeys', 'tabular.explain', *query),
+                         ['test', 'other', 'bag'])
+        self.assertEqual(self.cmd('command', 'getkeys', 'tabular.explain', 'analyze', *query),
+                         ['test', 'other', 'bag'])
+
+    def testPacked(self):
+        for i in range(1, 30):
+            self.cmd('SADD', 'test', 's' + str(i))
+            self.cmd('HMSET', 's' + str(i), 'value', i, 'name', 'Descr' + str(i % 3))
+        self.assertEqual(self.cmd('tabular.get', 'test', 0, 1, 'SORT', 1, 'value', 'NUM', 'FORMAT', 'PACKED'),
+                         '*\x03:\x3a$\x02s1$\x02s2')
+        query = ('tabular.get', 'test', 0, 2, 'SORT', 1, 'value', 'NUM', 'WITHFIELDS', 1, 'name')
+        self.assertEqual(unpack(self.cmd(*(query + ('FORMAT', 'PACKED'))))[0], self.cmd(*query))
+        data = self.cmd('tabular.count', 'test', 'FILTER', 1, 'name', 'MATCH', '*',
+                        'AGGREGATE', 1, 'SUM', 'value', 'FORMAT', 'PACKED')
+        aggs, pos = varint(data, 0)
+        self.assertEqual(aggs, 1)
+        n, pos = varint(data, pos)
+        self.assertEqual(data[pos:pos + n], 'sum(value)')
+        nodes, pos = varint(data, pos + n)
+        self.assertEqual(nodes, 3)
+        groups = {}
+        for _ in range(nodes):
+            parent, pos = varint(data, pos)
+            n, pos = varint(data, pos)
+            value = data[pos:pos + n]
+            count, pos = varint(data, pos + n)
+            groups[value] = (parent, count, struct.unpack('<d', data[pos:pos + 8])[0])
+            pos += 8
+        self.assertEqual(pos, len(data))
+        self.assertEqual(groups, {'Descr0': (0, 9, 135.0), 'Descr1': (0, 10, 145.0), 'Descr2': (0, 10, 155.0)})
+        with self.assertResponseError():
+            self.cmd('tabular.get', 'test', 0, 1, 'STORE', 'out', 'FORMAT', 'PACKED')
+        with self.assertResponseError():
+            self.cmd('tabular.count', 'test', 'FILTER', 1, 'name', 'MATCH', '*', 'FACETS', 1, 'value', 'FORMAT', 'PACKED')
+        with self.assertResponseError():
+            self.cmd('tabular.get', 'test', 0, 1, 'FORMAT', 'JSON')
+
+    def testLargeBounds(self):
+        for i in range(1, 30):
+            self.cmd('SADD', 'test', 's' + str(i))
+            self.cmd('HMSET', 's' + str(i), 'value', i, 'name', 'Descr' + str(i % 3))
+        big = 9223372036854775807
+        tab = self.cmd('tabular.get', 'test', 0, big, 'SORT', 1, 'value', 'NUM')
+        self.assertEqual(tab, [29] + ['s' + str(i) for i in range(1, 30)])
+        tab = self.cmd('tabular.get', 'test', big - 1, big, 'SORT', 1, 'value', 'NUM')
+        self.assertEqual(tab, [0])
+        tab = self.cmd('tabular.get', 'test', -5, 2, 'SORT', 1, 'value', 'NUM')
+        self.assertEqual(tab, [29, 's1', 's2', 's3'])
+        tab = self.cmd('tabular.get', 'test', -3, -1, 'SORT', 1, 'value', 'NUM')
+        self.assertEqual(tab, [0])
+        tab = self.cmd('tabular.get', 'test', 'WINDOWS', 2, 27, big, -big - 1, 0,
+                       'SORT', 1, 'value', 'NUM')
+        self.assertEqual(tab, [29, ['s28', 's29'], ['s1']])
+        tab = self.cmd('tabular.get', 'test', 0, big, 'FILTER', 1, 'name', 'EQUAL', 'Descr0',
+                       'NOCOUNT')
+        self.assertEqual(len(tab), 10)
+
+    def testJoin(self):
+        for i in range(1, 4):
+            self.cmd('HSET', 'host' + str(i), 'name', 'Host' + str(4 - i))
+        for i in range(1, 30):
+            self.cmd('SADD', 'test', 's' + str(i))
+            self.cmd('HMSET', 's' + str(i), 'value', i, 'host_id', 'host' + str(i % 3 + 1))
+        tab = self.cmd('tabular.get', 'test', 0, 3, 'SORT', 2, 'host_id->name', 'ALPHA',
+                       'value', 'NUM', 'WITHFIELDS', 1, 'host_id->name')
+        self.assertEqual(tab, [29, ['s2', 'Host1'], ['s5', 'Host1'], ['s8', 'Host1'], ['s11', 'Host1']])
+        tab = self.cmd('tabular.get', 'test', 0, 1, 'SORT', 1, 'value', 'NUM',
+                       'FILTER', 1, 'host_id->name', 'EQUAL', 'Host3')
+        self.assertEqual(tab, [9, 's3', 's6'])
+        tab = self.cmd('tabular.count', 'test', 'FILTER', 1, 'host_id->name', 'MATCH', '*')
+        self.assertEqual(sorted(tab[i] for i in range(3, len(tab), 6)), [9, 10, 10])
+        self.cmd('HSET', 'host3', 'name', 'Host0')
+        self.cmd('HDEL', 's2', 'host_id')
+        tab = self.cmd('tabular.get', 'test', 0, 3, 'SORT', 2, 'host_id->name', 'ALPHA',
+                       'value', 'NUM', 'WITHFIELDS', 1, 'host_id->name')
+        self.assertEqual(tab, [29, ['s2', None], ['s5', 'Host0'], ['s8', 'Host0'], ['s11', 'Host0']])
+        with self.assertResponseError():
+            self.cmd('tabular.index', 'create', 'host_id->name')
+
+    def testKeyField(self):
+        for i in range(1, 30):
+            self.cmd('SADD', 'test', 's' + str(i))
+            self.cmd('HMSET', 's' + str(i), 'value', i, 'name', 'Descr' + str(i % 3))
+        tab = self.cmd('tabular.get', 'test', 0, 3, 'SORT', 1, '@key', 'REVALPHA',
+                       'FILTER', 1, '@key', 'MATCH', 's2*')
+        self.assertEqual(tab, [11, 's29', 's28', 's27', 's26'])
+        tab = self.cmd('tabular.get', 'test', 0, 1, 'SORT', 1, 'value', 'NUM',
+                       'FILTER', 2, '@key', 'MATCH', 's1*', 'name', 'EQUAL', 'Descr1',
+                       'WITHFIELDS', 1, '@key')
+        self.assertEqual(tab, [5, ['s1', 's1'], ['s10', 's10']])
+        self.assertEqual(self.cmd('tabular.filter', 'test', 'FILTER', 1, '@key', 'EQUAL', 's7'),
+                         ['s7'])
+        plan = self.cmd('tabular.explain', 'test', 0, 1, 'FILTER', 1, '@key', 'MATCH', 's2*')
+        self.assertEqual(plan[1][:3], ['key', '@key MATCH s2*', 11])
+        with self.assertResponseError():
+            self.cmd('tabular.index', 'create', '@key')
+
 if __name__ == '__main__':
     unittest.main()